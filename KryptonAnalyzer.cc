@@ -36,27 +36,79 @@
 #include <TTree.h>
 #include <TStyle.h>
 
+#include <TROOT.h>
+
+#include <atomic>
 #include <cmath>
 #include <fstream>
+#include <memory>
+#include <mutex>
+#include <sstream>
 #include <string>
+#include <thread>
 
 #include <boost/filesystem.hpp>
 
+#include <csignal>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
 using namespace std;
 using namespace modutils;
 
 /// Main function.
 int main(int argc, char* argv[])
+{
+  const vector<string> argumentsVector(argv + 1, argv + argc);
+
+  //Daemon mode, and jobs sent to a running daemon.
+  if (!argumentsVector.empty() && (argumentsVector.front() == string("--daemon") ||
+				   argumentsVector.front() == string("--submit"))) {
+    if (argumentsVector.size() < 2 || argumentsVector[1].rfind("-",0) != string::npos) {
+      cout << "[ERROR] No socket path provided with argument " << argumentsVector.front()
+	   << "!" << endl;
+      DisplayUsage();
+    }
+    if (argumentsVector.front() == string("--daemon"))
+      return RunDaemon(argumentsVector[1]);
+    DaemonJob job;
+    job.fDirectory = boost::filesystem::current_path().string();
+    job.fArguments.assign(argumentsVector.begin() + 2,argumentsVector.end());
+    return SubmitDaemonJob(argumentsVector[1],job);
+  }
+
+  return RunAnalysis(argumentsVector);
+}
+
+int RunAnalysis(const vector<string>& argumentsVector)
 {
   int exitCode = 0;
 
-  const vector<string> argumentsVector(argv + 1, argv + argc);
   vector<string> filenamesVector;
 
   string configFilename = "Config.txt";
   string outputPrefix;
   string previousGainsFilename;
   bool updateGains = false;
+  double memoryBudget = 0;
+  unsigned int nThreads = 1;
+  unsigned int nTimeBins = 1;
+  unsigned int nIterations = 1;
+  double iterationTolerance = 1e-3;
+  unsigned int fineBinFactor = 0;
+  unsigned int nDriftBins = 0;
+  bool channelStatus = false;
+  double hotPadFactor = 0;
+  bool validateInputs = false;
+  bool validateBaskets = false;
+  bool sectorSpectraOutput = false;
+  int compression = -1;
+  unsigned int nWriteThreads = 1;
+  bool numaPlacement = false;
+  string fillMode = "auto";
+  bool padSort = true;
+  string processingOrder = "file";
+  string refitFilename;
   for (auto it = argumentsVector.begin(), itEnd = argumentsVector.end(); 
        it != itEnd; ++it) {
     if (*it == string("-h") || *it == string("--help")) {
@@ -89,6 +141,177 @@ int main(int argc, char* argv[])
       updateGains = true;
       cout << "[INFO] User-provided gains file: " << previousGainsFilename << endl;
     }
+    else if (*it == string("--memory-budget")) {
+      if (next(it) == itEnd || next(it)->rfind("-",0) != string::npos) {
+	cout << "[ERROR] No budget in MB provided with argument --memory-budget!" << endl;
+	DisplayUsage();
+      }
+      advance(it,1);
+      memoryBudget = 1e6*ParseDoubleArgument("--memory-budget",*it);
+      cout << "[INFO] Memory budget: " << *it << " MB" << endl;
+    }
+    else if (*it == string("-j") || *it == string("--threads")) {
+      if (next(it) == itEnd || next(it)->rfind("-",0) != string::npos) {
+	cout << "[ERROR] No number of threads provided with argument -j!" << endl;
+	DisplayUsage();
+      }
+      advance(it,1);
+      nThreads = max(1,ParseIntArgument("-j",*it));
+      cout << "[INFO] Number of filling threads: " << nThreads << endl;
+    }
+    else if (*it == string("--time-bins")) {
+      if (next(it) == itEnd || next(it)->rfind("-",0) != string::npos) {
+	cout << "[ERROR] No number of time bins provided with argument --time-bins!" << endl;
+	DisplayUsage();
+      }
+      advance(it,1);
+      nTimeBins = max(1,ParseIntArgument("--time-bins",*it));
+      cout << "[INFO] Number of time (file sequence) bins: " << nTimeBins << endl;
+    }
+    else if (*it == string("--iterations")) {
+      if (next(it) == itEnd || next(it)->rfind("-",0) != string::npos) {
+	cout << "[ERROR] No number of iterations provided with argument --iterations!" << endl;
+	DisplayUsage();
+      }
+      advance(it,1);
+      nIterations = max(1,ParseIntArgument("--iterations",*it));
+      cout << "[INFO] Maximum number of calibration iterations: " << nIterations << endl;
+    }
+    else if (*it == string("--iteration-tolerance")) {
+      if (next(it) == itEnd || next(it)->rfind("-",0) != string::npos) {
+	cout << "[ERROR] No tolerance provided with argument --iteration-tolerance!" << endl;
+	DisplayUsage();
+      }
+      advance(it,1);
+      iterationTolerance = ParseDoubleArgument("--iteration-tolerance",*it);
+      cout << "[INFO] Iteration tolerance (relative gain change): " << iterationTolerance << endl;
+    }
+    else if (*it == string("--fine-bins")) {
+      if (next(it) == itEnd || next(it)->rfind("-",0) != string::npos) {
+	cout << "[ERROR] No bin factor provided with argument --fine-bins!" << endl;
+	DisplayUsage();
+      }
+      advance(it,1);
+      fineBinFactor = max(1,ParseIntArgument("--fine-bins",*it));
+      cout << "[INFO] Uncorrected spectra with " << fineBinFactor
+	   << " times finer bins. Gains applied by bin remapping." << endl;
+    }
+    else if (*it == string("--drift-bins")) {
+      if (next(it) == itEnd || next(it)->rfind("-",0) != string::npos) {
+	cout << "[ERROR] No number of time slice bins provided with argument --drift-bins!" << endl;
+	DisplayUsage();
+      }
+      advance(it,1);
+      nDriftBins = min((int)kMaxDriftTimeSlice,max(2,ParseIntArgument("--drift-bins",*it)));
+      cout << "[INFO] Charge vs. drift time in " << nDriftBins << " time slice bins." << endl;
+    }
+    else if (*it == string("--channel-status")) {
+      channelStatus = true;
+      cout << "[INFO] Channel status from running pad statistics." << endl;
+    }
+    else if (*it == string("--exclude-hot-pads")) {
+      if (next(it) == itEnd || next(it)->rfind("-",0) != string::npos) {
+	cout << "[ERROR] No factor provided with argument --exclude-hot-pads!" << endl;
+	DisplayUsage();
+      }
+      advance(it,1);
+      hotPadFactor = ParseDoubleArgument("--exclude-hot-pads",*it);
+      channelStatus = true;
+      cout << "[INFO] Excluding pads with more than " << hotPadFactor
+	   << " times the sector median of clusters during the fill." << endl;
+    }
+    else if (*it == string("--validate")) {
+      validateInputs = true;
+      cout << "[INFO] Validating input files before the analysis." << endl;
+    }
+    else if (*it == string("--validate-baskets")) {
+      validateInputs = true;
+      validateBaskets = true;
+      cout << "[INFO] Validating input files, reading all baskets, before the analysis." << endl;
+    }
+    else if (*it == string("--sector-spectra")) {
+      sectorSpectraOutput = true;
+      cout << "[INFO] Pad spectra written as one 2D histogram per sector." << endl;
+    }
+    else if (*it == string("--compression")) {
+      if (next(it) == itEnd || next(it)->rfind("-",0) != string::npos) {
+	cout << "[ERROR] No setting provided with argument --compression!" << endl;
+	DisplayUsage();
+      }
+      advance(it,1);
+      compression = ParseCompressionSetting(*it);
+      if (compression < 0) {
+	cout << "[ERROR] Invalid compression setting " << *it
+	     << "! Use algorithm:level with zlib, lzma, lz4 or zstd and level 1-9, or none." << endl;
+	DisplayUsage();
+      }
+      cout << "[INFO] Output compression: " << *it << endl;
+    }
+    else if (*it == string("--write-threads")) {
+      if (next(it) == itEnd || next(it)->rfind("-",0) != string::npos) {
+	cout << "[ERROR] No number of threads provided with argument --write-threads!" << endl;
+	DisplayUsage();
+      }
+      advance(it,1);
+      nWriteThreads = max(1,ParseIntArgument("--write-threads",*it));
+      cout << "[INFO] Number of output writing threads: " << nWriteThreads << endl;
+    }
+    else if (*it == string("--refit")) {
+      if (next(it) == itEnd || next(it)->rfind("-",0) != string::npos) {
+	cout << "[ERROR] No previous output file provided with argument --refit!" << endl;
+	DisplayUsage();
+      }
+      advance(it,1);
+      refitFilename = *it;
+      cout << "[INFO] Refitting the pad spectra of " << refitFilename
+	   << ". Input files are not read." << endl;
+    }
+    else if (*it == string("--fill-mode")) {
+      if (next(it) == itEnd || next(it)->rfind("-",0) != string::npos) {
+	cout << "[ERROR] No mode provided with argument --fill-mode!" << endl;
+	DisplayUsage();
+      }
+      advance(it,1);
+      fillMode = *it;
+      if (fillMode != "local" && fillMode != "shared" && fillMode != "auto") {
+	cout << "[ERROR] Invalid fill mode " << fillMode << "! Use local, shared or auto." << endl;
+	DisplayUsage();
+      }
+    }
+    else if (*it == string("--order")) {
+      if (next(it) == itEnd || next(it)->rfind("-",0) != string::npos) {
+	cout << "[ERROR] No order provided with argument --order!" << endl;
+	DisplayUsage();
+      }
+      advance(it,1);
+      processingOrder = *it;
+      if (processingOrder != "file" && processingOrder != "sector") {
+	cout << "[ERROR] Invalid order " << processingOrder << "! Use file or sector." << endl;
+	DisplayUsage();
+      }
+    }
+    else if (*it == string("--no-pad-sort")) {
+      padSort = false;
+      cout << "[INFO] Filling clusters in input order, without sorting by pad." << endl;
+    }
+    else if (*it == string("--numa")) {
+      numaPlacement = true;
+      cout << "[INFO] Placing filling threads and their histograms on NUMA nodes." << endl;
+    }
+    else if (*it == string("--perf-counters")) {
+      fPhaseTimer.EnablePerfCounters();
+      cout << "[INFO] Recording hardware counters per phase." << endl;
+    }
+    else if (*it == string("--trace")) {
+      if (next(it) == itEnd || next(it)->rfind("-",0) != string::npos) {
+	cout << "[ERROR] No trace filename provided with argument --trace!" << endl;
+	DisplayUsage();
+      }
+      advance(it,1);
+      fTraceRecorder.Enable(*it);
+      fPhaseTimer.SetTraceRecorder(&fTraceRecorder);
+      cout << "[INFO] Recording trace to file: " << *it << endl;
+    }
     else if (*it == string("-i") || *it == string("--inputFiles")) {
       filenamesVector.assign(next(it),itEnd);
       break;
@@ -99,10 +322,35 @@ int main(int argc, char* argv[])
     }
   }
 
-  if (filenamesVector.size() == 0) {
+  if (filenamesVector.size() == 0 && refitFilename.empty()) {
     cout << "[ERROR] No input filenames provided!" << endl;
     DisplayUsage();
   }
+  //A refit only has the stored (merged, gain-corrected) pad spectra.
+  if (!refitFilename.empty()) {
+    if (nTimeBins > 1 || nIterations > 1 || fineBinFactor > 0 || nDriftBins > 0 ||
+	channelStatus || validateInputs || processingOrder != "file")
+      cout << "[WARNING] Time bins, iterations, fine bins, drift bins, channel status, "
+	   << "validation and sector order need the input files. Ignored with --refit." << endl;
+    filenamesVector.clear();
+    nTimeBins = 1;
+    nIterations = 1;
+    fineBinFactor = 0;
+    nDriftBins = 0;
+    channelStatus = false;
+    hotPadFactor = 0;
+    validateInputs = false;
+    processingOrder = "file";
+  }
+  //Hot pads are excluded on the counts of the files read so far. In file
+  //order, threads would each see other files, so the exclusions would
+  //depend on the thread count and scheduling. In sector order all files
+  //of a sector are read by one thread, in file order, as with one thread.
+  if (hotPadFactor > 0 && nThreads > 1 && processingOrder == "file") {
+    cout << "[INFO] Hot pad exclusion with several threads: using sector order." << endl;
+    processingOrder = "sector";
+  }
+  const bool sectorMajor = (processingOrder == "sector");
   if (outputPrefix.size() == 0) {
     cout << "[ERROR] No output prefix provided!" << endl;
     DisplayUsage();
@@ -111,40 +359,64 @@ int main(int argc, char* argv[])
        << ". Config file: " << configFilename 
        << ". Update previously-calculated gains? " << updateGains << endl;
 
+  fTraceRecorder.SetThreadName("main");
+
   //Manage our own object ownership. Grrr.
   TH1::AddDirectory(kFALSE);
+  if (nThreads > 1 || nWriteThreads > 1)
+    ROOT::EnableThreadSafety();
+
+  //Check all input files in parallel, and quarantine bad ones.
+  if (validateInputs) {
+    filenamesVector = ValidateInputFiles(filenamesVector,validateBaskets,nThreads,
+					 outputPrefix + "-Quarantine.txt");
+    if (filenamesVector.empty()) {
+      cout << "[ERROR] No valid input files!" << endl;
+      return -1;
+    }
+  }
+  if (nTimeBins > 1 && nTimeBins > filenamesVector.size()) {
+    nTimeBins = filenamesVector.size();
+    cout << "[WARNING] More time bins than input files. Using " << nTimeBins
+         << " time bins." << endl;
+  }
 
   //Parse configuration file.
-  ParseConfigFile(configFilename);
+  if (!ParseConfigFile(configFilename))
+    return -1;
+  if (!refitFilename.empty() && !fCutSets.empty()) {
+    cout << "[WARNING] Cut sets need the input files. Ignored with --refit." << endl;
+    fCutSets.clear();
+  }
 
   //Bootstrap XML path is by default in this directory.
   string bootstrapPath = "bootstrap.xml";
 
+  //Read previous gains into memory. The bootstrap file is left untouched.
   if (updateGains) {
-    ReplacePadGainPath(bootstrapPath,string(previousGainsFilename));
+    const unsigned int nPreviousGains = LoadPadGains(previousGainsFilename,fPreviousGains);
+    if (nPreviousGains == 0) {
+      cout << "[ERROR] No pad gains could be read from " << previousGainsFilename << "!" << endl;
+      return -1;
+    }
+    cout << "[INFO] Read " << nPreviousGains << " previous pad gains from "
+         << previousGainsFilename << endl;
   }
 
   //Name and create output file. Use full path.
-  const string& firstInputFile = filenamesVector.front();
+  const string& firstInputFile =
+    (filenamesVector.empty()) ? refitFilename : filenamesVector.front();
   boost::filesystem::path currentPath( boost::filesystem::current_path() );
   const string& currentWorkingDirectory = currentPath.string() + "/";
   boost::filesystem::path inputNameAndPath(firstInputFile);
 
-  //First histogram: No cuts. Second histogram: With cuts.
-  unordered_map<int,unordered_map<int,pair<TH1D*,TH1D*> > > sectorSpectraHistograms;
-  unordered_map<int,unordered_map<int,pair<TH2D*,TH2D*> > > sectorPadEntries;
-  unordered_map<int,unordered_map<int,pair<TH1D*,TH1D*> > > sectorTimeSlices;
-  unordered_map<int,unordered_map<int,pair<TH2D*,TH2D*> > > sectorChargeVsMaxADC;
-  unordered_map<int,unordered_map<int,pair<TH2D*,TH2D*> > > sectorNPadsVsNTimeSlices;
+  //Pad spectra and sector QA, freed on every return. Typedefs are in
+  //KryptonKernels.h. QA first histogram: No cuts. Second histogram: With cuts.
+  DetectorHistograms spectraHistograms;
+  DetectorQAHistograms sectorQAHistograms;
     
-  //Prepare PDF file.
-  TString gainsPDFName = currentWorkingDirectory.c_str() + outputPrefix + ".pdf";
-  TString gainsOpenString = gainsPDFName + "[";
-  TString gainsCloseString = gainsPDFName + "]";
-  TCanvas dummy;
-  dummy.SaveAs(gainsOpenString);
-
   //Get parameters from XML file.
+  PhaseTimer::Scope geometryPhase(fPhaseTimer,"geometryInit");
   fwk::CentralConfig::GetInstance(bootstrapPath);
 
   //Get detector and event interfaces.
@@ -153,14 +425,89 @@ int main(int argc, char* argv[])
   const utl::TimeStamp dummyTime = utl::TimeStamp(1);
   detector.Update(dummyTime,dummyRun);
   const det::TPC& tpc = detector.GetTPC();
+  geometryPhase.Stop();
+
+  //Estimate histogram memory before booking, and check it against the budget.
+  //Each filling thread holds its own copy of all histograms.
+  MemoryReport bookingEstimate = EstimateBookingMemory(tpc);
+  if (!fCutSets.empty())
+    bookingEstimate.Add("cutSetSpectra",fCutSets.size()*bookingEstimate.GetBytes("padSpectra"),
+			fCutSets.size()*bookingEstimate.GetObjects("padSpectra"));
+  //Fine spectra reach down to the lowest acceptable gain.
+  const bool remapGains = (fineBinFactor > 0);
+  const double fineRangeScale =
+    (fMinAcceptableGain > 0 && fMinAcceptableGain < 1) ? 1./fMinAcceptableGain : 1.;
+  if (remapGains)
+    bookingEstimate.Add("fineSpectra",(unsigned long long)
+			(nTimeBins*fineBinFactor*fineRangeScale*bookingEstimate.GetBytes("padSpectra")),
+			nTimeBins*bookingEstimate.GetObjects("padSpectra"));
+  if (nTimeBins > 1)
+    bookingEstimate.Add("timeBinSpectra",nTimeBins*bookingEstimate.GetBytes("padSpectra"),
+			nTimeBins*bookingEstimate.GetObjects("padSpectra"));
+  //Filling threads hold their own copy of all histograms (local), or share
+  //the pad spectra, with atomic bin increments, and only copy the sector QA
+  //(shared). Auto takes shared if the local copies exceed the memory budget.
+  //In sector order each sector is filled by one thread only, so the pad
+  //spectra are shared without atomic increments.
+  const unsigned long long baselineRSS = GetCurrentRSS();
+  bool sharedSpectra = false;
+  bool atomicFill = false;
+  if (nThreads > 1) {
+    const unsigned long long bookedBytes = bookingEstimate.GetTotalBytes();
+    const unsigned long long spectraBytes = bookingEstimate.GetBytes("padSpectra") +
+      bookingEstimate.GetBytes("cutSetSpectra") + bookingEstimate.GetBytes("fineSpectra") +
+      bookingEstimate.GetBytes("timeBinSpectra");
+    sharedSpectra = (sectorMajor || fillMode == "shared" ||
+		     (fillMode == "auto" && memoryBudget > 0 &&
+		      baselineRSS + (nThreads + 1)*bookedBytes > memoryBudget));
+    atomicFill = (sharedSpectra && !sectorMajor);
+    bookingEstimate.Add("workerBanks",nThreads*(sharedSpectra ? bookedBytes - spectraBytes :
+						 bookedBytes),nThreads);
+    cout << "[INFO] Fill mode: "
+	 << (sectorMajor ? "pad spectra of each sector filled by one thread."
+	     : sharedSpectra ? "pad spectra shared by all threads."
+	     : "one copy of the pad spectra per thread.") << endl;
+  }
+  bookingEstimate.Print("Estimated histogram memory");
+  fPhaseTimer.AddReportSection("memoryEstimate",bookingEstimate.ToJSON());
+  if (memoryBudget > 0 && baselineRSS + bookingEstimate.GetTotalBytes() > memoryBudget) {
+    cout << "[ERROR] Estimated memory use of "
+         << (baselineRSS + bookingEstimate.GetTotalBytes())/1e6 << " MB (current RSS "
+         << baselineRSS/1e6 << " MB + histograms " << bookingEstimate.GetTotalBytes()/1e6
+         << " MB) exceeds the memory budget of " << memoryBudget/1e6 << " MB! "
+         << "Reduce the TPC list, histogramBins or histogramPadding, "
+         << "or raise --memory-budget." << endl;
+    return -1;
+  }
 
   //Create output file.
   TString outputFilename = currentWorkingDirectory + outputPrefix + ".root";
   cout << "[INFO] Output filename: " << outputFilename.Data() << endl;  
-  TFile* outputFile = new TFile(outputFilename,"RECREATE");  
+  if (!refitFilename.empty() && boost::filesystem::exists(outputFilename.Data()) &&
+      boost::filesystem::exists(refitFilename) &&
+      boost::filesystem::equivalent(refitFilename,outputFilename.Data())) {
+    cout << "[ERROR] The refit output would overwrite " << refitFilename
+	 << "! Use another output prefix." << endl;
+    return -1;
+  }
+
+  //Prepare PDF file, after the checks that stop the analysis. It is closed
+  //on every later return.
+  TString gainsPDFName = currentWorkingDirectory.c_str() + outputPrefix + ".pdf";
+  TString gainsOpenString = gainsPDFName + "[";
+  TString gainsCloseString = gainsPDFName + "]";
+  TCanvas dummy;
+  dummy.SaveAs(gainsOpenString);
+  RecordOutputFile(gainsPDFName.Data());
+
+  unique_ptr<TFile> outputFile(new TFile(outputFilename,"RECREATE"));
+  RecordOutputFile(outputFilename.Data());
+  if (compression >= 0)
+    outputFile->SetCompressionSettings(compression);
 
 
   //Create one histogram per active pad.
+  PhaseTimer::Scope bookingPhase(fPhaseTimer,"histogramBooking");
   for (auto chamberIt = tpc.ChambersBegin(), chamberEnd = tpc.ChambersEnd();
        chamberIt != chamberEnd; ++chamberIt) {
     const det::TPCChamber& chamber = *chamberIt;
@@ -194,336 +541,356 @@ int main(int argc, char* argv[])
 	    fMinADCPeakSearchVTPC1Upstream : fMinADCPeakSearch;
 
           const double histogramMax = minADCPeakSearch*fHistogramPadding;
-          TH1D* histogram = new TH1D(nameString,titleString,fHistogramBins,0,histogramMax);
-          fSpectraHistograms[tpcId][sectorId][padrowId][padId] = histogram;
+          spectraHistograms[tpcId][sectorId][padrowId][padId].reset(
+	    new TH1D(nameString,titleString,fHistogramBins,0,histogramMax));
         } //End pad loop.
       } //End padrow loop.
     } //End sector loop.
   } //End TPC loop.
+  bookingPhase.Stop();
   
-  //Variables to fill.
-  Float16_t fCharge = 0;
-  UShort_t fMaxADC = 0;
-  UShort_t fTimeSlice = 0;
-  UShort_t fNPixels = 0;
-  UChar_t fNTimeSlices = 0;
-  UChar_t fNPads = 0;
-  UChar_t fPadrow = 0;
-  UChar_t fPad = 0;
-
-  //Loop over input files. Give progress percentage.
-  double filesProcessed = 0;
-  double previousPercentage = 0;
-  for (auto fileIt = filenamesVector.begin(), fileEnd = filenamesVector.end();
-       fileIt != fileEnd; ++fileIt) {
-    ++filesProcessed;
-    const double progressPercentage = round(1000*(filesProcessed - 1)/filenamesVector.size()/10.);
-    if (previousPercentage != progressPercentage && fmod(progressPercentage,5) == 0)
-      cout << "[INFO] Processing file " << filesProcessed
-	   << " / " << filenamesVector.size() 
-	   << " (" << progressPercentage << "% complete)." << endl;
-    previousPercentage = progressPercentage;
-    
-    //Open the file for filling and get the TTree.
-    const string& filename = *fileIt;
-    TFile* inputFile = new TFile(filename.c_str(),"READ");
-    if (inputFile == NULL || inputFile->IsZombie()) {
-      cout << "[WARNING] Error opening input file! Skipping." << endl;
-      continue;
-    }
-
-    if (inputFile->GetNkeys() == 0) {
-      cout << "[WARNING] " << filename << " has no keys. Skipping." << endl;
-      continue;
+  //Clusters are decoded from the trees and filled in blocks.
+  ClusterCuts cuts;
+  cuts.fMinPads = fMinPads;
+  cuts.fMaxPads = fMaxPads;
+  cuts.fMinTimeSliceNumber = fMinTimeSliceNumber;
+  cuts.fMinTimeSlices = fMinTimeSlices;
+  cuts.fMaxTimeSlices = fMaxTimeSlices;
+  cuts.fMaxADCCut = fMaxADCCut;
+  cuts.fChargeCut = fChargeCut;
+
+  //Alternative cut sets from the config file, each with its own pad spectra.
+  vector<DetectorHistograms> cutSetSpectra(fCutSets.size());
+  vector<CutSetBank> cutSetBanks(fCutSets.size());
+  if (!fCutSets.empty()) {
+    PhaseTimer::Scope cutSetBookingPhase(fPhaseTimer,"histogramBooking");
+    for (unsigned int i = 0; i < fCutSets.size(); ++i) {
+      cutSetSpectra[i] = CloneHistograms(spectraHistograms);
+      cutSetBanks[i].fName = fCutSets[i].first;
+      cutSetBanks[i].fCuts = cuts;
+      const CutOverrides& overrides = fCutSets[i].second;
+      for (auto it = overrides.begin(), itEnd = overrides.end(); it != itEnd; ++it)
+	SetClusterCut(cutSetBanks[i].fCuts,it->first,it->second);
+      cutSetBanks[i].fSpectra = &cutSetSpectra[i];
     }
+  }
 
-    //Loop through keys in input file.
-    TIter fileIter(inputFile->GetListOfKeys());
-    TKey *key;
-    while ((key = (TKey*)fileIter())) {
-      const TObject* object = key->ReadObj();
-      if (object->InheritsFrom("TTree")) {
-	TTree* tree = dynamic_cast<TTree*>(key->ReadObj());
+  //For iterations, post-cut cluster charges are kept in memory.
+  DetectorCharges clusterCharges;
+  //Not needed when the iterations remap fine spectra instead.
+  DetectorCharges* chargeStore = (nIterations > 1 && !remapGains) ? &clusterCharges : nullptr;
+
+  //Charge vs. drift time per padrow, filled alongside the pad spectra.
+  DetectorDriftProfiles driftProfiles;
+  DetectorDriftProfiles* driftStore = (nDriftBins > 0) ? &driftProfiles : nullptr;
+
+  //Running cluster counts per pad, for the channel status map.
+  DetectorChannels channelStatistics;
+  DetectorChannels* channelStore = (channelStatus) ? &channelStatistics : nullptr;
+
+  //With time bins, each bin of consecutive input files fills its own
+  //pad spectra, which are summed into the full spectra after reading.
+  vector<DetectorHistograms> timeBinSpectra;
+  vector<DetectorHistograms*> fillSpectra;
+  if (nTimeBins > 1) {
+    PhaseTimer::Scope timeBinBookingPhase(fPhaseTimer,"histogramBooking");
+    for (unsigned int bin = 0; bin < nTimeBins; ++bin)
+      timeBinSpectra.push_back(CloneHistograms(spectraHistograms));
+    for (unsigned int bin = 0; bin < nTimeBins; ++bin)
+      fillSpectra.push_back(&timeBinSpectra[bin]);
+  }
+  else
+    fillSpectra.push_back(&spectraHistograms);
+
+  //With fine bins, uncorrected fine spectra are filled instead, and the
+  //gains are applied afterwards by remapping them into the pad spectra.
+  vector<DetectorHistograms> fineSpectra;
+  vector<DetectorHistograms*> remapTargets;
+  if (remapGains) {
+    PhaseTimer::Scope fineBookingPhase(fPhaseTimer,"histogramBooking");
+    remapTargets = fillSpectra;
+    for (unsigned int bin = 0; bin < remapTargets.size(); ++bin)
+      fineSpectra.push_back(BookFineHistograms(*remapTargets[bin],fineBinFactor,fineRangeScale));
+    for (unsigned int bin = 0; bin < remapTargets.size(); ++bin)
+      fillSpectra[bin] = &fineSpectra[bin];
+  }
 
-	//Ignore empty trees.
-	if (tree->GetEntries() == 0)
-	  continue;
-      
-	//Identify TPC and sector.
-	//Format: TTree name = [TPCName]Sector[SectorId]Clusters
-	const string& treeName = tree->GetName();
-	const string& tpcName = treeName.substr(0,treeName.find("Sector"));
-	const size_t sectorIdStart = treeName.find("Sector") + 6;
-	const size_t sectorIdStop = treeName.find("Clusters");
-
-	const string& sectorIdString = treeName.substr(sectorIdStart,sectorIdStop - sectorIdStart);
-	const det::TPCConst::EId tpcId = det::TPCConst::GetId(tpcName);
-	const unsigned int sectorId = stoi(sectorIdString);
-      
-	const det::TPCSector& sector = tpc.GetChamber(tpcId).GetSector(sectorId);
+  //In sector order, the input index lists the files of each sector tree,
+  //and the work units are sectors instead of files. Only one sector's
+  //histograms are filled at a time, and each sector by one thread, in
+  //file order. The largest sectors go first, to balance the threads.
+  vector<InputSector> inputIndex;
+  if (sectorMajor) {
+    PhaseTimer::Scope indexPhase(fPhaseTimer,"inputIndex");
+    const vector<InputSector> allSectors = BuildInputIndex(filenamesVector);
+    for (auto it = allSectors.begin(), itEnd = allSectors.end(); it != itEnd; ++it)
+      if (fTPCIdList.find(det::TPCConst::GetId(it->fTPCName)) != fTPCIdList.end())
+	inputIndex.push_back(*it);
+    stable_sort(inputIndex.begin(),inputIndex.end(),
+		[](const InputSector& a, const InputSector& b) { return a.fEntries > b.fEntries; });
+    indexPhase.AddEntries(inputIndex.size());
+    cout << "[INFO] Processing " << inputIndex.size() << " sectors in sector order." << endl;
+  }
+  const unsigned int nUnits = sectorMajor ? inputIndex.size() : filenamesVector.size();
+  const string unitName = sectorMajor ? "sector" : "file";
+
+  //Loop over input files or sectors. Give progress percentage. With
+  //several threads, workers take the next unit from a shared counter and
+  //fill their own histogram banks, which are merged once all are read.
+  atomic<unsigned int> nextUnit(0);
+  unsigned int unitsProcessed = 0;
+  double previousPercentage = 0;
+  mutex progressMutex;
+  auto processFiles = [&](const vector<DetectorHistograms*>& spectraBanks,
+			  DetectorQAHistograms& qaHistograms,
+			  const vector<CutSetBank>& cutSets,
+			  DetectorCharges* charges,
+			  DetectorDriftProfiles* drift,
+			  DetectorChannels* channels) {
+    ClusterBlock block;
+    for (unsigned int unit = nextUnit++; unit < nUnits; unit = nextUnit++) {
+      {
+	lock_guard<mutex> lock(progressMutex);
+	++unitsProcessed;
+	const double progressPercentage =
+	  round(1000*(unitsProcessed - 1.)/nUnits/10.);
+	if (previousPercentage != progressPercentage && fmod(progressPercentage,5) == 0)
+	  cout << "[INFO] Processing " << unitName << " " << unitsProcessed
+	       << " / " << nUnits
+	       << " (" << progressPercentage << "% complete)." << endl;
+	previousPercentage = progressPercentage;
+      }
+      vector<unsigned int> unitFiles(1,unit);
+      string unitTree;
+      if (sectorMajor) {
+	unitFiles = inputIndex[unit].fFiles;
+	unitTree = inputIndex[unit].fTreeName;
+      }
+      for (auto fileIt = unitFiles.begin(), fileEnd = unitFiles.end(); fileIt != fileEnd; ++fileIt) {
+	const unsigned int timeBin = GetTimeBin(*fileIt,filenamesVector.size(),nTimeBins);
+	ProcessInputFile(filenamesVector[*fileIt],tpc,cuts,updateGains,remapGains,block,
+			 *spectraBanks[timeBin],qaHistograms,cutSets,charges,drift,nDriftBins,
+			 channels,hotPadFactor,atomicFill,padSort,unitTree);
+      }
+    }
+  };
 
-	//Skip entries for TPCs we do not wish to calibrate.
-	if (fTPCIdList.find(tpcId) == fTPCIdList.end())
+  if (!refitFilename.empty()) {
+    if (!ReadStoredSpectra(refitFilename,tpc,spectraHistograms,sectorQAHistograms)) {
+      dummy.SaveAs(gainsCloseString);
+      return -1;
+    }
+  }
+  else if (nThreads == 1)
+    processFiles(fillSpectra,sectorQAHistograms,cutSetBanks,chargeStore,driftStore,
+		 channelStore);
+  else {
+    vector<vector<DetectorHistograms> > workerSpectra(nThreads);
+    vector<vector<DetectorHistograms*> > workerFillSpectra(nThreads);
+    vector<DetectorQAHistograms> workerQAHistograms(nThreads);
+    vector<vector<DetectorHistograms> > workerCutSetSpectra(nThreads);
+    vector<vector<CutSetBank> > workerCutSetBanks(nThreads,cutSetBanks);
+    vector<DetectorCharges> workerCharges(nThreads);
+    vector<DetectorDriftProfiles> workerDriftProfiles(nThreads);
+    vector<DetectorChannels> workerChannels(nThreads);
+
+    //Workers of each NUMA node, pinned to the CPUs of their node.
+    vector<vector<int> > numaNodes;
+    if (numaPlacement) {
+      numaNodes = GetNumaNodeCPUs();
+      if (numaNodes.size() > 1)
+	cout << "[INFO] Placing " << nThreads << " filling threads on " << numaNodes.size()
+	     << " NUMA nodes." << endl;
+      else {
+	cout << "[INFO] Single NUMA node. Filling threads are not pinned." << endl;
+	numaNodes.clear();
+      }
+    }
+    vector<vector<unsigned int> > nodeWorkers(max((size_t)1,numaNodes.size()));
+    for (unsigned int i = 0; i < nThreads; ++i)
+      nodeWorkers[numaNodes.empty() ? 0 : GetWorkerNumaNode(i,nThreads,numaNodes.size())]
+	.push_back(i);
+
+    //Each worker books its own histograms, so their memory is first
+    //touched, and placed, on the worker's node.
+    vector<thread> workers;
+    for (unsigned int node = 0; node < nodeWorkers.size(); ++node)
+      for (auto workerIt = nodeWorkers[node].begin(), workerEnd = nodeWorkers[node].end();
+	   workerIt != workerEnd; ++workerIt) {
+	const unsigned int i = *workerIt;
+	workers.push_back(thread([&,i,node]() {
+	      fTraceRecorder.SetThreadName("worker " + to_string(i));
+	      if (!numaNodes.empty() && !PinThreadToCPUs(numaNodes[node]))
+		cout << "[WARNING] Could not pin worker " << i << " to NUMA node " << node << endl;
+	      PhaseTimer::Scope workerBookingPhase(fPhaseTimer,"histogramBooking");
+	      if (sharedSpectra)
+		workerFillSpectra[i] = fillSpectra;
+	      else {
+		for (unsigned int bin = 0; bin < fillSpectra.size(); ++bin)
+		  workerSpectra[i].push_back(CloneHistograms(*fillSpectra[bin]));
+		for (unsigned int bin = 0; bin < fillSpectra.size(); ++bin)
+		  workerFillSpectra[i].push_back(&workerSpectra[i][bin]);
+		for (unsigned int j = 0; j < cutSetBanks.size(); ++j)
+		  workerCutSetSpectra[i].push_back(CloneHistograms(spectraHistograms));
+		for (unsigned int j = 0; j < cutSetBanks.size(); ++j)
+		  workerCutSetBanks[i][j].fSpectra = &workerCutSetSpectra[i][j];
+	      }
+	      workerBookingPhase.Stop();
+	      processFiles(workerFillSpectra[i],workerQAHistograms[i],workerCutSetBanks[i],
+			   chargeStore ? &workerCharges[i] : nullptr,
+			   driftStore ? &workerDriftProfiles[i] : nullptr,
+			   channelStore ? &workerChannels[i] : nullptr);
+	    }));
+      }
+    for (auto it = workers.begin(), itEnd = workers.end(); it != itEnd; ++it)
+      it->join();
+
+    //Merge in worker order, so the result does not depend on scheduling.
+    //With NUMA placement the pad spectra are first merged on each node into
+    //the bank of its first worker, and only those go across nodes.
+    PhaseTimer::Scope mergePhase(fPhaseTimer,"merge");
+    if (!numaNodes.empty() && !sharedSpectra) {
+      vector<thread> nodeMergers;
+      for (unsigned int node = 0; node < nodeWorkers.size(); ++node) {
+	if (nodeWorkers[node].size() < 2)
 	  continue;
-	
-      
-	tree->SetBranchAddress("fCharge",&fCharge);
-	tree->SetBranchAddress("fMaxADC",&fMaxADC);
-	tree->SetBranchAddress("fTimeSlice",&fTimeSlice);
-	tree->SetBranchAddress("fNPixels",&fNPixels);
-	tree->SetBranchAddress("fNTimeSlices",&fNTimeSlices);
-	tree->SetBranchAddress("fNPads",&fNPads);
-	tree->SetBranchAddress("fPadrow",&fPadrow);
-	tree->SetBranchAddress("fPad",&fPad);
-
-	//Prepare QA plots.
-	TString nameString = tpcName.data() +
-	  TString("Sector") + Form("%i",(unsigned int)sector.GetId());
-	TString titleString = tpcName.data() +
-	  TString(" Sector ") + Form("%i",(unsigned int)sector.GetId());
-      
-	const double minADCPeakSearch = 
-	  (tpcId == det::TPCConst::eVTPC1 && (sectorId == 1 || sectorId == 4)) ? 
-	  fMinADCPeakSearchVTPC1Upstream : fMinADCPeakSearch;
-      
-	const double histogramMax = minADCPeakSearch*fHistogramPadding;
-	const unsigned int nPadrows = sector.GetNPadrows();
-	const unsigned int nPads = sector.GetPadrow(sector.GetNPadrows()).GetNPads();
-      
-	if (sectorSpectraHistograms.find(tpcId) == sectorSpectraHistograms.end() ||
-	    sectorSpectraHistograms.at(tpcId).find(sectorId) == 
-	    sectorSpectraHistograms.at(tpcId).end()) {
-
-	  TH1D* spectrumNoCuts =
-	    new TH1D(Form("ChargeNoCuts%s",nameString.Data()),
-		     Form("%s Krypton Cluster Charges (No cuts);"
-			  "Cluster Charge [ADC];Entries",
-			  titleString.Data()),
-		     2*fHistogramBins,0,histogramMax);
-	  TH1D* spectrumAllCuts =
-	    new TH1D(Form("ChargeAllCuts%s",nameString.Data()),
-		     Form("%s Krypton Cluster Charges (All cuts Applied);"
-			  "Cluster Charge [ADC];Entries",
-			  titleString.Data()),
-		     2*fHistogramBins,0,histogramMax);
-
-	  TH2D* padEntriesNoCuts =
-	    new TH2D(Form("padEntriesNoCuts%s",nameString.Data()),
-		     Form("%s Entries Per Pad (No cuts);Pad Number;Padrow Number",
-			  titleString.Data()),
-		     nPads+2,0,nPads+2,
-		     nPadrows+2,0,nPadrows+2);
-	  TH2D* padEntriesAllCuts =
-	    new TH2D(Form("padEntriesAllCuts%s",nameString.Data()),
-		     Form("%s Entries Per Pad (All cuts Applied);Pad Number;Padrow Number",
-			  titleString.Data()),
-		     nPads+2,0,nPads+2,
-		     nPadrows+2,0,nPadrows+2);
-
-	  TH1D* timeSlicesNoCuts =
-	    new TH1D(Form("timeSlicesNoCuts%s",nameString.Data()),
-		     Form("%s Time Slices (No cuts);Time Slice;Entries",
-			  titleString.Data()),
-		     260,0,260);
-	  TH1D* timeSlicesAllCuts =
-	    new TH1D(Form("timeSlicesAllCuts%s",nameString.Data()),
-		     Form("%s Time Slices (All cuts Applied);Time Slice;Entries",
-			  titleString.Data()),
-		     260,0,260);
-      
-	  TH2D* chargeVsMaxADCNoCuts =
-	    new TH2D(Form("chargeVsMaxADCNoCuts%s",nameString.Data()),
-		     Form("%s Charge vs. MaxADC (No cuts);Charge [ADC];MaxADC [ADC]",
-			  titleString.Data()),
-		     histogramMax*2,0,histogramMax*2,
-		     512,0,512);
-	  TH2D* chargeVsMaxADCAllCuts =
-	    new TH2D(Form("chargeVsMaxADCAllCuts%s",nameString.Data()),
-		     Form("%s Charge vs. MaxADC (All cuts Applied);Charge [ADC];MaxADC [ADC]",
-			  titleString.Data()),
-		     histogramMax*2,0,histogramMax*2,
-		     512,0,512);
-
-	  TH2D* nPadsVsNTimeSlicesNoCuts =
-	    new TH2D(Form("nPadsVsNTimeSlicesNoCuts%s",nameString.Data()),
-		     Form("%s nPads vs. nTimeSlices (No cuts);nPads;nTimeSlices",
-			  titleString.Data()),
-		     fMaxPads*5,0,fMaxPads*5,
-		     fMaxTimeSlices*5,0,fMaxTimeSlices*5);
-	  TH2D* nPadsVsNTimeSlicesAllCuts =
-	    new TH2D(Form("nPadsVsNTimeSlicesAllCuts%s",nameString.Data()),
-		     Form("%s nPads vs. nTimeSlices (All cuts Applied);nPads;nTimeSlices",
-			  titleString.Data()),
-		     fMaxPads*5,0,fMaxPads*5,
-		     fMaxTimeSlices*5,0,fMaxTimeSlices*5);
-      
-	  sectorSpectraHistograms[tpcId][sectorId] = make_pair(spectrumNoCuts,spectrumAllCuts);
-	  sectorPadEntries[tpcId][sectorId] = make_pair(padEntriesNoCuts,padEntriesAllCuts);
-	  sectorTimeSlices[tpcId][sectorId] = make_pair(timeSlicesNoCuts,timeSlicesAllCuts);
-	  sectorChargeVsMaxADC[tpcId][sectorId] = 
-	    make_pair(chargeVsMaxADCNoCuts,chargeVsMaxADCAllCuts);
-	  sectorNPadsVsNTimeSlices[tpcId][sectorId] = 
-	    make_pair(nPadsVsNTimeSlicesNoCuts,nPadsVsNTimeSlicesAllCuts);
+	nodeMergers.push_back(thread([&,node]() {
+	      PinThreadToCPUs(numaNodes[node]);
+	      PhaseTimer::Scope nodeMergePhase(fPhaseTimer,"nodeMerge",Form("Node%u",node));
+	      const unsigned int first = nodeWorkers[node].front();
+	      for (auto it = nodeWorkers[node].begin() + 1, itEnd = nodeWorkers[node].end();
+		   it != itEnd; ++it) {
+		for (unsigned int bin = 0; bin < fillSpectra.size(); ++bin)
+		  MergeHistograms(workerSpectra[first][bin],workerSpectra[*it][bin]);
+		for (unsigned int j = 0; j < cutSetBanks.size(); ++j)
+		  MergeHistograms(workerCutSetSpectra[first][j],workerCutSetSpectra[*it][j]);
+	      }
+	    }));
+      }
+      for (auto it = nodeMergers.begin(), itEnd = nodeMergers.end(); it != itEnd; ++it)
+	it->join();
+    }
+    for (unsigned int node = 0; node < nodeWorkers.size(); ++node)
+      for (auto workerIt = nodeWorkers[node].begin(), workerEnd = nodeWorkers[node].end();
+	   workerIt != workerEnd; ++workerIt) {
+	const unsigned int i = *workerIt;
+	//Banks of the other workers of a node are already merged and empty.
+	if (!sharedSpectra && (numaNodes.empty() || workerIt == nodeWorkers[node].begin())) {
+	  for (unsigned int bin = 0; bin < fillSpectra.size(); ++bin)
+	    MergeHistograms(*fillSpectra[bin],workerSpectra[i][bin]);
+	  for (unsigned int j = 0; j < cutSetBanks.size(); ++j)
+	    MergeHistograms(cutSetSpectra[j],workerCutSetSpectra[i][j]);
 	}
-      
-	//Loop through all data to calculate total average for sectors.
-	for(long double i = 0; i < tree->GetEntries(); ++i) {
-	  tree->GetEntry(i);
-
-	  const unsigned int pad = (unsigned int)fPad;
-	  const unsigned int padrow = (unsigned int)fPadrow;
-	  const unsigned int nPads = (unsigned int)fNPads;
-	  const unsigned int nTimeSlices = (unsigned int)fNTimeSlices;
-	
-	  //Fill sector QA histograms (no cuts).
-	  sectorSpectraHistograms[tpcId][sectorId].first->Fill(fCharge);
-	  sectorPadEntries[tpcId][sectorId].first->Fill(pad,padrow);
-	  sectorTimeSlices[tpcId][sectorId].first->Fill(fTimeSlice);
-	  sectorChargeVsMaxADC[tpcId][sectorId].first->Fill(fCharge,fMaxADC);
-	  sectorNPadsVsNTimeSlices[tpcId][sectorId].first->Fill(fNPads,fNTimeSlices);
-
-	  //Ignore zero charge bins.
-	  if (fCharge == 0)
-	    continue;
-	  //Cluster cuts.
-	  if (nPads < fMinPads)
-	    continue;
-	  if (nPads > fMaxPads)
-	    continue;
-	  if (nTimeSlices < fMinTimeSlices)
-	    continue;
-	  if (nTimeSlices > fMaxTimeSlices)
-	    continue;
-	
-	  if (fTimeSlice < fMinTimeSliceNumber)
-	    continue;    
-	  if (fCharge < fChargeCut && fMaxADC < fMaxADCCut)
-	    continue;
-	
-	  if (updateGains) {
-	    const det::TPCPadrow& detPadrow = sector.GetPadrow(padrow);
-	    fCharge *= detPadrow.GetPadGain(pad);
+	MergeQAHistograms(sectorQAHistograms,workerQAHistograms[i]);
+	if (chargeStore)
+	  MergeClusterCharges(clusterCharges,workerCharges[i]);
+	if (driftStore)
+	  MergeDriftProfiles(driftProfiles,workerDriftProfiles[i]);
+	if (channelStore)
+	  MergeChannelStatistics(channelStatistics,workerChannels[i]);
+      }
+    if (atomicFill) {
+      for (unsigned int bin = 0; bin < fillSpectra.size(); ++bin)
+	FinishAtomicFill(*fillSpectra[bin]);
+      for (unsigned int j = 0; j < cutSetSpectra.size(); ++j)
+	FinishAtomicFill(cutSetSpectra[j]);
+    }
+  }
+  //Flag dead, hot and noisy pads. Excluded pads are left out of the fits,
+  //also with what they filled before they were excluded.
+  if (channelStore) {
+    WriteChannelStatus(tpc,channelStatistics,currentWorkingDirectory + outputPrefix);
+    for (unsigned int bin = 0; bin < fillSpectra.size(); ++bin)
+      ResetExcludedPads(*fillSpectra[bin],channelStatistics);
+    for (unsigned int j = 0; j < cutSetSpectra.size(); ++j)
+      ResetExcludedPads(cutSetSpectra[j],channelStatistics);
+    for (auto tpcIt = clusterCharges.begin(), tpcEnd = clusterCharges.end(); tpcIt != tpcEnd; ++tpcIt) {
+      const auto channelTPCIt = channelStatistics.find(tpcIt->first);
+      if (channelTPCIt == channelStatistics.end())
+	continue;
+      for (auto sectorIt = tpcIt->second.begin(), sectorEnd = tpcIt->second.end();
+	   sectorIt != sectorEnd; ++sectorIt) {
+	const auto channelSectorIt = channelTPCIt->second.find(sectorIt->first);
+	if (channelSectorIt == channelTPCIt->second.end())
+	  continue;
+	for (auto padrowIt = sectorIt->second.begin(), padrowEnd = sectorIt->second.end();
+	     padrowIt != padrowEnd; ++padrowIt)
+	  for (auto padIt = padrowIt->second.begin(); padIt != padrowIt->second.end(); ) {
+	    if (IsPadExcluded(channelSectorIt->second,padrowIt->first,padIt->first))
+	      padIt = padrowIt->second.erase(padIt);
+	    else
+	      ++padIt;
 	  }
-	
-	  //Fill pad histogram.
-	  fSpectraHistograms[tpcId][sectorId][padrow][pad]->Fill(fCharge);
-
-	  //Fill sector QA histograms (all cuts).
-	  sectorSpectraHistograms[tpcId][sectorId].second->Fill(fCharge);
-	  sectorPadEntries[tpcId][sectorId].second->Fill(pad,padrow);
-	  sectorTimeSlices[tpcId][sectorId].second->Fill(fTimeSlice);
-	  sectorChargeVsMaxADC[tpcId][sectorId].second->Fill(fCharge,fMaxADC);
-	  sectorNPadsVsNTimeSlices[tpcId][sectorId].second->Fill(fNPads,fNTimeSlices);
-	} //End TTree loop.
-
-      } //End inherets from TTree.
-    } //End key iteration.
-    inputFile->Close();
-  } //End filename loop.
+      }
+    }
+  }
+  if (remapGains) {
+    PhaseTimer::Scope remapPhase(fPhaseTimer,"gainRemap");
+    for (unsigned int bin = 0; bin < remapTargets.size(); ++bin)
+      RemapHistograms(*remapTargets[bin],fineSpectra[bin],fPreviousGains);
+  }
+  if (nTimeBins > 1) {
+    PhaseTimer::Scope timeBinMergePhase(fPhaseTimer,"merge");
+    for (unsigned int bin = 0; bin < nTimeBins; ++bin)
+      AddHistograms(spectraHistograms,timeBinSpectra[bin]);
+  }
   
   //Calculate peak positions.
-  unordered_map<unsigned int, 
-		unordered_map<unsigned int,
-			      unordered_map<unsigned int,
-					    unordered_map<unsigned int,double> > > > spectrumADCs;
+  DetectorADCs spectrumADCs;
   //Container for calculating and holding total sector averages.
   DEDXTools::SectorAveragers totalAccumulators;
-  
+  //Full fit results of every pad, for the columnar result tree.
+  DetectorFitResults fitResults;
+  FitDetectorSpectra(spectraHistograms,spectrumADCs,totalAccumulators,"fitting",&fitResults);
+
+  //Gains applied to the pad spectra: previous gains (-u), replaced by the
+  //gains of each iteration. Pads missing from the table have unit gain.
+  DetectorGains appliedGains = fPreviousGains;
+  if (nIterations > 1)
+    IterateCalibration(tpc,clusterCharges,fineSpectra,nIterations,iterationTolerance,
+		       spectraHistograms,appliedGains,spectrumADCs,totalAccumulators,&fitResults);
+  fineSpectra.clear();
+
+  //Write pad spectra to QA file, one key per pad or per sector. With
+  //--write-threads the pad spectra and sector QA go to shard files.
+  PhaseTimer::Scope padWritePhase(fPhaseTimer,"outputWrite");
+  const string outputBase = currentWorkingDirectory + outputPrefix;
+  //Shards of an earlier run would be read by a refit.
+  for (unsigned int shard = 0;
+       boost::filesystem::exists(GetOutputShardFilename(outputBase,shard)); ++shard)
+    boost::filesystem::remove(GetOutputShardFilename(outputBase,shard));
   outputFile->cd();
-  for (auto chamberIt = fSpectraHistograms.begin(), chamberEnd = fSpectraHistograms.end();
-       chamberIt != chamberEnd; ++chamberIt) {
-    const unsigned int tpcId = chamberIt->first;
-    const SectorHistograms sectorHistograms = chamberIt->second;
-    for (auto sectorIt = sectorHistograms.begin(), sectorEnd = sectorHistograms.end();
-         sectorIt != sectorEnd; ++sectorIt) {
-      const unsigned int sectorId = sectorIt->first;
-      const PadrowHistograms padrowHistograms = sectorIt->second;
-      for (auto padrowIt = padrowHistograms.begin(), padrowEnd = padrowHistograms.end();
-           padrowIt != padrowEnd; ++padrowIt) {
-        const unsigned int padrowId = padrowIt->first;
-        const PadHistograms padHistograms = padrowIt->second;
-        for (auto padIt = padHistograms.begin(), padEnd = padHistograms.end();
-             padIt != padEnd; ++padIt) {
-          const unsigned int padId = padIt->first;
-
-          //Get histogram.
-          TH1D* padHistogram = padIt->second;
-
-          const int lastBin = padHistogram->GetXaxis()->GetNbins() - 1;
-          const double maxCharge = padHistogram->GetXaxis()->GetBinCenter(lastBin);
-
-          //Search for peak above minimum acceptable Krypton peak value.
-          int maxBin = 0;
-          double chargePeak = 0;
-          double chargePeakValue = 0;
-          for (int i = 0; i < lastBin; ++i) {
-            const double binCenter = padHistogram->GetXaxis()->GetBinCenter(i);
-	    const double minADCPeakSearch = 
-	      ((det::TPCConst::EId)tpcId == 
-	       det::TPCConst::eVTPC1 && (sectorId == 1 || sectorId == 4)) ? 
-	      fMinADCPeakSearchVTPC1Upstream : fMinADCPeakSearch;
-	    if (binCenter < minADCPeakSearch)
-              continue;
-            const double value = padHistogram->GetBinContent(i);
-            if (value > chargePeakValue) {
-              maxBin = i;
-              chargePeak = binCenter;
-              chargePeakValue = value;
-            }
-          }
-
-          //Find where peak drops by a factor of 2 above and below.
-          //Calculate peak nearest end of distribution. Count backwards from end of histogram.
-          double minChargeForFit = 0;
-          double maxChargeForFit = 0;
-          for (int bin = maxBin; bin > 0; --bin) {
-            const double binContent = padHistogram->GetBinContent(bin);
-            if (binContent < 0.5*chargePeakValue) {
-              minChargeForFit = padHistogram->GetXaxis()->GetBinCenter(bin);
-              break;
-            }
-          }
-          for (int bin = maxBin; bin <= lastBin; ++bin) {
-            const double binContent = padHistogram->GetBinContent(bin);
-            if (binContent < 0.5*chargePeakValue) {
-              maxChargeForFit = padHistogram->GetXaxis()->GetBinCenter(bin);
-              break;
-            }
-          }
-
-          //Define fit functions.
-          TF1* gausFit = new TF1("gausFit","gaus",
-                                 minChargeForFit,maxChargeForFit);
-          TF1* fermiFit = new TF1("fermiFit","[0]/(1+TMath::Exp([1]*(x-[2])))",
-                                  chargePeak,maxCharge);
-          fermiFit->FixParameter(0,chargePeakValue);
-          fermiFit->SetParameter(1,0.01);
-          fermiFit->SetParLimits(1,0.0001,1);
-          fermiFit->SetParameter(2,chargePeak);
-          
-          //Don't do anything for pads with too few entries.
-          if (padHistogram->GetEntries() >= fMinHistogramEntries) {
-            //Perform desired fit. Store results.
-            if (fFitFunction == "Gaussian") {
-              padHistogram->Fit(gausFit,"R Q");
-              spectrumADCs[tpcId][sectorId][padrowId][padId] = gausFit->GetParameter(1);
-              totalAccumulators.AddValue(tpcId,sectorId,gausFit->GetParameter(1));
-            }
-            else if (fFitFunction == "Fermi") {
-              padHistogram->Fit(fermiFit,"R Q");
-              spectrumADCs[tpcId][sectorId][padrowId][padId] = fermiFit->GetParameter(2);
-              totalAccumulators.AddValue(tpcId,sectorId,fermiFit->GetParameter(2));
-            }
-          }
-          //Write to QA file.
-	  if (padHistogram->GetEntries() > 0)
-	    padHistogram->Write();
-        } // Pad loop.
-      } // Padrow loop.
-    } // Sector loop.
-  } // TPC loop.
+  if (sectorSpectraOutput)
+    WriteSectorSpectra(tpc,spectraHistograms,*outputFile);
+  if (nWriteThreads > 1) {
+    if (!WriteSpectraShards(spectraHistograms,sectorQAHistograms,!sectorSpectraOutput,
+			    outputBase,nWriteThreads,compression)) {
+      dummy.SaveAs(gainsCloseString);
+      return -1;
+    }
+  }
+  else {
+    if (!sectorSpectraOutput)
+      for (auto chamberIt = spectraHistograms.begin(), chamberEnd = spectraHistograms.end();
+	   chamberIt != chamberEnd; ++chamberIt)
+	for (auto sectorIt = chamberIt->second.begin(), sectorEnd = chamberIt->second.end();
+	     sectorIt != sectorEnd; ++sectorIt)
+	  for (auto padrowIt = sectorIt->second.begin(), padrowEnd = sectorIt->second.end();
+	       padrowIt != padrowEnd; ++padrowIt)
+	    for (auto padIt = padrowIt->second.begin(), padEnd = padrowIt->second.end();
+		 padIt != padEnd; ++padIt)
+	      if (padIt->second->GetEntries() > 0)
+		padIt->second->Write();
+    //Sector QA, for the QA pages of a later refit.
+    for (auto tpcIt = sectorQAHistograms.begin(), tpcEnd = sectorQAHistograms.end();
+	 tpcIt != tpcEnd; ++tpcIt)
+      for (auto sectorIt = tpcIt->second.begin(), sectorEnd = tpcIt->second.end();
+	   sectorIt != sectorEnd; ++sectorIt)
+	WriteSectorQAHistograms(sectorIt->second);
+  }
+  padWritePhase.Stop();
 
-  if (fSpectraHistograms.begin() == fSpectraHistograms.end())
+  if (spectraHistograms.begin() == spectraHistograms.end())
     cout << "[WARNING] No histograms were filled. "
          << "Was your TPC included in the configuration file list?" << endl;
   
@@ -542,11 +909,55 @@ int main(int argc, char* argv[])
   double fGain;
   fResultTree->Branch("fGain",&fGain);
 
+  //Columnar results with the fit diagnostics: one entry per sector with
+  //arrays over its pads, filled in bulk from the sector columns.
+  unsigned int maxSectorPads = 0;
+  for (auto chamberIt = tpc.ChambersBegin(), chamberEnd = tpc.ChambersEnd();
+       chamberIt != chamberEnd; ++chamberIt) {
+    const det::TPCChamber& chamber = *chamberIt;
+    for (auto sectorIt = chamber.SectorsBegin(), sectorEnd = chamber.SectorsEnd();
+         sectorIt != sectorEnd; ++sectorIt) {
+      const det::TPCSector& sector = *sectorIt;
+      unsigned int nSectorPads = 0;
+      for (auto padrowIt = sector.PadrowsBegin(), padrowEnd = sector.PadrowsEnd();
+           padrowIt != padrowEnd; ++padrowIt) {
+        const det::TPCPadrow& padrow = *padrowIt;
+        nSectorPads += padrow.GetNPads();
+      }
+      maxSectorPads = max(maxSectorPads,nSectorPads);
+    }
+  }
+  SectorResultColumns resultColumns(maxSectorPads);
+  TTree* fSectorResultTree =
+    resultColumns.BookTree("fSectorResultTree","Krypton Analysis Results per Sector");
+  const PadFitResult noFitResult;
+  auto getFitResult = [&](const unsigned int tpcId, const unsigned int sectorId,
+                          const unsigned int padrowId, const unsigned int padId)
+    -> const PadFitResult& {
+    const auto tpcIt = fitResults.find(tpcId);
+    if (tpcIt == fitResults.end())
+      return noFitResult;
+    const auto sectorIt = tpcIt->second.find(sectorId);
+    if (sectorIt == tpcIt->second.end())
+      return noFitResult;
+    const auto padrowIt = sectorIt->second.find(padrowId);
+    if (padrowIt == sectorIt->second.end())
+      return noFitResult;
+    const auto padIt = padrowIt->second.find(padId);
+    return (padIt == padrowIt->second.end()) ? noFitResult : padIt->second;
+  };
+
   //XML file writing infrastructure.
+  PhaseTimer::Scope gainWritingPhase(fPhaseTimer,"gainWriting");
   string gainsFilename = currentWorkingDirectory + outputPrefix + "-KryptonPadGains.xml";
   ofstream gainsFileStream;
   gainsFileStream.open(gainsFilename);
+  RecordOutputFile(gainsFilename);
   
+  //Same gains in binary form, for fast loading with -u.
+  string binaryGainsFilename = currentWorkingDirectory + outputPrefix + "-KryptonPadGains.bin";
+  DetectorGains newGains;
+
   gainsFileStream << "<?xml version=\"1.0\" encoding=\"utf-8\"?>\n"
                   << "\n"
                   << "<PadByPadGain\n"
@@ -566,6 +977,7 @@ int main(int argc, char* argv[])
       const unsigned int sectorId = (unsigned int)sector.GetId();
       const double sectorADC = totalAccumulators.GetAverage(tpcId,sectorId);
       gainsFileStream << "    <Sector id=\"" << (unsigned int)sectorId << "\">\n";
+      resultColumns.Clear(tpcId,sectorId);
       for (auto padrowIt = sector.PadrowsBegin(), padrowEnd = sector.PadrowsEnd();
            padrowIt != padrowEnd; ++padrowIt) {
         const det::TPCPadrow& padrow = *padrowIt;
@@ -575,8 +987,8 @@ int main(int argc, char* argv[])
         for (unsigned int padId = 1; padId <= padrow.GetNPads(); ++padId) {
           
           const double padADC = spectrumADCs[tpcId][sectorId][padrowId][padId];
-          const double gain = (updateGains) ?
-            padrow.GetPadGain(padId)*sectorADC/padADC : sectorADC/padADC;
+          const double previousGain = GetPadGain(appliedGains,tpcId,sectorId,padrowId,padId);
+          const double gain = previousGain*sectorADC/padADC;
 
           if (fTPCIdList.find(chamber.GetId()) == fTPCIdList.end())
             continue;
@@ -586,7 +998,7 @@ int main(int argc, char* argv[])
                  << ", sector " << sectorId
                  << ", padrow " << padrowId
                  << ", pad " << padId
-                 << ": Previous gain = " << padrow.GetPadGain(padId)
+                 << ": Previous gain = " << previousGain
                  << ". Pad ADC = " << padADC
                  << ". Sector ADC = " << sectorADC
                  << ". SectorADC/PadADC = " << sectorADC/padADC
@@ -604,16 +1016,18 @@ int main(int argc, char* argv[])
           fGain = (isnan(gain) || isinf(gain) ) ? 
 	    0 : gain;
           fResultTree->Fill();
+          resultColumns.Add(padrowId,padId,fGain,getFitResult(tpcId,sectorId,padrowId,padId));
           
-          if (gain > fMinAcceptableGain &&
-              gain < fMaxAcceptableGain)
-            gainsFileStream << gain << " ";
-          else
-            gainsFileStream << -1.0 << " ";
+          const double writtenGain = (gain > fMinAcceptableGain &&
+                                      gain < fMaxAcceptableGain) ? gain : -1.0;
+          gainsFileStream << writtenGain << " ";
+          newGains[tpcId][sectorId][padrowId][padId] = writtenGain;
         } // Pad loop.
         gainsFileStream << "</PadGains>\n";
         gainsFileStream << "      </Padrow>\n";
       } // Padrow loop.
+      if (resultColumns.fNPads > 0)
+        fSectorResultTree->Fill();
       gainsFileStream << "    </Sector>\n";
     } // Sector loop.
     gainsFileStream << "  </TPC>\n";
@@ -621,8 +1035,35 @@ int main(int argc, char* argv[])
   gainsFileStream << "</PadByPadGain>\n";
   
   cout << "[INFO] Pad gains written to file " << gainsFilename << " . Thanks!" << endl;
+  if (WritePadGainBinary(binaryGainsFilename,newGains)) {
+    RecordOutputFile(binaryGainsFilename);
+    cout << "[INFO] Binary pad gains written to file " << binaryGainsFilename << endl;
+  }
+  gainsFileStream.close();
+  gainWritingPhase.Stop();
+
+  //Gains of the alternative cut sets, compared with the main cuts.
+  if (!cutSetBanks.empty()) {
+    AnalyzeCutSets(tpc,cutSetBanks,spectraHistograms,newGains,updateGains,
+		   currentWorkingDirectory + outputPrefix);
+    cutSetBanks.clear();
+    cutSetSpectra.clear();
+  }
+
+  //Gains and their stability per time bin.
+  if (nTimeBins > 1) {
+    AnalyzeTimeBins(tpc,timeBinSpectra,filenamesVector,updateGains,
+		    currentWorkingDirectory + outputPrefix,*outputFile);
+    fillSpectra.clear();
+    timeBinSpectra.clear();
+  }
+
+  //Drift attenuation per padrow and sector.
+  if (driftStore)
+    AnalyzeDriftProfiles(driftProfiles,*outputFile);
 
   //Make QA plots.
+  PhaseTimer::Scope qaPhase(fPhaseTimer,"qaRendering");
   for (auto chamberIt = tpc.ChambersBegin(), chamberEnd = tpc.ChambersEnd();
        chamberIt != chamberEnd; ++chamberIt) {
     const det::TPCChamber& chamber = *chamberIt;
@@ -674,7 +1115,7 @@ int main(int argc, char* argv[])
       sectorGains.SetMinimum(0.6);
       sectorGains.SetMaximum(1.4);
       sectorGains.Draw("COLZ");
-      canvas.SaveAs(gainsPDFName);
+      SaveQAPage(canvas,gainsPDFName);
       outputFile->cd();
       sectorGains.Write();
     } // Sector loop.
@@ -690,14 +1131,14 @@ int main(int argc, char* argv[])
 
   gStyle->SetOptStat(0);
   
-  for (auto it = sectorSpectraHistograms.begin(),
-  	 itEnd = sectorSpectraHistograms.end(); it != itEnd; ++it) {
+  for (auto it = sectorQAHistograms.begin(),
+  	 itEnd = sectorQAHistograms.end(); it != itEnd; ++it) {
     const det::TPCConst::EId tpcId = (det::TPCConst::EId)it->first;
-    auto sectorMap = it->second;
+    const auto& sectorMap = it->second;
     for (auto sectorIt = sectorMap.begin(), sectorEnd = sectorMap.end();
 	 sectorIt != sectorEnd; ++sectorIt) {
       const int sectorId = sectorIt->first;
-      auto histogramPair = sectorIt->second;
+      const auto& histogramPair = sectorIt->second.fSpectra;
 
 
       TCanvas canvas;
@@ -710,7 +1151,7 @@ int main(int argc, char* argv[])
       gPad->SetRightMargin(rightMargin);
       gPad->SetLogz();
       canvas.cd(2);
-      TH1D* spectrum = histogramPair.second;
+      TH1D* spectrum = histogramPair.second.get();
       spectrum->Draw();
       //Fit around peak.
       const double minADCPeakSearch = 
@@ -752,25 +1193,24 @@ int main(int argc, char* argv[])
       gPad->SetLeftMargin(leftMargin);
       gPad->SetRightMargin(rightMargin);
       gPad->SetLogz();
-      canvas.SaveAs(gainsPDFName);
+      SaveQAPage(canvas,gainsPDFName);
     }
   }
 
-  for (auto it = sectorSpectraHistograms.begin(),
-  	 itEnd = sectorSpectraHistograms.end(); it != itEnd; ++it) {
+  for (auto it = sectorQAHistograms.begin(),
+  	 itEnd = sectorQAHistograms.end(); it != itEnd; ++it) {
     const det::TPCConst::EId tpcId = (det::TPCConst::EId)it->first;
     const string& tpcName = det::TPCConst::GetName(tpcId);
-    auto sectorMap= it->second;
+    const auto& sectorMap = it->second;
     for (auto sectorIt = sectorMap.begin(), sectorEnd = sectorMap.end();
 	 sectorIt != sectorEnd; ++sectorIt) {
       const unsigned int sectorId = sectorIt->first;
       const det::TPCSector& sector = tpc.GetChamber(tpcId).GetSector(sectorId);
       const unsigned int nPadrows = sector.GetNPadrows();
       
-      TH1D* gains = new TH1D(Form("%sSector%iGains",tpcName.data(),sectorId),
-			     Form("%s Sector %i Gains;Gain;Entries",
-				  tpcName.data(),sectorId),
-			     200,0.5,1.5);
+      TH1D gains(Form("%sSector%iGains",tpcName.data(),sectorId),
+		 Form("%s Sector %i Gains;Gain;Entries",tpcName.data(),sectorId),
+		 200,0.5,1.5);
       
       fResultTree->SetBranchAddress("fTPCId",&fTPCId);
       fResultTree->SetBranchAddress("fSectorId",&fSectorId);
@@ -788,11 +1228,11 @@ int main(int argc, char* argv[])
       for (double i = 0; i < fResultTree->GetEntries(); ++i) {
 	fResultTree->GetEntry(i);
 	if (fTPCId == (unsigned int)tpcId && fSectorId == sectorId) {
-	  gains->Fill(fGain);
+	  gains.Fill(fGain);
 	  gainsContainer[fPadrowId][fPadId] = fGain;
 	}
       }
-      //Create TGraphs and TMultiGraph.
+      //Create TGraphs and TMultiGraph, which owns the graphs.
       TMultiGraph multigraph;
       TString gainsByPadName = Form("%sSector%iGainsByPad",tpcName.data(),sectorId);
       multigraph.SetNameTitle(gainsByPadName,
@@ -816,15 +1256,15 @@ int main(int argc, char* argv[])
       }
       
       //Create z-scale palette using dummy TH2D.
-      TH2D* dummy2D = new TH2D("dummy","dummy",100,0,1,100,0,1);
-      dummy2D->Fill(0.1,0.1,1);
-      dummy2D->Fill(0.9,0.9,nPadrows);
-      dummy2D->GetZaxis()->SetLabelSize(0.02);
+      TH2D dummy2D("dummy","dummy",100,0,1,100,0,1);
+      dummy2D.Fill(0.1,0.1,1);
+      dummy2D.Fill(0.9,0.9,nPadrows);
+      dummy2D.GetZaxis()->SetLabelSize(0.02);
       TCanvas dummy;
-      dummy2D->Draw("COLZ");
+      dummy2D.Draw("COLZ");
       dummy.Update();
       TPaletteAxis* palette =
-      	(TPaletteAxis*)dummy2D->GetListOfFunctions()->FindObject("palette");
+      	(TPaletteAxis*)dummy2D.GetListOfFunctions()->FindObject("palette");
       palette->SetX1NDC(0.9);
       palette->SetX2NDC(0.925);
       palette->SetY1NDC(0.1);
@@ -840,19 +1280,19 @@ int main(int argc, char* argv[])
       multigraph.Draw("AP");
       palette->Draw();
       label.DrawLatexNDC(0.975,0.45,"Padrow Id");
-      canvas.SaveAs(gainsPDFName);
-      gains->Draw();
-      canvas.SaveAs(gainsPDFName);
+      SaveQAPage(canvas,gainsPDFName);
+      gains.Draw();
+      SaveQAPage(canvas,gainsPDFName);
       // gStyle->SetPalette(55);
     }
   }  
 
-  for (auto it = sectorPadEntries.begin(),
-  	 itEnd = sectorPadEntries.end(); it != itEnd; ++it) {
-    auto sectorMap = it->second;
+  for (auto it = sectorQAHistograms.begin(),
+  	 itEnd = sectorQAHistograms.end(); it != itEnd; ++it) {
+    const auto& sectorMap = it->second;
     for (auto sectorIt = sectorMap.begin(), sectorEnd = sectorMap.end();
 	 sectorIt != sectorEnd; ++sectorIt) {
-      auto histogramPair = sectorIt->second;
+      const auto& histogramPair = sectorIt->second.fPadEntries;
       
       TCanvas canvas;
       canvas.Divide(2,1);
@@ -870,16 +1310,16 @@ int main(int argc, char* argv[])
       gPad->SetLeftMargin(leftMargin);
       gPad->SetRightMargin(rightMargin);
       gPad->SetLogz();
-      canvas.SaveAs(gainsPDFName);
+      SaveQAPage(canvas,gainsPDFName);
     }
   }
   
-  for (auto it = sectorTimeSlices.begin(),
-  	 itEnd = sectorTimeSlices.end(); it != itEnd; ++it) {
-    auto sectorMap = it->second;
+  for (auto it = sectorQAHistograms.begin(),
+  	 itEnd = sectorQAHistograms.end(); it != itEnd; ++it) {
+    const auto& sectorMap = it->second;
     for (auto sectorIt = sectorMap.begin(), sectorEnd = sectorMap.end();
 	 sectorIt != sectorEnd; ++sectorIt) {
-      auto histogramPair = sectorIt->second;
+      const auto& histogramPair = sectorIt->second.fTimeSlices;
       TCanvas canvas;
       canvas.Divide(2,1);
       canvas.cd(1);
@@ -896,16 +1336,16 @@ int main(int argc, char* argv[])
       gPad->SetLeftMargin(leftMargin);
       gPad->SetRightMargin(rightMargin);
       gPad->SetLogz();
-      canvas.SaveAs(gainsPDFName);
+      SaveQAPage(canvas,gainsPDFName);
     }
   }
 
-  for (auto it = sectorChargeVsMaxADC.begin(),
-  	 itEnd = sectorChargeVsMaxADC.end(); it != itEnd; ++it) {
-    auto sectorMap = it->second;
+  for (auto it = sectorQAHistograms.begin(),
+  	 itEnd = sectorQAHistograms.end(); it != itEnd; ++it) {
+    const auto& sectorMap = it->second;
     for (auto sectorIt = sectorMap.begin(), sectorEnd = sectorMap.end();
 	 sectorIt != sectorEnd; ++sectorIt) {
-      auto histogramPair = sectorIt->second;
+      const auto& histogramPair = sectorIt->second.fChargeVsMaxADC;
       TCanvas canvas;
       canvas.Divide(2,1);
       canvas.cd(1);
@@ -922,16 +1362,16 @@ int main(int argc, char* argv[])
       gPad->SetLeftMargin(leftMargin);
       gPad->SetRightMargin(rightMargin);
       gPad->SetLogz();
-      canvas.SaveAs(gainsPDFName);
+      SaveQAPage(canvas,gainsPDFName);
     }
   }
 
-  for (auto it = sectorNPadsVsNTimeSlices.begin(),
-  	 itEnd = sectorNPadsVsNTimeSlices.end(); it != itEnd; ++it) {
-    auto sectorMap = it->second;
+  for (auto it = sectorQAHistograms.begin(),
+  	 itEnd = sectorQAHistograms.end(); it != itEnd; ++it) {
+    const auto& sectorMap = it->second;
     for (auto sectorIt = sectorMap.begin(), sectorEnd = sectorMap.end();
 	 sectorIt != sectorEnd; ++sectorIt) {
-      auto histogramPair = sectorIt->second;
+      const auto& histogramPair = sectorIt->second.fNPadsVsNTimeSlices;
       TCanvas canvas;
       canvas.Divide(2,1);
       canvas.cd(1);
@@ -948,54 +1388,351 @@ int main(int argc, char* argv[])
       gPad->SetLeftMargin(leftMargin);
       gPad->SetRightMargin(rightMargin);
       gPad->SetLogz();
-      canvas.SaveAs(gainsPDFName);
+      SaveQAPage(canvas,gainsPDFName);
     }
   } 
   
   //Close PDF.
   dummy.SaveAs(gainsCloseString);
+  qaPhase.Stop();
   
+  //Memory held by the main containers at the end of the analysis.
+  MemoryReport memoryUsage;
+  for (auto chamberIt = spectraHistograms.begin(), chamberEnd = spectraHistograms.end();
+       chamberIt != chamberEnd; ++chamberIt)
+    for (auto sectorIt = chamberIt->second.begin(), sectorEnd = chamberIt->second.end();
+         sectorIt != sectorEnd; ++sectorIt)
+      for (auto padrowIt = sectorIt->second.begin(), padrowEnd = sectorIt->second.end();
+           padrowIt != padrowEnd; ++padrowIt)
+        for (auto padIt = padrowIt->second.begin(), padEnd = padrowIt->second.end();
+             padIt != padEnd; ++padIt)
+          memoryUsage.Add("padSpectra",EstimateHistogramBytes(*padIt->second));
+  for (auto it = sectorQAHistograms.begin(), itEnd = sectorQAHistograms.end();
+       it != itEnd; ++it) {
+    for (auto sectorIt = it->second.begin(), sectorEnd = it->second.end();
+         sectorIt != sectorEnd; ++sectorIt) {
+      const SectorQAHistograms& qa = sectorIt->second;
+      memoryUsage.Add("sectorSpectra",
+                      EstimateHistogramBytes(*qa.fSpectra.first) +
+                      EstimateHistogramBytes(*qa.fSpectra.second),2);
+      memoryUsage.Add("sectorPadEntries",
+                      EstimateHistogramBytes(*qa.fPadEntries.first) +
+                      EstimateHistogramBytes(*qa.fPadEntries.second),2);
+      memoryUsage.Add("sectorTimeSlices",
+                      EstimateHistogramBytes(*qa.fTimeSlices.first) +
+                      EstimateHistogramBytes(*qa.fTimeSlices.second),2);
+      memoryUsage.Add("sectorChargeVsMaxADC",
+                      EstimateHistogramBytes(*qa.fChargeVsMaxADC.first) +
+                      EstimateHistogramBytes(*qa.fChargeVsMaxADC.second),2);
+      memoryUsage.Add("sectorNPadsVsNTimeSlices",
+                      EstimateHistogramBytes(*qa.fNPadsVsNTimeSlices.first) +
+                      EstimateHistogramBytes(*qa.fNPadsVsNTimeSlices.second),2);
+    }
+  }
+  for (auto tpcIt = clusterCharges.begin(), tpcEnd = clusterCharges.end(); tpcIt != tpcEnd; ++tpcIt)
+    for (auto sectorIt = tpcIt->second.begin(), sectorEnd = tpcIt->second.end();
+         sectorIt != sectorEnd; ++sectorIt)
+      for (auto padrowIt = sectorIt->second.begin(), padrowEnd = sectorIt->second.end();
+           padrowIt != padrowEnd; ++padrowIt)
+        for (auto padIt = padrowIt->second.begin(), padEnd = padrowIt->second.end();
+             padIt != padEnd; ++padIt)
+          memoryUsage.Add("clusterCharges",kHashNodeBytes + sizeof(vector<float>) +
+                          padIt->second.capacity()*sizeof(float),padIt->second.size());
+  for (auto tpcIt = driftProfiles.begin(), tpcEnd = driftProfiles.end(); tpcIt != tpcEnd; ++tpcIt)
+    for (auto sectorIt = tpcIt->second.begin(), sectorEnd = tpcIt->second.end();
+         sectorIt != sectorEnd; ++sectorIt)
+      for (auto padrowIt = sectorIt->second.begin(), padrowEnd = sectorIt->second.end();
+           padrowIt != padrowEnd; ++padrowIt)
+        memoryUsage.Add("driftProfiles",kHashNodeBytes + sizeof(DriftProfile) +
+                        3*padrowIt->second.fEntries.capacity()*sizeof(double),1);
+  unsigned long long nResults = 0;
+  for (auto chamberIt = spectrumADCs.begin(), chamberEnd = spectrumADCs.end();
+       chamberIt != chamberEnd; ++chamberIt)
+    for (auto sectorIt = chamberIt->second.begin(), sectorEnd = chamberIt->second.end();
+         sectorIt != sectorEnd; ++sectorIt)
+      for (auto padrowIt = sectorIt->second.begin(), padrowEnd = sectorIt->second.end();
+           padrowIt != padrowEnd; ++padrowIt)
+        nResults += padrowIt->second.size();
+  //Hash map nodes of spectrum ADCs, and the result tree baskets.
+  memoryUsage.Add("results",nResults*kHashNodeBytes + fResultTree->GetTotBytes() +
+                  fSectorResultTree->GetTotBytes(),nResults);
+  unsigned long long nFitResults = 0;
+  for (auto tpcIt = fitResults.begin(), tpcEnd = fitResults.end(); tpcIt != tpcEnd; ++tpcIt)
+    for (auto sectorIt = tpcIt->second.begin(), sectorEnd = tpcIt->second.end();
+         sectorIt != sectorEnd; ++sectorIt)
+      for (auto padrowIt = sectorIt->second.begin(), padrowEnd = sectorIt->second.end();
+           padrowIt != padrowEnd; ++padrowIt)
+        nFitResults += padrowIt->second.size();
+  memoryUsage.Add("fitResults",nFitResults*(kHashNodeBytes + sizeof(PadFitResult)),nFitResults);
+  memoryUsage.Print("Histogram and result memory");
+  fPhaseTimer.AddReportSection("memoryUsage",memoryUsage.ToJSON());
+
   //Clean up and finish.
-  gainsFileStream.close();
+  PhaseTimer::Scope outputWritePhase(fPhaseTimer,"outputWrite");
   fResultTree->Write();
+  fSectorResultTree->Write();
+  //The output file owns and deletes the trees created in it.
   outputFile->Close();
+  outputWritePhase.Stop();
+
+  if (fTraceRecorder.Write())
+    RecordOutputFile(fTraceRecorder.GetFilename());
+
+  //Timing report goes next to the gains XML.
+  const string timingFilename = currentWorkingDirectory + outputPrefix + "-Timing.json";
+  fPhaseTimer.Print();
+  if (fPhaseTimer.WriteJSON(timingFilename,outputPrefix)) {
+    RecordOutputFile(timingFilename);
+    cout << "[INFO] Timing report written to file " << timingFilename << endl;
+  }
   
   return exitCode; 
 }
 
-void ParseConfigFile(const std::string& configFile) {
-  //Open file.  
-  ifstream file(configFile);
-  //Parse lines in file.
-  std::string line;
-  cout << "[INFO] Parsing config file:" << endl;
-  while (std::getline(file, line))
-    {
-      std::istringstream lineString(line);
-      //Ignore lines beginning with a "#".
-      if (lineString.str().front() == '#')
-        continue;
-      //Parse everything else.
-      string variableName = "";
-      int foundPosition = 0;
-      if (lineString.str().find("tpcList",foundPosition) != string::npos) {
-        string tpcName = "";
-        while (line.find("tpcListEnd") == string::npos) {
-          std::getline(file,line);
-          std::istringstream nameString(line);
-          //Ignore lines beginning with a "#".
-          if (nameString.str().front() == '#')
-            continue;
-          if (!(nameString >> tpcName)) {
-            cout << "[ERROR] File parsing failed! Line: " << lineString.str() << endl;
-          }
-          //Translate to TPC Id.
-          const det::TPCConst::EId& tpcId = det::TPCConst::GetId(tpcName);
-          if (tpcId != det::TPCConst::eUnknown) {
-            fTPCIdList.insert(tpcId);
-            cout << "[INFO] Added TPC " << tpcName << " (ID = " << tpcId << ")" << endl;
+int RunDaemon(const string& socketPath)
+{
+  //Load the geometry once. Jobs run in forked processes that inherit it.
+  PhaseTimer::Scope geometryPhase(fPhaseTimer,"geometryInit");
+  fwk::CentralConfig::GetInstance("bootstrap.xml");
+  det::Detector& detector = det::Detector::GetInstance();
+  const unsigned int dummyRun = 1;
+  const utl::TimeStamp dummyTime = utl::TimeStamp(1);
+  detector.Update(dummyTime,dummyRun);
+  geometryPhase.Stop();
+  cout << "[INFO] Geometry loaded in " << fPhaseTimer.GetTiming("geometryInit").fWallTime
+       << " s." << endl;
+
+  sockaddr_un address;
+  if (!GetSocketAddress(socketPath,address)) {
+    cout << "[ERROR] Invalid socket path " << socketPath << "!" << endl;
+    return -1;
+  }
+  //Replace the socket of a previous daemon, but no other file.
+  struct stat socketStat;
+  if (lstat(socketPath.c_str(),&socketStat) == 0) {
+    if (!S_ISSOCK(socketStat.st_mode)) {
+      cout << "[ERROR] " << socketPath << " exists and is not a socket!" << endl;
+      return -1;
+    }
+    unlink(socketPath.c_str());
+  }
+  const int listenFd = socket(AF_UNIX,SOCK_STREAM,0);
+  if (listenFd < 0 || bind(listenFd,(const sockaddr*)&address,sizeof(address)) != 0 ||
+      listen(listenFd,16) != 0) {
+    cout << "[ERROR] Cannot listen on " << socketPath << ": " << strerror(errno) << endl;
+    if (listenFd >= 0)
+      close(listenFd);
+    return -1;
+  }
+  //A client that goes away must not end the daemon.
+  signal(SIGPIPE,SIG_IGN);
+  cout << "[INFO] Daemon listening on " << socketPath
+       << ". Submit jobs with KryptonAnalyzer --submit " << socketPath << " [arguments]." << endl;
+
+  unsigned int nJobs = 0;
+  for (;;) {
+    const int clientFd = accept(listenFd,nullptr,nullptr);
+    if (clientFd < 0) {
+      if (errno == EINTR)
+	continue;
+      cout << "[ERROR] Cannot accept jobs on " << socketPath << ": " << strerror(errno) << endl;
+      break;
+    }
+    DaemonJob job;
+    if (!ReadDaemonJob(clientFd,job)) {
+      WriteSocket(clientFd,kDaemonLinePrefix + "EXIT -1\n");
+      close(clientFd);
+      continue;
+    }
+    if (job.fArguments.size() == 1 && job.fArguments.front() == "--shutdown") {
+      WriteSocket(clientFd,kDaemonLinePrefix + "EXIT 0\n");
+      close(clientFd);
+      break;
+    }
+
+    ++nJobs;
+    cout << "[INFO] Job " << nJobs << " in " << job.fDirectory << endl;
+
+    //The job reports the files it wrote on a pipe, one path per line.
+    int outputPipe[2];
+    if (pipe(outputPipe) != 0) {
+      cout << "[ERROR] Cannot start job " << nJobs << ": " << strerror(errno) << endl;
+      WriteSocket(clientFd,kDaemonLinePrefix + "EXIT -1\n");
+      close(clientFd);
+      continue;
+    }
+
+    //The job writes its output to the client, and must not repeat ours.
+    cout << flush;
+    const pid_t pid = fork();
+    if (pid == 0) {
+      close(listenFd);
+      close(outputPipe[0]);
+      dup2(clientFd,STDOUT_FILENO);
+      dup2(clientFd,STDERR_FILENO);
+      close(clientFd);
+      if (chdir(job.fDirectory.c_str()) != 0) {
+	cout << "[ERROR] Cannot change to directory " << job.fDirectory << "!" << endl;
+	exit(-1);
+      }
+      fPhaseTimer.Restart();
+      fOutputFiles.clear();
+      const int jobExitCode = RunAnalysis(job.fArguments);
+      string outputList;
+      for (auto it = fOutputFiles.begin(), itEnd = fOutputFiles.end(); it != itEnd; ++it)
+	outputList += *it + "\n";
+      WriteSocket(outputPipe[1],outputList);
+      exit(jobExitCode);
+    }
+    close(outputPipe[1]);
+    int exitCode = -1;
+    vector<string> outputs;
+    if (pid < 0)
+      cout << "[ERROR] Cannot start job " << nJobs << ": " << strerror(errno) << endl;
+    else {
+      outputs = ReadLines(outputPipe[0]);
+      int status = 0;
+      while (waitpid(pid,&status,0) < 0 && errno == EINTR) { }
+      exitCode = WIFEXITED(status) ? (signed char)WEXITSTATUS(status) : -1;
+    }
+    close(outputPipe[0]);
+
+    string reply;
+    for (auto it = outputs.begin(), itEnd = outputs.end(); it != itEnd; ++it)
+      reply += kDaemonLinePrefix + "OUTPUT " + *it + "\n";
+    reply += kDaemonLinePrefix + "EXIT " + to_string(exitCode) + "\n";
+    WriteSocket(clientFd,reply);
+    close(clientFd);
+    cout << "[INFO] Job " << nJobs << " finished with exit code " << exitCode << ", "
+	 << outputs.size() << " output files." << endl;
+  }
+
+  close(listenFd);
+  unlink(socketPath.c_str());
+  cout << "[INFO] Daemon stopped after " << nJobs << " jobs." << endl;
+  return 0;
+}
+
+void RecordOutputFile(const string& filename)
+{
+  fOutputFiles.push_back(boost::filesystem::absolute(filename).string());
+}
+
+int ParseIntArgument(const string& argument, const string& value)
+{
+  size_t length = 0;
+  int number = 0;
+  try {
+    number = stoi(value,&length);
+  }
+  catch (const std::exception&) {
+    length = 0;
+  }
+  if (length == 0 || length != value.size()) {
+    cout << "[ERROR] Invalid value " << value << " for argument " << argument << "!" << endl;
+    DisplayUsage();
+  }
+  return number;
+}
+
+double ParseDoubleArgument(const string& argument, const string& value)
+{
+  size_t length = 0;
+  double number = 0;
+  try {
+    number = stod(value,&length);
+  }
+  catch (const std::exception&) {
+    length = 0;
+  }
+  if (length == 0 || length != value.size()) {
+    cout << "[ERROR] Invalid value " << value << " for argument " << argument << "!" << endl;
+    DisplayUsage();
+  }
+  return number;
+}
+
+bool ParseConfigFile(const std::string& configFile) {
+  //Open file.  
+  ifstream file(configFile);
+  //Parse lines in file.
+  std::string line;
+  cout << "[INFO] Parsing config file:" << endl;
+  while (std::getline(file, line))
+    {
+      std::istringstream lineString(line);
+      //Ignore lines beginning with a "#".
+      if (lineString.str().front() == '#')
+        continue;
+      //Parse everything else.
+      string variableName = "";
+      int foundPosition = 0;
+      if (lineString.str().find("tpcList",foundPosition) != string::npos) {
+        string tpcName = "";
+        while (line.find("tpcListEnd") == string::npos) {
+          std::getline(file,line);
+          std::istringstream nameString(line);
+          //Ignore lines beginning with a "#".
+          if (nameString.str().front() == '#')
+            continue;
+          if (!(nameString >> tpcName)) {
+            cout << "[ERROR] File parsing failed! Line: " << lineString.str() << endl;
+          }
+          //Translate to TPC Id.
+          const det::TPCConst::EId& tpcId = det::TPCConst::GetId(tpcName);
+          if (tpcId != det::TPCConst::eUnknown) {
+            fTPCIdList.insert(tpcId);
+            cout << "[INFO] Added TPC " << tpcName << " (ID = " << tpcId << ")" << endl;
+          }
+        }
+      }
+      //Cut set blocks are recognized by their exact keyword only.
+      string keyword = "";
+      std::istringstream(line) >> keyword;
+      if (keyword == "cutSetEnd") {
+        cout << "[ERROR] cutSetEnd without cutSet in " << configFile << "!" << endl;
+        return false;
+      }
+      if (keyword == "cutSet") {
+        //Named cut set: cut lines until cutSetEnd override the main cuts.
+        string cutSetName = "";
+        if (!(lineString >> variableName >> cutSetName)) {
+          cout << "[ERROR] File parsing failed! Line: " << lineString.str() << endl;
+          return false;
+        }
+        CutOverrides overrides;
+        bool closed = false;
+        while (std::getline(file,line)) {
+          std::istringstream cutString(line);
+          string cutName = "";
+          double cutValue = 0;
+          if (!(cutString >> cutName) || cutName.front() == '#')
+            continue;
+          if (cutName == "cutSetEnd") {
+            closed = true;
+            break;
           }
+          if (cutName == "cutSet") {
+            cout << "[ERROR] Nested cutSet in cut set " << cutSetName << " of "
+                 << configFile << "!" << endl;
+            return false;
+          }
+          ClusterCuts testCuts;
+          if (!(cutString >> cutValue) || !SetClusterCut(testCuts,cutName,cutValue)) {
+            cout << "[ERROR] File parsing failed! Line: " << line << endl;
+            continue;
+          }
+          overrides.push_back(make_pair(cutName,cutValue));
         }
+        if (!closed) {
+          cout << "[ERROR] Cut set " << cutSetName << " of " << configFile
+               << " is not closed with cutSetEnd!" << endl;
+          return false;
+        }
+        fCutSets.push_back(make_pair(cutSetName,overrides));
+        cout << "[INFO] Cut set " << cutSetName << " with " << overrides.size()
+             << " modified cuts" << endl;
+        continue;
       }
       if (lineString.str().find("fitFunction",foundPosition) != string::npos) {
         if (!(lineString >> variableName >> fFitFunction)) {
@@ -1090,42 +1827,1339 @@ void ParseConfigFile(const std::string& configFile) {
       }
       
     } //End parsing.
-  return;  
+  return true;  
 }
 
-void ReplacePadGainPath(const std::string& bootstrap,
-                        const std::string& newPadGainXML) 
+void FitDetectorSpectra(const DetectorHistograms& spectraHistograms,
+			DetectorADCs& spectrumADCs,
+			DEDXTools::SectorAveragers& sectorAccumulators,
+			const string& phaseName,
+			DetectorFitResults* fitResults)
 {
-  //Definitions.
-  string defaultPadGainXML = "&configDir;/TPCPadGainFixedManager.xml";
-  string tempBootstrapName = "bootstrap-temp.xml";
-  //Open file.  
-  ifstream file(bootstrap);
-  //Create output file.
-  ofstream outputFile(tempBootstrapName);
-  //Parse lines in file.
-  std::string line;
-  cout << "[INFO] Replacing default pad gain path with new path: " << newPadGainXML << endl;
-  while (std::getline(file, line)) {
-    //Search for path to default TPC pad gain XML.
-    size_t foundPosition = line.find(defaultPadGainXML);
-    if (foundPosition != string::npos) {
-      line.replace(foundPosition,
-                   defaultPadGainXML.size(),
-                   newPadGainXML);
-    }
-    //Copy string to temp file.
-    outputFile << line << endl;
-  }
-  //Move the tmp file to original bootstrap location.
-  namespace fs = boost::filesystem;
-  try {
-    fs::rename(tempBootstrapName,bootstrap);
+  for (auto chamberIt = spectraHistograms.begin(), chamberEnd = spectraHistograms.end();
+       chamberIt != chamberEnd; ++chamberIt) {
+    const unsigned int tpcId = chamberIt->first;
+    const SectorHistograms& sectorHistograms = chamberIt->second;
+    for (auto sectorIt = sectorHistograms.begin(), sectorEnd = sectorHistograms.end();
+         sectorIt != sectorEnd; ++sectorIt) {
+      const unsigned int sectorId = sectorIt->first;
+      const PadrowHistograms& padrowHistograms = sectorIt->second;
+      const double minADCPeakSearch = 
+	((det::TPCConst::EId)tpcId == 
+	 det::TPCConst::eVTPC1 && (sectorId == 1 || sectorId == 4)) ? 
+	fMinADCPeakSearchVTPC1Upstream : fMinADCPeakSearch;
+      //Pads are fitted in one batch per sector.
+      PhaseTimer::Scope fittingPhase(fPhaseTimer,phaseName,
+				     det::TPCConst::GetName((det::TPCConst::EId)tpcId) +
+				     Form("Sector%u",sectorId));
+      for (auto padrowIt = padrowHistograms.begin(), padrowEnd = padrowHistograms.end();
+           padrowIt != padrowEnd; ++padrowIt) {
+        const unsigned int padrowId = padrowIt->first;
+        const PadHistograms& padHistograms = padrowIt->second;
+        for (auto padIt = padHistograms.begin(), padEnd = padHistograms.end();
+             padIt != padEnd; ++padIt) {
+          const unsigned int padId = padIt->first;
+
+          //Get histogram.
+          TH1D* padHistogram = padIt->second.get();
+
+          //Don't do anything for pads with too few entries.
+          if (padHistogram->GetEntries() < fMinHistogramEntries) {
+            if (fitResults != nullptr)
+              (*fitResults)[tpcId][sectorId][padrowId][padId].fEntries =
+                padHistogram->GetEntries();
+            continue;
+          }
+          fittingPhase.AddEntries(1);
+
+          //Search for peak above minimum acceptable Krypton peak value,
+          //perform desired fit and store results.
+          const SpectrumPeak peak = FindSpectrumPeak(*padHistogram,minADCPeakSearch);
+          const PadFitResult fitResult = FitPadSpectrum(*padHistogram,peak,fFitFunction);
+          if (fitResult.fFitted) {
+            spectrumADCs[tpcId][sectorId][padrowId][padId] = fitResult.fSpectrumADC;
+            sectorAccumulators.AddValue(tpcId,sectorId,fitResult.fSpectrumADC);
+          }
+          if (fitResults != nullptr)
+            (*fitResults)[tpcId][sectorId][padrowId][padId] = fitResult;
+        } // Pad loop.
+      } // Padrow loop.
+    } // Sector loop.
+  } // TPC loop.
+}
+
+bool HasSector(const det::TPC& tpc,
+	       const det::TPCConst::EId tpcId,
+	       const unsigned int sectorId)
+{
+  const det::TPCChamber& chamber = tpc.GetChamber(tpcId);
+  for (auto sectorIt = chamber.SectorsBegin(), sectorEnd = chamber.SectorsEnd();
+       sectorIt != sectorEnd; ++sectorIt)
+    if (sectorIt->GetId() == sectorId)
+      return true;
+  return false;
+}
+
+vector<string> ValidateInputFiles(const vector<string>& filenames,
+				  const bool readBaskets,
+				  const unsigned int nThreads,
+				  const string& quarantineFilename)
+{
+  PhaseTimer::Scope validationPhase(fPhaseTimer,"validation");
+  validationPhase.AddEntries(filenames.size());
+  vector<string> reasons(filenames.size());
+  atomic<unsigned int> nextFile(0);
+  auto validateFiles = [&]() {
+    for (unsigned int fileIndex = nextFile++; fileIndex < filenames.size();
+	 fileIndex = nextFile++)
+      reasons[fileIndex] = ValidateInputFile(filenames[fileIndex],readBaskets);
+  };
+  vector<thread> validators;
+  for (unsigned int i = 1; i < nThreads; ++i)
+    validators.push_back(thread(validateFiles));
+  validateFiles();
+  for (auto it = validators.begin(), itEnd = validators.end(); it != itEnd; ++it)
+    it->join();
+
+  //Keep the input order of the good files.
+  vector<string> goodFilenames;
+  unsigned int nQuarantined = 0;
+  ofstream quarantineFile;
+  for (unsigned int i = 0; i < filenames.size(); ++i) {
+    if (reasons[i].empty()) {
+      goodFilenames.push_back(filenames[i]);
+      continue;
+    }
+    if (nQuarantined == 0) {
+      quarantineFile.open(quarantineFilename);
+      RecordOutputFile(quarantineFilename);
+    }
+    quarantineFile << filenames[i] << " # " << reasons[i] << endl;
+    cout << "[WARNING] Quarantined " << filenames[i] << ": " << reasons[i] << endl;
+    ++nQuarantined;
   }
-  catch (fs::filesystem_error& e) {
-    cout << e.what() << '\n';
+  if (nQuarantined > 0)
+    cout << "[WARNING] " << nQuarantined << " of " << filenames.size()
+	 << " input files quarantined. List written to " << quarantineFilename << endl;
+  else
+    cout << "[INFO] All " << filenames.size() << " input files are valid." << endl;
+  return goodFilenames;
+}
+
+bool ProcessInputFile(const string& filename,
+		      const det::TPC& tpc,
+		      const ClusterCuts& cuts,
+		      const bool updateGains,
+		      const bool remapGains,
+		      ClusterBlock& block,
+		      DetectorHistograms& spectraHistograms,
+		      DetectorQAHistograms& sectorQAHistograms,
+		      const vector<CutSetBank>& cutSetBanks,
+		      DetectorCharges* clusterCharges,
+		      DetectorDriftProfiles* driftProfiles,
+		      const unsigned int nDriftBins,
+		      DetectorChannels* channelStatistics,
+		      const double hotPadFactor,
+		      const bool sharedSpectra,
+		      const bool padSort,
+		      const string& onlyTree)
+{
+  //Open the file for filling and get the TTree.
+  PhaseTimer::Scope openPhase(fPhaseTimer,"fileOpen",filename);
+  unique_ptr<TFile> inputFile(new TFile(filename.c_str(),"READ"));
+  if (inputFile->IsZombie()) {
+    cout << "[WARNING] Error opening input file! Skipping." << endl;
+    return false;
   }
-  return;
+
+  if (inputFile->GetNkeys() == 0) {
+    cout << "[WARNING] " << filename << " has no keys. Skipping." << endl;
+    return false;
+  }
+  openPhase.AddBytesRead(inputFile->GetBytesRead());
+  openPhase.Stop();
+  Long64_t bytesRead = inputFile->GetBytesRead();
+  ClusterBlock sortScratch;
+
+  //Loop through keys in input file.
+  TIter fileIter(inputFile->GetListOfKeys());
+  TKey *key;
+  while ((key = (TKey*)fileIter())) {
+    if (!onlyTree.empty() && onlyTree != key->GetName())
+      continue;
+    //Older cycles of a tree are backups of the same entries.
+    const TKey* latestKey = inputFile->GetKey(key->GetName());
+    if (latestKey != nullptr && latestKey->GetCycle() != key->GetCycle())
+      continue;
+    //Each object is read once, and deleted before the next key.
+    unique_ptr<TObject> object(key->ReadObj());
+    if (object->InheritsFrom("TTree")) {
+      TTree* tree = dynamic_cast<TTree*>(object.get());
+
+      //Ignore empty trees.
+      if (tree->GetEntries() == 0)
+	continue;
+    
+      //Identify TPC and sector.
+      //Format: TTree name = [TPCName]Sector[SectorId]Clusters
+      const string& treeName = tree->GetName();
+      string tpcName;
+      unsigned int sectorId;
+      if (!ParseSectorTreeName(treeName,tpcName,sectorId)) {
+	cout << "[WARNING] Tree " << treeName << " in " << filename
+	     << " is not a sector tree. Skipping." << endl;
+	continue;
+      }
+      const det::TPCConst::EId tpcId = det::TPCConst::GetId(tpcName);
+
+      //Skip entries for TPCs we do not wish to calibrate.
+      if (fTPCIdList.find(tpcId) == fTPCIdList.end())
+	continue;
+
+      if (!HasSector(tpc,tpcId,sectorId)) {
+	cout << "[WARNING] " << tpcName << " has no sector " << sectorId << " (tree "
+	     << treeName << " in " << filename << "). Skipping." << endl;
+	continue;
+      }
+      const det::TPCSector& sector = tpc.GetChamber(tpcId).GetSector(sectorId);
+    
+      block.SetBranchAddresses(*tree);
+      PadrowHistograms& sectorHistograms = spectraHistograms[tpcId][sectorId];
+      const PadrowGains* previousSectorGains = (updateGains) ?
+	GetSectorGains(fPreviousGains,tpcId,sectorId) : nullptr;
+
+      //Prepare QA plots.
+      TString nameString = tpcName.data() +
+	TString("Sector") + Form("%i",(unsigned int)sector.GetId());
+      TString titleString = tpcName.data() +
+	TString(" Sector ") + Form("%i",(unsigned int)sector.GetId());
+    
+      const double minADCPeakSearch = 
+	(tpcId == det::TPCConst::eVTPC1 && (sectorId == 1 || sectorId == 4)) ? 
+	fMinADCPeakSearchVTPC1Upstream : fMinADCPeakSearch;
+    
+      const double histogramMax = minADCPeakSearch*fHistogramPadding;
+      const unsigned int nPadrows = sector.GetNPadrows();
+      const unsigned int nPads = sector.GetPadrow(sector.GetNPadrows()).GetNPads();
+    
+      if (sectorQAHistograms.find(tpcId) == sectorQAHistograms.end() ||
+	  sectorQAHistograms.at(tpcId).find(sectorId) == 
+	  sectorQAHistograms.at(tpcId).end()) {
+	PhaseTimer::Scope bookingPhase(fPhaseTimer,"histogramBooking");
+	sectorQAHistograms[tpcId][sectorId] =
+	  BookSectorQAHistograms(nameString,titleString,nPadrows,nPads,histogramMax,
+				 fHistogramBins,fMaxPads,fMaxTimeSlices);
+      }
+    
+      SectorQAHistograms& sectorQA = sectorQAHistograms[tpcId][sectorId];
+      PadrowChannels* sectorChannels = (channelStatistics != nullptr) ?
+	&(*channelStatistics)[tpcId][sectorId] : nullptr;
+      bool hasExcludedPads = (sectorChannels != nullptr && CountExcludedPads(*sectorChannels) > 0);
+
+      //Decode and fill clusters block by block. The block phases are traced
+      //once per tree: the decode and fill times of all blocks are summed
+      //and recorded as consecutive spans from the start of the tree.
+      TraceRecorder::Span treeSpan(fTraceRecorder,"treeProcess",treeName);
+      const chrono::steady_clock::time_point treeStart = chrono::steady_clock::now();
+      double treeReadTime = 0;
+      double treeFillTime = 0;
+      const Long64_t nEntries = tree->GetEntries();
+      for (Long64_t blockStart = 0; blockStart < nEntries; blockStart += kClusterBlockSize) {
+	const Long64_t blockEnd = min(nEntries,blockStart + (Long64_t)kClusterBlockSize);
+	PhaseTimer::Scope readPhase(fPhaseTimer,"treeRead",treeName,PhaseTimer::eBlock);
+	block.Read(*tree,blockStart,blockEnd);
+	readPhase.AddEntries(block.fSize);
+	readPhase.AddBytesRead(inputFile->GetBytesRead() - bytesRead);
+	readPhase.Stop();
+	treeReadTime += readPhase.GetWallTime();
+	bytesRead = inputFile->GetBytesRead();
+
+	//Clusters come in event order, spread over the sector: sort them by
+	//pad, so that the spectrum and channel counts of each pad are filled
+	//in one run.
+	if (padSort) {
+	  PhaseTimer::Scope sortPhase(fPhaseTimer,"padSort","",PhaseTimer::eBlock);
+	  sortPhase.AddEntries(block.fSize);
+	  SortClusterBlockByPad(block,sortScratch);
+	}
+
+	if (sectorChannels != nullptr) {
+	  PhaseTimer::Scope channelPhase(fPhaseTimer,"channelStatistics","",PhaseTimer::eBlock);
+	  channelPhase.AddEntries(block.fSize);
+	  AccumulateChannelStatistics(block,cuts,minADCPeakSearch,*sectorChannels);
+	  if (hasExcludedPads)
+	    RemoveExcludedPads(block,*sectorChannels);
+	}
+
+	PhaseTimer::Scope fillPhase(fPhaseTimer,"fill","",PhaseTimer::eBlock);
+	fillPhase.AddEntries(block.fSize);
+	FillClusterBlock(block,cuts,sectorHistograms,sectorQA,
+			 (remapGains) ? nullptr : previousSectorGains,sharedSpectra);
+	fillPhase.Stop();
+	treeFillTime += fillPhase.GetWallTime();
+
+	if (clusterCharges != nullptr) {
+	  PhaseTimer::Scope storePhase(fPhaseTimer,"chargeStore","",PhaseTimer::eBlock);
+	  storePhase.AddEntries(block.fSize);
+	  StoreClusterCharges(block,cuts,sectorHistograms,(*clusterCharges)[tpcId][sectorId]);
+	}
+
+	if (driftProfiles != nullptr) {
+	  PhaseTimer::Scope driftPhase(fPhaseTimer,"driftFill","",PhaseTimer::eBlock);
+	  driftPhase.AddEntries(block.fSize);
+	  FillClusterBlockDrift(block,cuts,nDriftBins,(*driftProfiles)[tpcId][sectorId],
+				previousSectorGains);
+	}
+
+	if (cutSetBanks.empty())
+	  continue;
+	PhaseTimer::Scope cutSetFillPhase(fPhaseTimer,"cutSetFill","",PhaseTimer::eBlock);
+	cutSetFillPhase.AddEntries(block.fSize*cutSetBanks.size());
+	for (auto it = cutSetBanks.begin(), itEnd = cutSetBanks.end(); it != itEnd; ++it)
+	  FillClusterBlockSpectra(block,it->fCuts,(*it->fSpectra)[tpcId][sectorId],
+				  previousSectorGains,sharedSpectra);
+      } //End TTree loop.
+
+      if (fTraceRecorder.IsEnabled()) {
+	const chrono::steady_clock::time_point readStop = treeStart +
+	  chrono::duration_cast<chrono::steady_clock::duration>(chrono::duration<double>(treeReadTime));
+	const chrono::steady_clock::time_point fillStop = readStop +
+	  chrono::duration_cast<chrono::steady_clock::duration>(chrono::duration<double>(treeFillTime));
+	fTraceRecorder.AddSpan("treeRead",treeStart,readStop,treeName);
+	fTraceRecorder.AddSpan("fill",readStop,fillStop,treeName);
+      }
+
+      //Exclude hot pads from the following files.
+      if (sectorChannels != nullptr && hotPadFactor > 0) {
+	const unsigned int nExcluded =
+	  ExcludeHotPads(*sectorChannels,hotPadFactor,kMinHotPadClusters);
+	if (nExcluded > 0)
+	  cout << "[WARNING] Excluding " << nExcluded << " hot pads of " << tpcName
+	       << " sector " << sectorId << " after " << filename << endl;
+      }
+
+    } //End inherets from TTree.
+  } //End key iteration.
+  inputFile->Close();
+  return true;
+}
+
+bool ReadStoredSpectra(const string& filename,
+		       const det::TPC& tpc,
+		       DetectorHistograms& spectraHistograms,
+		       DetectorQAHistograms& sectorQAHistograms)
+{
+  PhaseTimer::Scope readPhase(fPhaseTimer,"spectraRead",filename);
+  unique_ptr<TFile> file(new TFile(filename.c_str(),"READ"));
+  if (file->IsZombie()) {
+    cout << "[ERROR] Could not open " << filename << "!" << endl;
+    return false;
+  }
+  //Pad spectra and sector QA written with --write-threads are in shard files.
+  vector<unique_ptr<TFile> > storedFiles;
+  storedFiles.push_back(move(file));
+  const string storedBase = (filename.size() > 5 && filename.substr(filename.size() - 5) == ".root") ?
+    filename.substr(0,filename.size() - 5) : filename;
+  for (unsigned int shard = 0;
+       boost::filesystem::exists(GetOutputShardFilename(storedBase,shard)); ++shard) {
+    storedFiles.emplace_back(new TFile(GetOutputShardFilename(storedBase,shard).c_str(),"READ"));
+    if (storedFiles.back()->IsZombie()) {
+      cout << "[ERROR] Could not open " << GetOutputShardFilename(storedBase,shard) << "!" << endl;
+      return false;
+    }
+  }
+  if (storedFiles.size() > 1)
+    cout << "[INFO] Reading " << storedFiles.size() - 1 << " output shards of " << filename << endl;
+  TFile& mainFile = *storedFiles.front();
+
+  //Per-sector 2D spectra (--sector-spectra) come with the pad index tree.
+  unique_ptr<TTree> indexTree(mainFile.Get<TTree>("fPadSpectraIndex"));
+  unsigned int nRead = 0;
+  unsigned int nMismatched = 0;
+  if (indexTree) {
+    unsigned int tpcId = 0;
+    unsigned int sectorId = 0;
+    unsigned int padrowId = 0;
+    unsigned int padId = 0;
+    unsigned int padIndex = 0;
+    double entries = 0;
+    indexTree->SetBranchAddress("fTPCId",&tpcId);
+    indexTree->SetBranchAddress("fSectorId",&sectorId);
+    indexTree->SetBranchAddress("fPadrowId",&padrowId);
+    indexTree->SetBranchAddress("fPadId",&padId);
+    indexTree->SetBranchAddress("fPadIndex",&padIndex);
+    indexTree->SetBranchAddress("fEntries",&entries);
+    //Index entries are ordered by sector, so one sector histogram is held at a time.
+    unique_ptr<TH2D> sectorSpectra;
+    pair<unsigned int,unsigned int> currentSector(0,0);
+    for (Long64_t i = 0; i < indexTree->GetEntries(); ++i) {
+      indexTree->GetEntry(i);
+      if (entries <= 0)
+	continue;
+      const auto tpcIt = spectraHistograms.find(tpcId);
+      if (tpcIt == spectraHistograms.end())
+	continue;
+      if (!sectorSpectra || currentSector != make_pair(tpcId,sectorId)) {
+	currentSector = make_pair(tpcId,sectorId);
+	sectorSpectra.reset(mainFile.Get<TH2D>(Form("%sSector%iPadSpectra",
+					      det::TPCConst::GetName((det::TPCConst::EId)tpcId).data(),
+					      sectorId)));
+      }
+      TH1D* spectrum = nullptr;
+      const auto sectorHistogramsIt = tpcIt->second.find(sectorId);
+      if (sectorHistogramsIt != tpcIt->second.end()) {
+	const auto padrowHistogramsIt = sectorHistogramsIt->second.find(padrowId);
+	if (padrowHistogramsIt != sectorHistogramsIt->second.end()) {
+	  const auto padHistogramIt = padrowHistogramsIt->second.find(padId);
+	  if (padHistogramIt != padrowHistogramsIt->second.end())
+	    spectrum = padHistogramIt->second.get();
+	}
+      }
+      if (!sectorSpectra || spectrum == nullptr)
+	continue;
+      const int nBins = spectrum->GetNbinsX();
+      if (sectorSpectra->GetNbinsY() != nBins ||
+	  sectorSpectra->GetYaxis()->GetXmax() != spectrum->GetXaxis()->GetXmax()) {
+	++nMismatched;
+	continue;
+      }
+      for (int bin = 0; bin <= nBins + 1; ++bin)
+	spectrum->SetBinContent(bin,sectorSpectra->GetBinContent(padIndex + 1,bin));
+      spectrum->ResetStats();
+      spectrum->SetEntries(entries);
+      ++nRead;
+    }
+  }
+  else {
+    for (auto tpcIt = spectraHistograms.begin(), tpcEnd = spectraHistograms.end();
+	 tpcIt != tpcEnd; ++tpcIt)
+      for (auto sectorIt = tpcIt->second.begin(), sectorEnd = tpcIt->second.end();
+	   sectorIt != sectorEnd; ++sectorIt)
+	for (auto padrowIt = sectorIt->second.begin(), padrowEnd = sectorIt->second.end();
+	     padrowIt != padrowEnd; ++padrowIt)
+	  for (auto padIt = padrowIt->second.begin(), padEnd = padrowIt->second.end();
+	       padIt != padEnd; ++padIt) {
+	    TH1D* spectrum = padIt->second.get();
+	    unique_ptr<TH1D> stored;
+	    for (auto fileIt = storedFiles.begin(), fileEnd = storedFiles.end();
+		 !stored && fileIt != fileEnd; ++fileIt)
+	      stored.reset((*fileIt)->Get<TH1D>(spectrum->GetName()));
+	    if (!stored)
+	      continue;
+	    if (stored->GetNbinsX() != spectrum->GetNbinsX() ||
+		stored->GetXaxis()->GetXmax() != spectrum->GetXaxis()->GetXmax()) {
+	      ++nMismatched;
+	      continue;
+	    }
+	    spectrum->Add(stored.get());
+	    ++nRead;
+	  }
+  }
+  if (nMismatched > 0) {
+    cout << "[ERROR] " << nMismatched << " stored pad spectra have another binning than "
+	 << "configured. Refit with the histogramBins and histogramPadding of the original run!"
+	 << endl;
+    return false;
+  }
+  if (nRead == 0) {
+    cout << "[ERROR] No pad spectra of the configured TPCs found in " << filename << "!" << endl;
+    return false;
+  }
+
+  //Sector QA, if the original run stored it.
+  unsigned int nQASectors = 0;
+  for (auto chamberIt = tpc.ChambersBegin(), chamberEnd = tpc.ChambersEnd();
+       chamberIt != chamberEnd; ++chamberIt) {
+    const det::TPCChamber& chamber = *chamberIt;
+    if (fTPCIdList.find(chamber.GetId()) == fTPCIdList.end())
+      continue;
+    for (auto sectorIt = chamber.SectorsBegin(), sectorEnd = chamber.SectorsEnd();
+	 sectorIt != sectorEnd; ++sectorIt) {
+      const det::TPCSector& sector = *sectorIt;
+      const TString nameString = det::TPCConst::GetName(chamber.GetId()) +
+	TString("Sector") + Form("%i",(unsigned int)sector.GetId());
+      SectorQAHistograms qa;
+      bool found = false;
+      for (auto fileIt = storedFiles.begin(), fileEnd = storedFiles.end();
+	   !found && fileIt != fileEnd; ++fileIt)
+	found = ReadSectorQAHistograms(**fileIt,nameString,qa);
+      if (!found)
+	continue;
+      sectorQAHistograms[(unsigned int)chamber.GetId()][sector.GetId()] = std::move(qa);
+      ++nQASectors;
+    }
+  }
+  cout << "[INFO] Read " << nRead << " pad spectra and the QA of " << nQASectors
+       << " sectors from " << filename << endl;
+  if (nQASectors == 0)
+    cout << "[WARNING] No sector QA stored in " << filename << ". QA pages are skipped." << endl;
+  return true;
+}
+
+void IterateCalibration(const det::TPC& tpc,
+			const DetectorCharges& clusterCharges,
+			const vector<DetectorHistograms>& fineSpectra,
+			const unsigned int nIterations,
+			const double tolerance,
+			DetectorHistograms& spectraHistograms,
+			DetectorGains& appliedGains,
+			DetectorADCs& spectrumADCs,
+			DEDXTools::SectorAveragers& sectorAccumulators,
+			DetectorFitResults* fitResults)
+{
+  unsigned long long nCharges = 0;
+  for (auto tpcIt = clusterCharges.begin(), tpcEnd = clusterCharges.end(); tpcIt != tpcEnd; ++tpcIt)
+    for (auto sectorIt = tpcIt->second.begin(), sectorEnd = tpcIt->second.end();
+	 sectorIt != sectorEnd; ++sectorIt)
+      for (auto padrowIt = sectorIt->second.begin(), padrowEnd = sectorIt->second.end();
+	   padrowIt != padrowEnd; ++padrowIt)
+	for (auto padIt = padrowIt->second.begin(), padEnd = padrowIt->second.end();
+	     padIt != padEnd; ++padIt)
+	  nCharges += padIt->second.size();
+  if (fineSpectra.empty())
+    cout << "[INFO] Iterating on " << nCharges << " stored cluster charges ("
+	 << nCharges*sizeof(float)/1e6 << " MB)." << endl;
+  else
+    cout << "[INFO] Iterating on the uncorrected fine spectra." << endl;
+
+  for (unsigned int iteration = 1; ; ++iteration) {
+    //Gains from the current spectra, and their change w.r.t. the applied gains.
+    const DetectorGains gains =
+      ComputePadGains(tpc,spectrumADCs,sectorAccumulators,appliedGains);
+    double maxChange = 0;
+    unsigned int nAccepted = 0;
+    for (auto tpcIt = gains.begin(), tpcEnd = gains.end(); tpcIt != tpcEnd; ++tpcIt)
+      for (auto sectorIt = tpcIt->second.begin(), sectorEnd = tpcIt->second.end();
+	   sectorIt != sectorEnd; ++sectorIt)
+	for (auto padrowIt = sectorIt->second.begin(), padrowEnd = sectorIt->second.end();
+	     padrowIt != padrowEnd; ++padrowIt)
+	  for (auto padIt = padrowIt->second.begin(), padEnd = padrowIt->second.end();
+	       padIt != padEnd; ++padIt) {
+	    if (padIt->second <= 0)
+	      continue;
+	    const double appliedGain = GetPadGain(appliedGains,tpcIt->first,sectorIt->first,
+						  padrowIt->first,padIt->first);
+	    maxChange = max(maxChange,fabs(padIt->second/appliedGain - 1));
+	    ++nAccepted;
+	  }
+    cout << "[INFO] Iteration " << iteration << ": maximum relative gain change "
+	 << maxChange << " (" << nAccepted << " accepted pads)." << endl;
+    if (maxChange < tolerance) {
+      cout << "[INFO] Gains converged after " << iteration << " iterations." << endl;
+      return;
+    }
+    if (iteration == nIterations) {
+      cout << "[WARNING] Gains not converged to " << tolerance << " after "
+	   << nIterations << " iterations." << endl;
+      return;
+    }
+
+    //Apply the new gains of accepted pads. Rejected pads keep their gain.
+    for (auto tpcIt = gains.begin(), tpcEnd = gains.end(); tpcIt != tpcEnd; ++tpcIt)
+      for (auto sectorIt = tpcIt->second.begin(), sectorEnd = tpcIt->second.end();
+	   sectorIt != sectorEnd; ++sectorIt)
+	for (auto padrowIt = sectorIt->second.begin(), padrowEnd = sectorIt->second.end();
+	     padrowIt != padrowEnd; ++padrowIt)
+	  for (auto padIt = padrowIt->second.begin(), padEnd = padrowIt->second.end();
+	       padIt != padEnd; ++padIt)
+	    if (padIt->second > 0)
+	      appliedGains[tpcIt->first][sectorIt->first][padrowIt->first][padIt->first] =
+		padIt->second;
+
+    //Refill the pad spectra from the stored charges, or remap the fine
+    //spectra, and refit.
+    PhaseTimer::Scope refillPhase(fPhaseTimer,"iterationFill",Form("Iteration%u",iteration + 1));
+    for (auto tpcIt = spectraHistograms.begin(), tpcEnd = spectraHistograms.end();
+	 tpcIt != tpcEnd; ++tpcIt)
+      for (auto sectorIt = tpcIt->second.begin(), sectorEnd = tpcIt->second.end();
+	   sectorIt != sectorEnd; ++sectorIt)
+	for (auto padrowIt = sectorIt->second.begin(), padrowEnd = sectorIt->second.end();
+	     padrowIt != padrowEnd; ++padrowIt)
+	  for (auto padIt = padrowIt->second.begin(), padEnd = padrowIt->second.end();
+	       padIt != padEnd; ++padIt)
+	    padIt->second->Reset();
+    for (auto it = fineSpectra.begin(), itEnd = fineSpectra.end(); it != itEnd; ++it)
+      RemapHistograms(spectraHistograms,*it,appliedGains);
+    //Charges of pads without a spectrum are never filled.
+    for (auto tpcIt = clusterCharges.begin(), tpcEnd = clusterCharges.end(); tpcIt != tpcEnd; ++tpcIt) {
+      auto tpcHistogramIt = spectraHistograms.find(tpcIt->first);
+      if (tpcHistogramIt == spectraHistograms.end())
+	continue;
+      for (auto sectorIt = tpcIt->second.begin(), sectorEnd = tpcIt->second.end();
+	   sectorIt != sectorEnd; ++sectorIt) {
+	auto sectorHistogramIt = tpcHistogramIt->second.find(sectorIt->first);
+	if (sectorHistogramIt == tpcHistogramIt->second.end())
+	  continue;
+	for (auto padrowIt = sectorIt->second.begin(), padrowEnd = sectorIt->second.end();
+	     padrowIt != padrowEnd; ++padrowIt)
+	  for (auto padIt = padrowIt->second.begin(), padEnd = padrowIt->second.end();
+	       padIt != padEnd; ++padIt) {
+	    TH1D* histogram = GetPadSpectrum(sectorHistogramIt->second,padrowIt->first,padIt->first);
+	    if (histogram == nullptr)
+	      continue;
+	    const double gain = GetPadGain(appliedGains,tpcIt->first,sectorIt->first,
+					   padrowIt->first,padIt->first);
+	    const vector<float>& charges = padIt->second;
+	    for (auto chargeIt = charges.begin(), chargeEnd = charges.end();
+		 chargeIt != chargeEnd; ++chargeIt)
+	      histogram->Fill((Float16_t)(*chargeIt*gain));
+	    refillPhase.AddEntries(charges.size());
+	  }
+      }
+    }
+    refillPhase.Stop();
+
+    spectrumADCs.clear();
+    sectorAccumulators = DEDXTools::SectorAveragers();
+    if (fitResults != nullptr)
+      fitResults->clear();
+    FitDetectorSpectra(spectraHistograms,spectrumADCs,sectorAccumulators,"iterationFitting",
+		       fitResults);
+  }
+}
+
+DetectorGains ComputePadGains(const det::TPC& tpc,
+			      const DetectorADCs& spectrumADCs,
+			      const DEDXTools::SectorAveragers& sectorAccumulators,
+			      const DetectorGains& previousGains)
+{
+  DetectorGains gains;
+  for (auto chamberIt = tpc.ChambersBegin(), chamberEnd = tpc.ChambersEnd();
+       chamberIt != chamberEnd; ++chamberIt) {
+    const det::TPCChamber& chamber = *chamberIt;
+    const unsigned int tpcId = (unsigned int)chamber.GetId();
+    if (fTPCIdList.find(chamber.GetId()) == fTPCIdList.end())
+      continue;
+    for (auto sectorIt = chamber.SectorsBegin(), sectorEnd = chamber.SectorsEnd();
+	 sectorIt != sectorEnd; ++sectorIt) {
+      const det::TPCSector& sector = *sectorIt;
+      const unsigned int sectorId = (unsigned int)sector.GetId();
+      const double sectorADC = sectorAccumulators.GetAverage(tpcId,sectorId);
+      for (auto padrowIt = sector.PadrowsBegin(), padrowEnd = sector.PadrowsEnd();
+	   padrowIt != padrowEnd; ++padrowIt) {
+	const det::TPCPadrow& padrow = *padrowIt;
+	const unsigned int padrowId = padrow.GetId();
+	for (unsigned int padId = 1; padId <= padrow.GetNPads(); ++padId) {
+	  //Unfitted pads have spectrum ADC 0 and infinite gain, i.e. -1.
+	  double padADC = 0;
+	  const auto tpcIt = spectrumADCs.find(tpcId);
+	  if (tpcIt != spectrumADCs.end() && tpcIt->second.count(sectorId) &&
+	      tpcIt->second.at(sectorId).count(padrowId) &&
+	      tpcIt->second.at(sectorId).at(padrowId).count(padId))
+	    padADC = tpcIt->second.at(sectorId).at(padrowId).at(padId);
+	  const double previousGain = GetPadGain(previousGains,tpcId,sectorId,padrowId,padId);
+	  const double gain = previousGain*sectorADC/padADC;
+	  gains[tpcId][sectorId][padrowId][padId] = (gain > fMinAcceptableGain &&
+						     gain < fMaxAcceptableGain) ? gain : -1.0;
+	}
+      }
+    }
+  }
+  return gains;
+}
+
+void AnalyzeCutSets(const det::TPC& tpc,
+		    const vector<CutSetBank>& cutSetBanks,
+		    const DetectorHistograms& mainSpectra,
+		    const DetectorGains& mainGains,
+		    const bool updateGains,
+		    const string& outputBase)
+{
+  //Clusters passing the cuts, i.e. entries summed over all pad spectra.
+  auto countEntries = [](const DetectorHistograms& histograms) {
+    double entries = 0;
+    for (auto tpcIt = histograms.begin(), tpcEnd = histograms.end(); tpcIt != tpcEnd; ++tpcIt)
+      for (auto sectorIt = tpcIt->second.begin(), sectorEnd = tpcIt->second.end();
+	   sectorIt != sectorEnd; ++sectorIt)
+	for (auto padrowIt = sectorIt->second.begin(), padrowEnd = sectorIt->second.end();
+	     padrowIt != padrowEnd; ++padrowIt)
+	  for (auto padIt = padrowIt->second.begin(), padEnd = padrowIt->second.end();
+	       padIt != padEnd; ++padIt)
+	    entries += padIt->second->GetEntries();
+    return entries;
+  };
+  auto countAccepted = [](const DetectorGains& gains) {
+    unsigned int accepted = 0;
+    for (auto tpcIt = gains.begin(), tpcEnd = gains.end(); tpcIt != tpcEnd; ++tpcIt)
+      for (auto sectorIt = tpcIt->second.begin(), sectorEnd = tpcIt->second.end();
+	   sectorIt != sectorEnd; ++sectorIt)
+	for (auto padrowIt = sectorIt->second.begin(), padrowEnd = sectorIt->second.end();
+	     padrowIt != padrowEnd; ++padrowIt)
+	  for (auto padIt = padrowIt->second.begin(), padEnd = padrowIt->second.end();
+	       padIt != padEnd; ++padIt)
+	    if (padIt->second > 0)
+	      ++accepted;
+    return accepted;
+  };
+
+  const double mainEntries = countEntries(mainSpectra);
+  ostringstream json;
+  json << "[{\"name\": \"main\", \"clusters\": " << mainEntries
+       << ", \"acceptedPads\": " << countAccepted(mainGains) << "}";
+  cout << "[INFO] Cut set comparison (clusters, relative to main cuts, accepted pads, "
+       << "mean and RMS of gain/main gain - 1):" << endl;
+  cout << "[INFO]   main: " << mainEntries << ", 1, " << countAccepted(mainGains) << endl;
+
+  for (auto it = cutSetBanks.begin(), itEnd = cutSetBanks.end(); it != itEnd; ++it) {
+    DetectorADCs spectrumADCs;
+    DEDXTools::SectorAveragers sectorAccumulators;
+    FitDetectorSpectra(*it->fSpectra,spectrumADCs,sectorAccumulators,"cutSetFitting");
+
+    PhaseTimer::Scope gainWritingPhase(fPhaseTimer,"gainWriting",it->fName);
+    const DetectorGains gains =
+      ComputePadGains(tpc,spectrumADCs,sectorAccumulators,
+		      (updateGains) ? fPreviousGains : DetectorGains());
+    const string gainsFilename = outputBase + "-CutSet" + it->fName + "-KryptonPadGains.xml";
+    if (WritePadGainXML(gainsFilename,gains)) {
+      RecordOutputFile(gainsFilename);
+      cout << "[INFO] Pad gains of cut set " << it->fName << " written to file "
+	   << gainsFilename << endl;
+    }
+
+    //Compare pads accepted with both cut sets.
+    unsigned int nCompared = 0;
+    double differenceSum = 0;
+    double differenceSquareSum = 0;
+    for (auto tpcIt = gains.begin(), tpcEnd = gains.end(); tpcIt != tpcEnd; ++tpcIt)
+      for (auto sectorIt = tpcIt->second.begin(), sectorEnd = tpcIt->second.end();
+	   sectorIt != sectorEnd; ++sectorIt)
+	for (auto padrowIt = sectorIt->second.begin(), padrowEnd = sectorIt->second.end();
+	     padrowIt != padrowEnd; ++padrowIt)
+	  for (auto padIt = padrowIt->second.begin(), padEnd = padrowIt->second.end();
+	       padIt != padEnd; ++padIt) {
+	    const double mainGain = GetPadGain(mainGains,tpcIt->first,sectorIt->first,
+					       padrowIt->first,padIt->first);
+	    if (padIt->second <= 0 || mainGain <= 0)
+	      continue;
+	    const double difference = padIt->second/mainGain - 1;
+	    differenceSum += difference;
+	    differenceSquareSum += difference*difference;
+	    ++nCompared;
+	  }
+    const double meanDifference = (nCompared > 0) ? differenceSum/nCompared : 0;
+    const double rmsDifference = (nCompared > 0) ?
+      sqrt(max(0.,differenceSquareSum/nCompared - meanDifference*meanDifference)) : 0;
+    const double entries = countEntries(*it->fSpectra);
+    const unsigned int accepted = countAccepted(gains);
+    cout << "[INFO]   " << it->fName << ": " << entries
+	 << ", " << ((mainEntries > 0) ? entries/mainEntries : 0)
+	 << ", " << accepted << ", " << meanDifference << ", " << rmsDifference << endl;
+    json << ", {\"name\": \"" << it->fName << "\", \"clusters\": " << entries
+	 << ", \"acceptedPads\": " << accepted << ", \"comparedPads\": " << nCompared
+	 << ", \"meanGainDifference\": " << meanDifference
+	 << ", \"rmsGainDifference\": " << rmsDifference
+	 << ", \"cuts\": {\"minPads\": " << it->fCuts.fMinPads
+	 << ", \"maxPads\": " << it->fCuts.fMaxPads
+	 << ", \"minTimeSliceNumber\": " << it->fCuts.fMinTimeSliceNumber
+	 << ", \"minTimeSlices\": " << it->fCuts.fMinTimeSlices
+	 << ", \"maxTimeSlices\": " << it->fCuts.fMaxTimeSlices
+	 << ", \"maxADCCut\": " << it->fCuts.fMaxADCCut
+	 << ", \"chargeCut\": " << it->fCuts.fChargeCut << "}}";
+  }
+  json << "]";
+  fPhaseTimer.AddReportSection("cutSets",json.str());
+}
+
+unsigned int GetTimeBin(const unsigned int fileIndex,
+			const unsigned int nFiles,
+			const unsigned int nTimeBins)
+{
+  return (unsigned long long)fileIndex*nTimeBins/nFiles;
+}
+
+void WriteSectorSpectra(const det::TPC& tpc,
+			const DetectorHistograms& spectraHistograms,
+			TFile& outputFile)
+{
+  //Index of the pads in the sector histograms.
+  TTree* indexTree = new TTree("fPadSpectraIndex","Pad Index of the Sector Pad Spectra");
+  unsigned int fTPCId;
+  indexTree->Branch("fTPCId",&fTPCId);
+  unsigned int fSectorId;
+  indexTree->Branch("fSectorId",&fSectorId);
+  unsigned int fPadrowId;
+  indexTree->Branch("fPadrowId",&fPadrowId);
+  unsigned int fPadId;
+  indexTree->Branch("fPadId",&fPadId);
+  unsigned int fPadIndex;
+  indexTree->Branch("fPadIndex",&fPadIndex);
+  double fEntries;
+  indexTree->Branch("fEntries",&fEntries);
+
+  outputFile.cd();
+  for (auto chamberIt = tpc.ChambersBegin(), chamberEnd = tpc.ChambersEnd();
+       chamberIt != chamberEnd; ++chamberIt) {
+    const det::TPCChamber& chamber = *chamberIt;
+    fTPCId = (unsigned int)chamber.GetId();
+    const auto tpcIt = spectraHistograms.find(fTPCId);
+    if (tpcIt == spectraHistograms.end())
+      continue;
+    const string tpcName = det::TPCConst::GetName(chamber.GetId());
+    for (auto sectorIt = chamber.SectorsBegin(), sectorEnd = chamber.SectorsEnd();
+	 sectorIt != sectorEnd; ++sectorIt) {
+      const det::TPCSector& sector = *sectorIt;
+      fSectorId = (unsigned int)sector.GetId();
+      const auto sectorHistogramsIt = tpcIt->second.find(fSectorId);
+      if (sectorHistogramsIt == tpcIt->second.end())
+	continue;
+      const PadrowHistograms& sectorHistograms = sectorHistogramsIt->second;
+
+      //Pads of a sector share the charge binning.
+      unsigned int nSectorPads = 0;
+      const TH1D* firstSpectrum = nullptr;
+      for (auto padrowIt = sector.PadrowsBegin(), padrowEnd = sector.PadrowsEnd();
+	   padrowIt != padrowEnd; ++padrowIt) {
+	const det::TPCPadrow& padrow = *padrowIt;
+	nSectorPads += padrow.GetNPads();
+	const auto padrowHistogramsIt = sectorHistograms.find(padrow.GetId());
+	if (firstSpectrum == nullptr && padrowHistogramsIt != sectorHistograms.end() &&
+	    !padrowHistogramsIt->second.empty())
+	  firstSpectrum = padrowHistogramsIt->second.begin()->second.get();
+      }
+      if (firstSpectrum == nullptr)
+	continue;
+      const TAxis& chargeAxis = *firstSpectrum->GetXaxis();
+      const int nChargeBins = chargeAxis.GetNbins();
+      TH2D sectorSpectra(Form("%sSector%iPadSpectra",tpcName.data(),fSectorId),
+			 Form("%s Sector %i Krypton decay cluster charges;Pad Index;"
+			      "Cluster Charge [ADC];Entries",tpcName.data(),fSectorId),
+			 nSectorPads,0,nSectorPads,
+			 nChargeBins,chargeAxis.GetXmin(),chargeAxis.GetXmax());
+
+      double sectorEntries = 0;
+      fPadIndex = 0;
+      for (auto padrowIt = sector.PadrowsBegin(), padrowEnd = sector.PadrowsEnd();
+	   padrowIt != padrowEnd; ++padrowIt) {
+	const det::TPCPadrow& padrow = *padrowIt;
+	fPadrowId = padrow.GetId();
+	const auto padrowHistogramsIt = sectorHistograms.find(fPadrowId);
+	for (fPadId = 1; fPadId <= padrow.GetNPads(); ++fPadId, ++fPadIndex) {
+	  fEntries = 0;
+	  if (padrowHistogramsIt != sectorHistograms.end()) {
+	    const auto padIt = padrowHistogramsIt->second.find(fPadId);
+	    if (padIt != padrowHistogramsIt->second.end()) {
+	      const TH1D& spectrum = *padIt->second;
+	      fEntries = spectrum.GetEntries();
+	      //Charge under- and overflow go to the y under- and overflow bins.
+	      if (fEntries > 0)
+		for (int bin = 0; bin <= nChargeBins + 1; ++bin)
+		  sectorSpectra.SetBinContent(fPadIndex + 1,bin,spectrum.GetBinContent(bin));
+	    }
+	  }
+	  sectorEntries += fEntries;
+	  indexTree->Fill();
+	}
+      }
+      sectorSpectra.SetEntries(sectorEntries);
+      sectorSpectra.Write();
+    } // Sector loop.
+  } // TPC loop.
+  indexTree->Write();
+}
+
+bool WriteSpectraShards(const DetectorHistograms& spectraHistograms,
+			const DetectorQAHistograms& sectorQAHistograms,
+			const bool writePadSpectra,
+			const string& outputBase,
+			const unsigned int nShards,
+			const int compression)
+{
+  //Objects of each sector, in sector order so the shards are reproducible.
+  set<pair<unsigned int,unsigned int> > sectorIds;
+  for (auto tpcIt = sectorQAHistograms.begin(), tpcEnd = sectorQAHistograms.end();
+       tpcIt != tpcEnd; ++tpcIt)
+    for (auto sectorIt = tpcIt->second.begin(), sectorEnd = tpcIt->second.end();
+	 sectorIt != sectorEnd; ++sectorIt)
+      sectorIds.insert(make_pair((unsigned int)tpcIt->first,(unsigned int)sectorIt->first));
+  if (writePadSpectra)
+    for (auto tpcIt = spectraHistograms.begin(), tpcEnd = spectraHistograms.end();
+	 tpcIt != tpcEnd; ++tpcIt)
+      for (auto sectorIt = tpcIt->second.begin(), sectorEnd = tpcIt->second.end();
+	   sectorIt != sectorEnd; ++sectorIt)
+	sectorIds.insert(make_pair(tpcIt->first,sectorIt->first));
+
+  vector<OutputObjects> sectorObjects;
+  vector<unsigned long long> sectorWeights;
+  for (auto it = sectorIds.begin(), itEnd = sectorIds.end(); it != itEnd; ++it) {
+    OutputObjects objects;
+    const auto qaTPCIt = sectorQAHistograms.find(it->first);
+    if (qaTPCIt != sectorQAHistograms.end()) {
+      const auto qaIt = qaTPCIt->second.find(it->second);
+      if (qaIt != qaTPCIt->second.end()) {
+	const SectorQAHistograms& qa = qaIt->second;
+	const TObject* qaObjects[10] = {
+	  qa.fSpectra.first.get(), qa.fSpectra.second.get(), qa.fPadEntries.first.get(),
+	  qa.fPadEntries.second.get(), qa.fTimeSlices.first.get(), qa.fTimeSlices.second.get(),
+	  qa.fChargeVsMaxADC.first.get(), qa.fChargeVsMaxADC.second.get(),
+	  qa.fNPadsVsNTimeSlices.first.get(), qa.fNPadsVsNTimeSlices.second.get()
+	};
+	for (unsigned int i = 0; i < 10; ++i)
+	  objects.push_back(make_pair(qaObjects[i],string()));
+      }
+    }
+    const auto tpcIt = spectraHistograms.find(it->first);
+    if (writePadSpectra && tpcIt != spectraHistograms.end()) {
+      const auto sectorIt = tpcIt->second.find(it->second);
+      if (sectorIt != tpcIt->second.end())
+	for (auto padrowIt = sectorIt->second.begin(), padrowEnd = sectorIt->second.end();
+	     padrowIt != padrowEnd; ++padrowIt)
+	  for (auto padIt = padrowIt->second.begin(), padEnd = padrowIt->second.end();
+	       padIt != padEnd; ++padIt)
+	    if (padIt->second->GetEntries() > 0)
+	      objects.push_back(make_pair((const TObject*)padIt->second.get(),string()));
+    }
+    sectorWeights.push_back(objects.size());
+    sectorObjects.push_back(objects);
+  }
+
+  const unsigned int nUsedShards = max(1u,min(nShards,(unsigned int)sectorObjects.size()));
+  const vector<unsigned int> sectorShards = BalanceShards(sectorWeights,nUsedShards);
+  vector<OutputObjects> shardObjects(nUsedShards);
+  unsigned long long nObjects = 0;
+  for (unsigned int i = 0; i < sectorObjects.size(); ++i) {
+    OutputObjects& shard = shardObjects[sectorShards[i]];
+    shard.insert(shard.end(),sectorObjects[i].begin(),sectorObjects[i].end());
+    nObjects += sectorObjects[i].size();
+  }
+
+  const Long64_t shardBytes = WriteOutputShards(outputBase,shardObjects,compression);
+  if (shardBytes < 0) {
+    cout << "[ERROR] Could not write the output shards " << GetOutputShardFilename(outputBase,0)
+	 << " ..." << endl;
+    return false;
+  }
+  for (unsigned int shard = 0; shard < nUsedShards; ++shard)
+    RecordOutputFile(GetOutputShardFilename(outputBase,shard));
+  cout << "[INFO] Wrote " << nObjects << " pad spectra and sector QA histograms to "
+       << nUsedShards << " shard files (" << shardBytes/1e6 << " MB): "
+       << GetOutputShardFilename(outputBase,0) << " ..." << endl;
+  return true;
+}
+
+void WriteChannelStatus(const det::TPC& tpc,
+			const DetectorChannels& channelStatistics,
+			const string& outputBase)
+{
+  PhaseTimer::Scope statusPhase(fPhaseTimer,"channelStatus");
+  const string statusFilename = outputBase + "-ChannelStatus.txt";
+  ofstream statusFile(statusFilename);
+  RecordOutputFile(statusFilename);
+  statusFile << "# TPC Sector Padrow Pad Status Clusters PassedFraction LowChargeFraction" << endl;
+  const char* statusNames[] = {"good", "dead", "hot", "noisy", "excluded"};
+
+  cout << "[INFO] Channel status (dead, hot, noisy, excluded pads):" << endl;
+  for (auto chamberIt = tpc.ChambersBegin(), chamberEnd = tpc.ChambersEnd();
+       chamberIt != chamberEnd; ++chamberIt) {
+    const det::TPCChamber& chamber = *chamberIt;
+    const unsigned int tpcId = (unsigned int)chamber.GetId();
+    if (fTPCIdList.find(chamber.GetId()) == fTPCIdList.end())
+      continue;
+    for (auto sectorIt = chamber.SectorsBegin(), sectorEnd = chamber.SectorsEnd();
+	 sectorIt != sectorEnd; ++sectorIt) {
+      const det::TPCSector& sector = *sectorIt;
+      const unsigned int sectorId = (unsigned int)sector.GetId();
+      const auto tpcChannelsIt = channelStatistics.find(tpcId);
+      if (tpcChannelsIt == channelStatistics.end() ||
+	  tpcChannelsIt->second.find(sectorId) == tpcChannelsIt->second.end())
+	continue;
+      const PadrowChannels& sectorChannels = tpcChannelsIt->second.at(sectorId);
+
+      //Sector medians of the cluster count and of the passed fraction.
+      const double medianClusters = GetMedianPadClusters(sectorChannels);
+      vector<double> passedFractions;
+      for (auto padrowIt = sectorChannels.begin(), padrowEnd = sectorChannels.end();
+	   padrowIt != padrowEnd; ++padrowIt)
+	for (auto padIt = padrowIt->second.begin(), padEnd = padrowIt->second.end();
+	     padIt != padEnd; ++padIt)
+	  if (padIt->second.fClusters > 0)
+	    passedFractions.push_back((double)padIt->second.fPassed/padIt->second.fClusters);
+      double medianPassedFraction = 0;
+      if (!passedFractions.empty()) {
+	nth_element(passedFractions.begin(),passedFractions.begin() + passedFractions.size()/2,
+		    passedFractions.end());
+	medianPassedFraction = passedFractions[passedFractions.size()/2];
+      }
+
+      unsigned int nStatus[eNChannelStatus] = {0, 0, 0, 0, 0};
+      for (auto padrowIt = sector.PadrowsBegin(), padrowEnd = sector.PadrowsEnd();
+	   padrowIt != padrowEnd; ++padrowIt) {
+	const det::TPCPadrow& padrow = *padrowIt;
+	const unsigned int padrowId = padrow.GetId();
+	for (unsigned int padId = 1; padId <= padrow.GetNPads(); ++padId) {
+	  PadChannelStatistics statistics;
+	  const auto padrowChannelsIt = sectorChannels.find(padrowId);
+	  if (padrowChannelsIt != sectorChannels.end()) {
+	    const auto padChannelsIt = padrowChannelsIt->second.find(padId);
+	    if (padChannelsIt != padrowChannelsIt->second.end())
+	      statistics = padChannelsIt->second;
+	  }
+	  const double passedFraction = (statistics.fClusters > 0) ?
+	    (double)statistics.fPassed/statistics.fClusters : 0;
+	  const double lowChargeFraction = (statistics.fPassed > 0) ?
+	    (double)statistics.fLowCharge/statistics.fPassed : 0;
+
+	  EChannelStatus status = eGoodChannel;
+	  if (statistics.fExcluded)
+	    status = eExcludedChannel;
+	  else if (statistics.fClusters < kDeadPadFraction*medianClusters)
+	    status = eDeadChannel;
+	  else if (statistics.fClusters > kHotPadFactor*medianClusters &&
+		   statistics.fClusters >= kMinHotPadClusters)
+	    status = eHotChannel;
+	  else if (passedFraction < kNoisyPassedFraction*medianPassedFraction ||
+		   lowChargeFraction > kNoisyLowChargeFraction)
+	    status = eNoisyChannel;
+	  ++nStatus[status];
+	  if (status == eGoodChannel)
+	    continue;
+	  statusFile << tpcId << " " << sectorId << " " << padrowId << " " << padId << " "
+		     << statusNames[status] << " " << statistics.fClusters << " "
+		     << passedFraction << " " << lowChargeFraction << endl;
+	} // Pad loop.
+      } // Padrow loop.
+      cout << "[INFO]   " << det::TPCConst::GetName(chamber.GetId()) << " sector " << sectorId
+	   << ": " << nStatus[eDeadChannel] << ", " << nStatus[eHotChannel] << ", "
+	   << nStatus[eNoisyChannel] << ", " << nStatus[eExcludedChannel]
+	   << " (median clusters per pad " << medianClusters << ")" << endl;
+    } // Sector loop.
+  } // TPC loop.
+  statusFile.close();
+  cout << "[INFO] Channel status map written to file " << statusFilename << endl;
+}
+
+void ResetExcludedPads(DetectorHistograms& spectraHistograms,
+		       const DetectorChannels& channelStatistics)
+{
+  for (auto tpcIt = channelStatistics.begin(), tpcEnd = channelStatistics.end();
+       tpcIt != tpcEnd; ++tpcIt)
+    for (auto sectorIt = tpcIt->second.begin(), sectorEnd = tpcIt->second.end();
+	 sectorIt != sectorEnd; ++sectorIt)
+      for (auto padrowIt = sectorIt->second.begin(), padrowEnd = sectorIt->second.end();
+	   padrowIt != padrowEnd; ++padrowIt)
+	for (auto padIt = padrowIt->second.begin(), padEnd = padrowIt->second.end();
+	     padIt != padEnd; ++padIt) {
+	  if (!padIt->second.fExcluded)
+	    continue;
+	  const auto histogramTPCIt = spectraHistograms.find(tpcIt->first);
+	  if (histogramTPCIt == spectraHistograms.end())
+	    continue;
+	  const auto histogramSectorIt = histogramTPCIt->second.find(sectorIt->first);
+	  if (histogramSectorIt == histogramTPCIt->second.end())
+	    continue;
+	  const auto histogramPadrowIt = histogramSectorIt->second.find(padrowIt->first);
+	  if (histogramPadrowIt == histogramSectorIt->second.end())
+	    continue;
+	  const auto histogramIt = histogramPadrowIt->second.find(padIt->first);
+	  if (histogramIt != histogramPadrowIt->second.end())
+	    histogramIt->second->Reset();
+	}
+}
+
+void AnalyzeDriftProfiles(const DetectorDriftProfiles& driftProfiles, TFile& outputFile)
+{
+  PhaseTimer::Scope driftPhase(fPhaseTimer,"driftFitting");
+
+  //TTree for storing drift fits. Padrow 0 holds the fit of the whole sector.
+  TTree* driftTree = new TTree("fDriftTree","Krypton Charge vs. Drift Time Fits");
+  unsigned int fTPCId;
+  driftTree->Branch("fTPCId",&fTPCId);
+  unsigned int fSectorId;
+  driftTree->Branch("fSectorId",&fSectorId);
+  unsigned int fPadrowId;
+  driftTree->Branch("fPadrowId",&fPadrowId);
+  double fConstant;
+  driftTree->Branch("fConstant",&fConstant);
+  double fSlope;
+  driftTree->Branch("fSlope",&fSlope);
+  double fSlopeError;
+  driftTree->Branch("fSlopeError",&fSlopeError);
+  double fChi2;
+  driftTree->Branch("fChi2",&fChi2);
+  int fNdf;
+  driftTree->Branch("fNdf",&fNdf);
+
+  //Mean charge per time slice bin, fitted with exp(constant + slope*timeSlice).
+  //Bins with few clusters are left empty.
+  const double minBinEntries = 10;
+  auto fitProfile = [&](const DriftProfile& profile, const TString& name, const TString& title) {
+    const unsigned int nBins = profile.fEntries.size();
+    TH1D meanCharges(name,title + ";Time Slice;Mean Cluster Charge [ADC]",
+		     nBins,0,kMaxDriftTimeSlice);
+    unsigned int nFilledBins = 0;
+    for (unsigned int i = 0; i < nBins; ++i) {
+      const double entries = profile.fEntries[i];
+      if (entries < minBinEntries)
+	continue;
+      const double mean = profile.fChargeSums[i]/entries;
+      const double variance = max(0.,profile.fChargeSquareSums[i]/entries - mean*mean);
+      meanCharges.SetBinContent(i + 1,mean);
+      meanCharges.SetBinError(i + 1,sqrt(variance/entries));
+      ++nFilledBins;
+    }
+    fConstant = 0;
+    fSlope = 0;
+    fSlopeError = 0;
+    fChi2 = 0;
+    fNdf = 0;
+    if (nFilledBins >= 3) {
+      TF1 expoFit("expoFit","expo",0,kMaxDriftTimeSlice);
+      if (meanCharges.Fit(&expoFit,"Q") == 0) {
+	fConstant = expoFit.GetParameter(0);
+	fSlope = expoFit.GetParameter(1);
+	fSlopeError = expoFit.GetParError(1);
+	fChi2 = expoFit.GetChisquare();
+	fNdf = expoFit.GetNDF();
+      }
+    }
+    meanCharges.Write();
+    driftTree->Fill();
+  };
+
+  outputFile.cd();
+  cout << "[INFO] Charge attenuation over drift time "
+       << "(relative change per 100 time slices, from exponential fits):" << endl;
+  map<pair<unsigned int,unsigned int>, const PadrowDriftProfiles*> sortedSectors;
+  for (auto tpcIt = driftProfiles.begin(), tpcEnd = driftProfiles.end(); tpcIt != tpcEnd; ++tpcIt)
+    for (auto sectorIt = tpcIt->second.begin(), sectorEnd = tpcIt->second.end();
+	 sectorIt != sectorEnd; ++sectorIt)
+      sortedSectors[make_pair(tpcIt->first,sectorIt->first)] = &sectorIt->second;
+  for (auto it = sortedSectors.begin(), itEnd = sortedSectors.end(); it != itEnd; ++it) {
+    fTPCId = it->first.first;
+    fSectorId = it->first.second;
+    const string tpcName = det::TPCConst::GetName((det::TPCConst::EId)fTPCId);
+    map<unsigned int, const DriftProfile*> sortedPadrows;
+    DriftProfile sectorProfile;
+    for (auto padrowIt = it->second->begin(), padrowEnd = it->second->end();
+	 padrowIt != padrowEnd; ++padrowIt) {
+      sortedPadrows[padrowIt->first] = &padrowIt->second;
+      sectorProfile.Add(padrowIt->second);
+    }
+    unsigned int nFittedPadrows = 0;
+    double padrowSlopeSum = 0;
+    for (auto padrowIt = sortedPadrows.begin(), padrowEnd = sortedPadrows.end();
+	 padrowIt != padrowEnd; ++padrowIt) {
+      fPadrowId = padrowIt->first;
+      fitProfile(*padrowIt->second,
+		 Form("%sSector%iPadrow%iDrift",tpcName.data(),fSectorId,fPadrowId),
+		 Form("%s Sector %i Padrow %i",tpcName.data(),fSectorId,fPadrowId));
+      if (fNdf > 0) {
+	padrowSlopeSum += fSlope;
+	++nFittedPadrows;
+      }
+    }
+    fPadrowId = 0;
+    fitProfile(sectorProfile,Form("%sSector%iDrift",tpcName.data(),fSectorId),
+	       Form("%s Sector %i",tpcName.data(),fSectorId));
+    cout << "[INFO]   " << tpcName << " sector " << fSectorId << ": "
+	 << 100*(exp(100*fSlope) - 1) << " +- " << 100*100*fSlopeError*exp(100*fSlope)
+	 << " %. Padrow mean: "
+	 << ((nFittedPadrows > 0) ? 100*(exp(100*padrowSlopeSum/nFittedPadrows) - 1) : 0)
+	 << " % (" << nFittedPadrows << " padrows)." << endl;
+  }
+  driftTree->Write();
+  delete driftTree;
+}
+
+void AnalyzeTimeBins(const det::TPC& tpc,
+		     const vector<DetectorHistograms>& timeBinSpectra,
+		     const vector<string>& filenames,
+		     const bool updateGains,
+		     const string& outputBase,
+		     TFile& outputFile)
+{
+  const unsigned int nTimeBins = timeBinSpectra.size();
+
+  //TTree for storing results per time bin.
+  TTree* timeBinTree = new TTree("fTimeBinTree","Krypton Analysis Results per Time Bin");
+  unsigned int fTimeBin;
+  timeBinTree->Branch("fTimeBin",&fTimeBin);
+  unsigned int fTPCId;
+  timeBinTree->Branch("fTPCId",&fTPCId);
+  unsigned int fSectorId;
+  timeBinTree->Branch("fSectorId",&fSectorId);
+  unsigned int fPadrowId;
+  timeBinTree->Branch("fPadrowId",&fPadrowId);
+  unsigned int fPadId;
+  timeBinTree->Branch("fPadId",&fPadId);
+  double fSpectrumADC;
+  timeBinTree->Branch("fSpectrumADC",&fSpectrumADC);
+  double fSectorADC;
+  timeBinTree->Branch("fSectorADC",&fSectorADC);
+  double fGain;
+  timeBinTree->Branch("fGain",&fGain);
+
+  //Accepted gains of each pad over the time bins, and sector ADC per bin.
+  unordered_map<unsigned int,
+		unordered_map<unsigned int,
+			      unordered_map<unsigned int,
+					    unordered_map<unsigned int,
+							  vector<double> > > > > padGainHistory;
+  map<pair<unsigned int,unsigned int>, vector<double> > sectorADCHistory;
+
+  for (unsigned int bin = 0; bin < nTimeBins; ++bin) {
+    unsigned int firstFile = filenames.size();
+    unsigned int lastFile = 0;
+    for (unsigned int i = 0; i < filenames.size(); ++i) {
+      if (GetTimeBin(i,filenames.size(),nTimeBins) != bin)
+	continue;
+      firstFile = min(firstFile,i);
+      lastFile = max(lastFile,i);
+    }
+    cout << "[INFO] Time bin " << bin << ": files " << firstFile + 1 << " - " << lastFile + 1
+	 << " (" << filenames[firstFile] << " - " << filenames[lastFile] << ")" << endl;
+
+    DetectorADCs spectrumADCs;
+    DEDXTools::SectorAveragers sectorAccumulators;
+    FitDetectorSpectra(timeBinSpectra[bin],spectrumADCs,sectorAccumulators,"timeBinFitting");
+
+    PhaseTimer::Scope gainWritingPhase(fPhaseTimer,"gainWriting",Form("TimeBin%u",bin));
+    DetectorGains binGains;
+    for (auto chamberIt = tpc.ChambersBegin(), chamberEnd = tpc.ChambersEnd();
+	 chamberIt != chamberEnd; ++chamberIt) {
+      const det::TPCChamber& chamber = *chamberIt;
+      const unsigned int tpcId = (unsigned int)chamber.GetId();
+      if (fTPCIdList.find(chamber.GetId()) == fTPCIdList.end())
+	continue;
+      for (auto sectorIt = chamber.SectorsBegin(), sectorEnd = chamber.SectorsEnd();
+	   sectorIt != sectorEnd; ++sectorIt) {
+	const det::TPCSector& sector = *sectorIt;
+	const unsigned int sectorId = (unsigned int)sector.GetId();
+	const double sectorADC = sectorAccumulators.GetAverage(tpcId,sectorId);
+	sectorADCHistory[make_pair(tpcId,sectorId)].push_back(sectorADC);
+	for (auto padrowIt = sector.PadrowsBegin(), padrowEnd = sector.PadrowsEnd();
+	     padrowIt != padrowEnd; ++padrowIt) {
+	  const det::TPCPadrow& padrow = *padrowIt;
+	  const unsigned int padrowId = padrow.GetId();
+	  for (unsigned int padId = 1; padId <= padrow.GetNPads(); ++padId) {
+	    const double padADC = spectrumADCs[tpcId][sectorId][padrowId][padId];
+	    const double previousGain = (updateGains) ?
+	      GetPadGain(fPreviousGains,tpcId,sectorId,padrowId,padId) : 1.;
+	    const double gain = previousGain*sectorADC/padADC;
+
+	    fTimeBin = bin;
+	    fTPCId = tpcId;
+	    fSectorId = sectorId;
+	    fPadrowId = padrowId;
+	    fPadId = padId;
+	    fSpectrumADC = padADC;
+	    fSectorADC = sectorADC;
+	    fGain = (isnan(gain) || isinf(gain)) ? 0 : gain;
+	    timeBinTree->Fill();
+
+	    const double writtenGain = (gain > fMinAcceptableGain &&
+					gain < fMaxAcceptableGain) ? gain : -1.0;
+	    binGains[tpcId][sectorId][padrowId][padId] = writtenGain;
+	    if (writtenGain > 0)
+	      padGainHistory[tpcId][sectorId][padrowId][padId].push_back(writtenGain);
+	  } // Pad loop.
+	} // Padrow loop.
+      } // Sector loop.
+    } // TPC loop.
+
+    const string binGainsFilename = outputBase + Form("-TimeBin%u-KryptonPadGains.xml",bin);
+    if (WritePadGainXML(binGainsFilename,binGains)) {
+      RecordOutputFile(binGainsFilename);
+      cout << "[INFO] Pad gains of time bin " << bin << " written to file "
+	   << binGainsFilename << endl;
+    }
+  } // Time bin loop.
+
+  PhaseTimer::Scope outputPhase(fPhaseTimer,"outputWrite");
+  outputFile.cd();
+  timeBinTree->Write();
+  outputPhase.Stop();
+
+  //Stability summary. Sector ADC drift is the spread of the sector average
+  //over the bins; pad stability is the relative RMS of each pad's gains.
+  cout << "[INFO] Gain stability over " << nTimeBins << " time bins "
+       << "(sector ADC drift (max-min)/mean, mean and max pad gain relative RMS, pads):" << endl;
+  for (auto it = sectorADCHistory.begin(), itEnd = sectorADCHistory.end(); it != itEnd; ++it) {
+    const unsigned int tpcId = it->first.first;
+    const unsigned int sectorId = it->first.second;
+    const vector<double>& sectorADCs = it->second;
+    double sectorADCSum = 0;
+    double minSectorADC = sectorADCs.front();
+    double maxSectorADC = sectorADCs.front();
+    for (auto adcIt = sectorADCs.begin(), adcEnd = sectorADCs.end(); adcIt != adcEnd; ++adcIt) {
+      sectorADCSum += *adcIt;
+      minSectorADC = min(minSectorADC,*adcIt);
+      maxSectorADC = max(maxSectorADC,*adcIt);
+    }
+    const double sectorADCDrift = (sectorADCSum > 0) ?
+      (maxSectorADC - minSectorADC)/(sectorADCSum/sectorADCs.size()) : 0;
+
+    unsigned int nPads = 0;
+    double relativeRMSSum = 0;
+    double maxRelativeRMS = 0;
+    const auto& padrowHistory = padGainHistory[tpcId][sectorId];
+    for (auto padrowIt = padrowHistory.begin(), padrowEnd = padrowHistory.end();
+	 padrowIt != padrowEnd; ++padrowIt) {
+      for (auto padIt = padrowIt->second.begin(), padEnd = padrowIt->second.end();
+	   padIt != padEnd; ++padIt) {
+	const vector<double>& gains = padIt->second;
+	if (gains.size() < 2)
+	  continue;
+	double sum = 0;
+	double squareSum = 0;
+	for (auto gainIt = gains.begin(), gainEnd = gains.end(); gainIt != gainEnd; ++gainIt) {
+	  sum += *gainIt;
+	  squareSum += (*gainIt)*(*gainIt);
+	}
+	const double mean = sum/gains.size();
+	const double relativeRMS = sqrt(max(0.,squareSum/gains.size() - mean*mean))/mean;
+	relativeRMSSum += relativeRMS;
+	maxRelativeRMS = max(maxRelativeRMS,relativeRMS);
+	++nPads;
+      }
+    }
+    cout << "[INFO]   " << det::TPCConst::GetName((det::TPCConst::EId)tpcId)
+	 << " Sector " << sectorId << ": " << sectorADCDrift
+	 << ", " << ((nPads > 0) ? relativeRMSSum/nPads : 0)
+	 << ", " << maxRelativeRMS << ", " << nPads << endl;
+  }
+}
+
+MemoryReport EstimateBookingMemory(const det::TPC& tpc)
+{
+  MemoryReport estimate;
+  for (auto chamberIt = tpc.ChambersBegin(), chamberEnd = tpc.ChambersEnd();
+       chamberIt != chamberEnd; ++chamberIt) {
+    const det::TPCChamber& chamber = *chamberIt;
+    const unsigned int tpcId = (unsigned int)chamber.GetId();
+    if (fTPCIdList.find(chamber.GetId()) == fTPCIdList.end())
+      continue;
+    for (auto sectorIt = chamber.SectorsBegin(), sectorEnd = chamber.SectorsEnd();
+         sectorIt != sectorEnd; ++sectorIt) {
+      const det::TPCSector& sector = *sectorIt;
+      const unsigned int sectorId = sector.GetId();
+      unsigned int nSectorPads = 0;
+      for (auto padrowIt = sector.PadrowsBegin(), padrowEnd = sector.PadrowsEnd();
+           padrowIt != padrowEnd; ++padrowIt)
+        nSectorPads += padrowIt->GetNPads();
+      estimate.Add("padSpectra",nSectorPads*EstimateTH1DBytes(fHistogramBins),nSectorPads);
+
+      //Sector QA histograms, booked in pairs (no cuts, all cuts) as in main().
+      const double minADCPeakSearch =
+	(tpcId == det::TPCConst::eVTPC1 && (sectorId == 1 || sectorId == 4)) ?
+	fMinADCPeakSearchVTPC1Upstream : fMinADCPeakSearch;
+      const double histogramMax = minADCPeakSearch*fHistogramPadding;
+      const unsigned int nPadrows = sector.GetNPadrows();
+      const unsigned int nPads = sector.GetPadrow(sector.GetNPadrows()).GetNPads();
+      estimate.Add("sectorSpectra",2*EstimateTH1DBytes(2*fHistogramBins),2);
+      estimate.Add("sectorPadEntries",2*EstimateTH2DBytes(nPads+2,nPadrows+2),2);
+      estimate.Add("sectorTimeSlices",2*EstimateTH1DBytes(260),2);
+      estimate.Add("sectorChargeVsMaxADC",2*EstimateTH2DBytes(histogramMax*2,512),2);
+      estimate.Add("sectorNPadsVsNTimeSlices",
+		   2*EstimateTH2DBytes(fMaxPads*5,fMaxTimeSlices*5),2);
+    }
+  }
+  return estimate;
+}
+
+void SaveQAPage(const TCanvas& canvas, const TString& pdfName)
+{
+  TraceRecorder::Span span(fTraceRecorder,"pageRender");
+  canvas.SaveAs(pdfName);
 }
 
 map<int,int> GetPadrowColorMap(const int maxPadrows) 
@@ -15,19 +15,27 @@
 #include <iostream>
 #include <unordered_map>
 #include <set>
+#include <vector>
 
+#include <det/TPC.h>
 #include <det/TPCConst.h>
+#include <modutils/DEDXTools.h>
 #include <modutils/PeakFinder.h>
 
+#include "TCanvas.h"
+#include "TFile.h"
 #include "TH1D.h"
+#include "TTree.h"
 
-//Typedefs and containers for holding histograms.
-typedef std::unordered_map<unsigned int, TH1D*> PadHistograms;
-typedef std::unordered_map<unsigned int, PadHistograms> PadrowHistograms;
-typedef std::unordered_map<unsigned int, PadrowHistograms> SectorHistograms;
-typedef std::unordered_map<unsigned int, SectorHistograms> DetectorHistograms;
-//The container itself.
-DetectorHistograms fSpectraHistograms;
+#include "KryptonDaemon.h"
+#include "KryptonInputIndex.h"
+#include "KryptonKernels.h"
+#include "KryptonMemory.h"
+#include "KryptonNuma.h"
+#include "KryptonOutput.h"
+#include "KryptonPadGains.h"
+#include "KryptonPhaseTimer.h"
+#include "KryptonValidation.h"
 
 //Typedefs and containers for peak finders.
 typedef std::unordered_map<unsigned int, modutils::PeakFinder> PadPeakFinders;
@@ -41,6 +49,50 @@ typedef std::unordered_map<unsigned int, double> SectorPeaks;
 typedef std::unordered_map<unsigned int, SectorPeaks> DetectorPeaks;
 DetectorPeaks fAverageSectorPeaks;
 
+//Typedefs and containers for fitted spectrum ADCs.
+typedef std::unordered_map<unsigned int, double> PadADCs;
+typedef std::unordered_map<unsigned int, PadADCs> PadrowADCs;
+typedef std::unordered_map<unsigned int, PadrowADCs> SectorADCs;
+typedef std::unordered_map<unsigned int, SectorADCs> DetectorADCs;
+
+//Typedefs and containers for the full pad fit results, for the columnar
+//result tree.
+typedef std::unordered_map<unsigned int, PadFitResult> PadFitResults;
+typedef std::unordered_map<unsigned int, PadFitResults> PadrowFitResults;
+typedef std::unordered_map<unsigned int, PadrowFitResults> SectorFitResults;
+typedef std::unordered_map<unsigned int, SectorFitResults> DetectorFitResults;
+
+//Previously-calculated pad gains, applied with -u / --updateGains.
+DetectorGains fPreviousGains;
+
+//Approximate heap size of one hash map entry, for memory reports.
+const unsigned int kHashNodeBytes = 64;
+
+//Channel status from running pad statistics. Dead and hot pads are
+//compared to the sector median of clusters per pad, noisy pads to the
+//sector median of the fraction passing the cuts. Low-charge clusters
+//are below the peak search threshold.
+enum EChannelStatus {
+  eGoodChannel = 0,
+  eDeadChannel,
+  eHotChannel,
+  eNoisyChannel,
+  eExcludedChannel,
+  eNChannelStatus
+};
+const double kDeadPadFraction = 0.1;
+const double kHotPadFactor = 10;
+const unsigned long long kMinHotPadClusters = 1000;
+const double kNoisyPassedFraction = 0.5;
+const double kNoisyLowChargeFraction = 0.5;
+
+//Timers for the analysis phases, and optional trace of all phase passes.
+PhaseTimer fPhaseTimer;
+TraceRecorder fTraceRecorder;
+
+//Files written by the analysis, reported to the client of a daemon job.
+std::vector<std::string> fOutputFiles;
+
 //Config parameters.
 std::set<det::TPCConst::EId> fTPCIdList;
 std::string fFitFunction;
@@ -58,21 +110,182 @@ double fMaxADCCut;
 double fChargeCut;
 double fMinADCPeakSearch;
 double fMinADCPeakSearchVTPC1Upstream;
+//Named alternative cut sets: cuts that differ from the main cuts.
+typedef std::vector<std::pair<std::string, double> > CutOverrides;
+std::vector<std::pair<std::string, CutOverrides> > fCutSets;
 
 
 /// Main function.
 int main(int argc, char* argv[]);
 
-/// Configuration file parsing function.
-void ParseConfigFile(const std::string& configFile);
+/// Add a written file to fOutputFiles, with its absolute path.
+void RecordOutputFile(const std::string& filename);
 
-/// Function for replaing default pad gain XML with user-defined XML.
-void ReplacePadGainPath(const std::string& bootstrap,
-                        const std::string& newPadGainXML);
+/// Numeric value of a command line argument. A value that is not a whole
+/// number is reported with the usage.
+int ParseIntArgument(const std::string& argument, const std::string& value);
+
+/// Floating point value of a command line argument. A value that is not a
+/// number is reported with the usage.
+double ParseDoubleArgument(const std::string& argument, const std::string& value);
+
+/// One analysis with the command line arguments. Returns the exit code.
+int RunAnalysis(const std::vector<std::string>& argumentsVector);
+
+/// Load the geometry once and run the jobs sent to the UNIX socket, each
+/// in a forked process, until a --shutdown job.
+int RunDaemon(const std::string& socketPath);
+
+/// Configuration file parsing function. Returns false for a malformed
+/// cut set block.
+bool ParseConfigFile(const std::string& configFile);
 
 /// Function for replaing default pad gain XML with user-defined XML.
 std::map<int,int> GetPadrowColorMap(const int maxPadrows);
 
+/// Whether the chamber of a TPC has a sector with the given id.
+bool HasSector(const det::TPC& tpc,
+               const det::TPCConst::EId tpcId,
+               const unsigned int sectorId);
+
+/// Validate the input files with nThreads threads. Bad files and the
+/// reasons are written to the quarantine list. Returns the good files.
+std::vector<std::string> ValidateInputFiles(const std::vector<std::string>& filenames,
+                                            const bool readBaskets,
+                                            const unsigned int nThreads,
+                                            const std::string& quarantineFilename);
+
+/// Read all sector trees of one input file and fill the given pad spectra
+/// and sector QA. Returns false if the file could not be read.
+/// Alternative cut sets fill their own pad spectra from the same blocks.
+/// Post-cut charges are also stored if clusterCharges is given. With
+/// remapGains the pad spectra are filled without the previous gains.
+/// Drift profiles with nDriftBins time slice bins are filled if given.
+/// Channel statistics are counted if given, and pads with more than
+/// hotPadFactor times the sector median are excluded from later files.
+/// With sharedSpectra the pad spectra are shared with other threads and
+/// filled with atomic bin increments. With padSort each block is sorted
+/// by pad before the fill. If onlyTree is given, only that tree is read.
+bool ProcessInputFile(const std::string& filename,
+                      const det::TPC& tpc,
+                      const ClusterCuts& cuts,
+                      const bool updateGains,
+                      const bool remapGains,
+                      ClusterBlock& block,
+                      DetectorHistograms& spectraHistograms,
+                      DetectorQAHistograms& sectorQAHistograms,
+                      const std::vector<CutSetBank>& cutSetBanks,
+                      DetectorCharges* clusterCharges = nullptr,
+                      DetectorDriftProfiles* driftProfiles = nullptr,
+                      const unsigned int nDriftBins = 0,
+                      DetectorChannels* channelStatistics = nullptr,
+                      const double hotPadFactor = 0,
+                      const bool sharedSpectra = false,
+                      const bool padSort = true,
+                      const std::string& onlyTree = "");
+
+/// Read the pad spectra (per pad or per sector) and sector QA written by a
+/// previous run, and its output shards, into the booked pad spectra, for
+/// --refit. Returns false if no spectra were found or their binning differs
+/// from the booked spectra.
+bool ReadStoredSpectra(const std::string& filename,
+                       const det::TPC& tpc,
+                       DetectorHistograms& spectraHistograms,
+                       DetectorQAHistograms& sectorQAHistograms);
+
+/// Find the peak of and fit every pad spectrum with enough entries. The
+/// spectrum ADCs of fitted pads are stored and added to the sector averages.
+/// The full fit result of every pad is stored if fitResults is given.
+void FitDetectorSpectra(const DetectorHistograms& spectraHistograms,
+                        DetectorADCs& spectrumADCs,
+                        modutils::DEDXTools::SectorAveragers& sectorAccumulators,
+                        const std::string& phaseName,
+                        DetectorFitResults* fitResults = nullptr);
+
+/// Write the pad spectra of each sector as one 2D histogram of pad index
+/// vs. charge, and fPadSpectraIndex with the pad index of every pad.
+void WriteSectorSpectra(const det::TPC& tpc,
+                        const DetectorHistograms& spectraHistograms,
+                        TFile& outputFile);
+
+/// Write the sector QA, and the filled pad spectra if writePadSpectra, to
+/// nShards shard files next to the output, in parallel. Whole sectors are
+/// balanced over the shards by their number of objects. Returns false if a
+/// shard could not be written.
+bool WriteSpectraShards(const DetectorHistograms& spectraHistograms,
+                        const DetectorQAHistograms& sectorQAHistograms,
+                        const bool writePadSpectra,
+                        const std::string& outputBase,
+                        const unsigned int nShards,
+                        const int compression);
+
+/// Classify every pad from its running statistics and write the pads that
+/// are not good to the channel status map.
+void WriteChannelStatus(const det::TPC& tpc,
+                        const DetectorChannels& channelStatistics,
+                        const std::string& outputBase);
+
+/// Empty the pad spectra of excluded pads.
+void ResetExcludedPads(DetectorHistograms& spectraHistograms,
+                       const DetectorChannels& channelStatistics);
+
+/// Fit the mean cluster charge vs. time slice of each padrow and sector
+/// with an exponential, and write the profiles and a tree of the fits.
+void AnalyzeDriftProfiles(const DetectorDriftProfiles& driftProfiles, TFile& outputFile);
+
+/// Time bin of an input file. Bins hold consecutive files of the input list.
+unsigned int GetTimeBin(const unsigned int fileIndex,
+                        const unsigned int nFiles,
+                        const unsigned int nTimeBins);
+
+/// Fit the pad spectra of each time bin and write the gains of each bin,
+/// a tree of per-bin results and a summary of the gain stability.
+void AnalyzeTimeBins(const det::TPC& tpc,
+                     const std::vector<DetectorHistograms>& timeBinSpectra,
+                     const std::vector<std::string>& filenames,
+                     const bool updateGains,
+                     const std::string& outputBase,
+                     TFile& outputFile);
+
+/// Normalized pad gains from fitted spectrum ADCs. Gains outside the
+/// acceptable limits are -1.
+DetectorGains ComputePadGains(const det::TPC& tpc,
+                              const DetectorADCs& spectrumADCs,
+                              const modutils::DEDXTools::SectorAveragers& sectorAccumulators,
+                              const DetectorGains& previousGains);
+
+/// Iterate the calibration in memory: apply the gains of the last fit to
+/// the stored cluster charges, or remap the uncorrected fine spectra if
+/// given, and refit the pad spectra, until the
+/// largest relative gain change is below the tolerance. On return the
+/// spectra, spectrum ADCs, sector averages and fit results belong to
+/// appliedGains.
+void IterateCalibration(const det::TPC& tpc,
+                        const DetectorCharges& clusterCharges,
+                        const std::vector<DetectorHistograms>& fineSpectra,
+                        const unsigned int nIterations,
+                        const double tolerance,
+                        DetectorHistograms& spectraHistograms,
+                        DetectorGains& appliedGains,
+                        DetectorADCs& spectrumADCs,
+                        modutils::DEDXTools::SectorAveragers& sectorAccumulators,
+                        DetectorFitResults* fitResults = nullptr);
+
+/// Fit the pad spectra of each alternative cut set, write their gains,
+/// and compare them with the gains of the main cuts.
+void AnalyzeCutSets(const det::TPC& tpc,
+                    const std::vector<CutSetBank>& cutSetBanks,
+                    const DetectorHistograms& mainSpectra,
+                    const DetectorGains& mainGains,
+                    const bool updateGains,
+                    const std::string& outputBase);
+
+/// Estimate memory of all histograms booked for the configured TPCs.
+MemoryReport EstimateBookingMemory(const det::TPC& tpc);
+
+/// Save canvas as a page of the QA PDF.
+void SaveQAPage(const TCanvas& canvas, const TString& pdfName);
+
 // Gauss function.
 double Gauss(const double x,
              const double mean,
@@ -87,8 +300,20 @@ double Gauss(const double x,
 void DisplayUsage()
 {
   std::cerr << "\nUsage:\n\tKryptonAnalyzer -o outputPrefix "
-    "[ (-c / --config) configFilePath] [ (-u / --updateGains) previousPadGainsFile] "
-    "-i rootFiles \n"
+    "[ (-c / --config) configFilePath] "
+    "[ (-u / --updateGains) previousPadGainsFile (.xml or .bin)] "
+    "[ (-j / --threads) nThreads] [--numa] [--fill-mode local|shared|auto] "
+    "[--order file|sector] "
+    "[--time-bins nBins] "
+    "[--iterations K] [--iteration-tolerance relativeGainChange] [--fine-bins factor] "
+    "[--drift-bins nBins] [--channel-status] [--exclude-hot-pads factor] "
+    "[--validate] [--validate-baskets] [--sector-spectra] [--no-pad-sort] "
+    "[--compression algorithm:level] [--write-threads nThreads] "
+    "[--refit previousOutput.root] "
+    "[--trace traceFile.json] [--memory-budget MB] [--perf-counters] "
+    "-i rootFiles (not with --refit) \n"
+    "\tKryptonAnalyzer --daemon socketPath\n"
+    "\tKryptonAnalyzer --submit socketPath [analyzer arguments | --shutdown] \n"
             << std::endl;
   exit(-1);
 }
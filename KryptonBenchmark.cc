@@ -0,0 +1,441 @@
+/**
+  \file Microbenchmarks of the hot paths of KryptonAnalyzer, run on
+  synthetic data without detector geometry or input files: the
+  cut-and-fill loop over cluster blocks, in input order and sorted by
+  pad, the peak and half-maximum
+  search over pad spectra, and the Gaussian and Fermi pad fits. The
+  kernels are the ones in KryptonKernels.h, so changes to the
+  analyzer's hot paths can be measured in isolation. The optional write
+  kernel writes the pad spectra of many sectors with the output
+  compression settings and thread counts of KryptonOutput.h, for write
+  time versus file size. The optional contention kernel fills the pad
+  spectra from several threads, once into thread-local copies that are
+  merged and once into shared spectra with atomic bin increments.
+
+  \author B. Rumberger
+  \version $Id:    $
+  \date 17 October 2026
+*/
+
+#include "KryptonKernels.h"
+#include "KryptonOutput.h"
+#include "KryptonPhaseTimer.h"
+
+#include <TRandom3.h>
+#include <TROOT.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <cstdio>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace std;
+
+// Display usage.
+void DisplayUsage()
+{
+  std::cerr << "\nUsage:\n\tKryptonBenchmark "
+    "[--entries N] [--padrows N] [--pads N] [--bins N] [--repetitions N] "
+    "[--kernels fill,sort,peak,gaussian,fermi,write,contention] [--withGains] [--perf-counters] [--seed N] "
+    "[--sectors N] [--compressions none,zlib:1,...] [--write-threads N] [--threads N] "
+    "[--json reportFile.json] \n"
+            << std::endl;
+  exit(-1);
+}
+
+/// Generate blocks of synthetic 83Kr clusters on a sector of nPadrows x nPads.
+vector<ClusterBlock> GenerateClusterBlocks(const unsigned int nEntries,
+                                           const unsigned int nPadrows,
+                                           const unsigned int nPads,
+                                           const unsigned int seed)
+{
+  //83Kr lines [keV] with their cumulative intensities, and charge scale.
+  const double lineEnergies[5] = {9.4, 12.6, 19.6, 29.0, 41.6};
+  const double cumulativeIntensities[5] = {0.05, 0.20, 0.30, 0.55, 1.00};
+  const double adcPerKeV = 70;
+  const double resolution = 0.08;
+  const double noiseFraction = 0.2;
+
+  TRandom3 random(seed);
+  vector<ClusterBlock> blocks;
+  for (unsigned int blockStart = 0; blockStart < nEntries; blockStart += kClusterBlockSize) {
+    ClusterBlock block;
+    block.Resize(min(kClusterBlockSize,nEntries - blockStart));
+    for (unsigned int i = 0; i < block.fSize; ++i) {
+      double charge = 0;
+      unsigned int clusterPads = 0;
+      unsigned int clusterTimeSlices = 0;
+      if (random.Uniform() < noiseFraction) {
+        charge = random.Exp(300);
+        clusterPads = 1 + random.Integer(4);
+        clusterTimeSlices = 1 + random.Integer(5);
+      }
+      else {
+        const double u = random.Uniform();
+        const unsigned int line =
+          lower_bound(cumulativeIntensities,cumulativeIntensities + 4,u) - cumulativeIntensities;
+        charge = lineEnergies[line]*adcPerKeV*(1 + resolution*random.Gaus());
+        clusterPads = 4 + random.Poisson(4);
+        clusterTimeSlices = 5 + random.Poisson(8);
+      }
+      charge = max(0.,charge);
+      block.fCharge[i] = charge;
+      block.fMaxADC[i] = (UShort_t)min(1023.,3*charge/(clusterPads*clusterTimeSlices));
+      block.fTimeSlice[i] = (UShort_t)random.Integer(256);
+      block.fNPixels[i] = (UShort_t)ceil(0.7*clusterPads*clusterTimeSlices);
+      block.fNTimeSlices[i] = (UChar_t)min(clusterTimeSlices,255u);
+      block.fNPads[i] = (UChar_t)min(clusterPads,255u);
+      block.fPadrow[i] = (UChar_t)(1 + random.Integer(nPadrows));
+      block.fPad[i] = (UChar_t)(1 + random.Integer(nPads));
+    }
+    blocks.push_back(block);
+  }
+  return blocks;
+}
+
+/// Main function.
+int main(int argc, char* argv[])
+{
+  const vector<string> argumentsVector(argv + 1, argv + argc);
+
+  unsigned int nEntries = 2000000;
+  unsigned int nPadrows = 24;
+  unsigned int nPads = 192;
+  unsigned int histogramBins = 100;
+  unsigned int repetitions = 3;
+  unsigned int seed = 4357;
+  bool withGains = false;
+  bool perfCounters = false;
+  string kernels = "fill,sort,peak,gaussian,fermi";
+  unsigned int nSectors = 1;
+  string compressions = "none,zlib:1,lz4:4,zstd:5,lzma:6";
+  unsigned int nWriteThreads = 4;
+  unsigned int nFillThreads = 4;
+  string jsonFilename;
+  for (auto it = argumentsVector.begin(), itEnd = argumentsVector.end();
+       it != itEnd; ++it) {
+    if (*it == string("-h") || *it == string("--help"))
+      DisplayUsage();
+    else if (*it == string("--withGains"))
+      withGains = true;
+    else if (*it == string("--perf-counters"))
+      perfCounters = true;
+    else if (next(it) == itEnd) {
+      cout << "[ERROR] No value provided with argument " << *it << "!" << endl;
+      DisplayUsage();
+    }
+    else if (*it == string("--entries"))
+      nEntries = stoul(*(++it));
+    else if (*it == string("--padrows"))
+      nPadrows = stoul(*(++it));
+    else if (*it == string("--pads"))
+      nPads = stoul(*(++it));
+    else if (*it == string("--bins"))
+      histogramBins = stoul(*(++it));
+    else if (*it == string("--repetitions"))
+      repetitions = stoul(*(++it));
+    else if (*it == string("--seed"))
+      seed = stoul(*(++it));
+    else if (*it == string("--kernels"))
+      kernels = *(++it);
+    else if (*it == string("--sectors"))
+      nSectors = stoul(*(++it));
+    else if (*it == string("--compressions"))
+      compressions = *(++it);
+    else if (*it == string("--write-threads"))
+      nWriteThreads = stoul(*(++it));
+    else if (*it == string("--threads"))
+      nFillThreads = stoul(*(++it));
+    else if (*it == string("--json"))
+      jsonFilename = *(++it);
+    else {
+      cout << "[ERROR] Invalid argument " << *it << "!" << endl;
+      DisplayUsage();
+    }
+  }
+  if (nPadrows == 0 || nPads == 0 || nPadrows > 255 || nPads > 255 || repetitions == 0 ||
+      nSectors == 0 || nWriteThreads == 0 || nFillThreads == 0) {
+    cout << "[ERROR] Padrows and pads must be in 1-255, repetitions, sectors and "
+         << "threads at least 1!" << endl;
+    DisplayUsage();
+  }
+  const bool runFill = kernels.find("fill") != string::npos;
+  const bool runSort = kernels.find("sort") != string::npos;
+  const bool runPeak = kernels.find("peak") != string::npos;
+  const bool runGaussian = kernels.find("gaussian") != string::npos;
+  const bool runFermi = kernels.find("fermi") != string::npos;
+  const bool runWrite = kernels.find("write") != string::npos;
+  const bool runContention = kernels.find("contention") != string::npos;
+
+  //Compression settings of the write kernel.
+  vector<pair<string,int> > writeSettings;
+  if (runWrite) {
+    istringstream settingsStream(compressions);
+    string setting;
+    while (getline(settingsStream,setting,',')) {
+      const int compression = ParseCompressionSetting(setting);
+      if (compression < 0) {
+        cout << "[ERROR] Invalid compression setting " << setting << "!" << endl;
+        DisplayUsage();
+      }
+      writeSettings.push_back(make_pair(setting,compression));
+    }
+  }
+
+  TH1::AddDirectory(kFALSE);
+  if ((runWrite && nWriteThreads > 1) || (runContention && nFillThreads > 1))
+    ROOT::EnableThreadSafety();
+
+  //Settings as in the default Config.txt.
+  ClusterCuts cuts;
+  cuts.fMinPads = 4;
+  cuts.fMaxPads = 32;
+  cuts.fMinTimeSliceNumber = 30;
+  cuts.fMinTimeSlices = 4;
+  cuts.fMaxTimeSlices = 50;
+  cuts.fMaxADCCut = 20;
+  cuts.fChargeCut = 6000;
+  const double minADCPeakSearch = 1500;
+  const double histogramMax = minADCPeakSearch*3.0;
+
+  cout << "[INFO] Generating " << nEntries << " clusters on " << nPadrows << " x "
+       << nPads << " pads." << endl;
+  const vector<ClusterBlock> blocks = GenerateClusterBlocks(nEntries,nPadrows,nPads,seed);
+
+  //Book pad spectra and sector QA, as sector 0 of TPC 0.
+  DetectorHistograms sectorHistograms;
+  PadrowHistograms& padHistograms = sectorHistograms[0][0];
+  PadrowGains previousGains;
+  TRandom3 random(seed + 1);
+  for (unsigned int padrowId = 1; padrowId <= nPadrows; ++padrowId) {
+    for (unsigned int padId = 1; padId <= nPads; ++padId) {
+      padHistograms[padrowId][padId].reset(
+        new TH1D(Form("BenchmarkPadrow%uPad%u",padrowId,padId),
+                 "Benchmark pad spectrum;Cluster Charge [ADC];Entries",
+                 histogramBins,0,histogramMax));
+      previousGains[padrowId][padId] = random.Gaus(1,0.05);
+    }
+  }
+  SectorQAHistograms qa =
+    BookSectorQAHistograms("Benchmark","Benchmark",nPadrows,nPads,histogramMax,
+                           histogramBins,cuts.fMaxPads,cuts.fMaxTimeSlices);
+  const unsigned int totalPads = nPadrows*nPads;
+
+  PhaseTimer timer;
+  if (perfCounters)
+    timer.EnablePerfCounters();
+
+  //Fill kernel. Spectra are always filled once, as input for the fit kernels.
+  for (unsigned int repetition = 0; repetition < (runFill ? repetitions : 1); ++repetition) {
+    PhaseTimer::Scope fillPhase(timer,"fill");
+    for (auto it = blocks.begin(), itEnd = blocks.end(); it != itEnd; ++it)
+      FillClusterBlock(*it,cuts,padHistograms,qa,withGains ? &previousGains : nullptr);
+    fillPhase.AddEntries(nEntries);
+  }
+
+  //Sorted fill kernel: blocks sorted by pad and filled in per-pad runs, as
+  //in the analyzer, into their own spectra. The sort is timed with the fill.
+  if (runSort) {
+    DetectorHistograms sortedHistograms = CloneHistograms(sectorHistograms);
+    SectorQAHistograms sortedQA =
+      BookSectorQAHistograms("BenchmarkSorted","Benchmark sorted",nPadrows,nPads,histogramMax,
+                             histogramBins,cuts.fMaxPads,cuts.fMaxTimeSlices);
+    ClusterBlock scratch;
+    for (unsigned int repetition = 0; repetition < repetitions; ++repetition) {
+      vector<ClusterBlock> sortedBlocks = blocks;
+      PhaseTimer::Scope sortedFillPhase(timer,"sortedFill");
+      for (auto it = sortedBlocks.begin(), itEnd = sortedBlocks.end(); it != itEnd; ++it) {
+        SortClusterBlockByPad(*it,scratch);
+        FillClusterBlock(*it,cuts,sortedHistograms[0][0],sortedQA,
+                         withGains ? &previousGains : nullptr);
+      }
+      sortedFillPhase.AddEntries(nEntries);
+    }
+  }
+
+  vector<SpectrumPeak> peaks(totalPads);
+  if (runPeak) {
+    for (unsigned int repetition = 0; repetition < repetitions; ++repetition) {
+      PhaseTimer::Scope peakPhase(timer,"peakSearch");
+      unsigned int i = 0;
+      for (unsigned int padrowId = 1; padrowId <= nPadrows; ++padrowId)
+        for (unsigned int padId = 1; padId <= nPads; ++padId)
+          peaks[i++] = FindSpectrumPeak(*padHistograms[padrowId][padId],minADCPeakSearch);
+      peakPhase.AddEntries(totalPads);
+    }
+  }
+  else {
+    unsigned int i = 0;
+    for (unsigned int padrowId = 1; padrowId <= nPadrows; ++padrowId)
+      for (unsigned int padId = 1; padId <= nPads; ++padId)
+        peaks[i++] = FindSpectrumPeak(*padHistograms[padrowId][padId],minADCPeakSearch);
+  }
+
+  const string fitFunctions[2] = {"Gaussian", "Fermi"};
+  const bool runFit[2] = {runGaussian, runFermi};
+  for (unsigned int f = 0; f < 2; ++f) {
+    if (!runFit[f])
+      continue;
+    unsigned int nFailed = 0;
+    for (unsigned int repetition = 0; repetition < repetitions; ++repetition) {
+      PhaseTimer::Scope fitPhase(timer,(f == 0) ? "gaussianFit" : "fermiFit");
+      unsigned int i = 0;
+      for (unsigned int padrowId = 1; padrowId <= nPadrows; ++padrowId) {
+        for (unsigned int padId = 1; padId <= nPads; ++padId) {
+          const PadFitResult result =
+            FitPadSpectrum(*padHistograms[padrowId][padId],peaks[i++],fitFunctions[f]);
+          if (result.fStatus != 0)
+            ++nFailed;
+        }
+      }
+      fitPhase.AddEntries(totalPads);
+    }
+    cout << "[INFO] " << fitFunctions[f] << " fits with non-zero status: "
+         << nFailed/repetitions << " / " << totalPads << endl;
+  }
+
+  //Contention kernel: the blocks are split over nFillThreads threads, which
+  //fill either their own copies of the pad spectra, merged afterwards, or
+  //the same spectra with atomic increments. Both include the booking.
+  if (runContention) {
+    const string modes[2] = {"local", "shared"};
+    double entries[2] = {0, 0};
+    for (unsigned int m = 0; m < 2; ++m) {
+      const bool shared = (m == 1);
+      const string phaseName = "contention-" + modes[m];
+      for (unsigned int repetition = 0; repetition < repetitions; ++repetition) {
+        PhaseTimer::Scope contentionPhase(timer,phaseName);
+        DetectorHistograms target = CloneHistograms(sectorHistograms);
+        vector<DetectorHistograms> threadHistograms(shared ? 0 : nFillThreads);
+        for (auto it = threadHistograms.begin(), itEnd = threadHistograms.end(); it != itEnd; ++it)
+          *it = CloneHistograms(sectorHistograms);
+        auto fillBlocks = [&](const unsigned int filler) {
+          PadrowHistograms& threadSpectra = shared ? target[0][0] : threadHistograms[filler][0][0];
+          for (unsigned int i = filler; i < blocks.size(); i += nFillThreads)
+            FillClusterBlockSpectra(blocks[i],cuts,threadSpectra,
+                                    withGains ? &previousGains : nullptr,shared);
+        };
+        vector<thread> fillers;
+        for (unsigned int filler = 0; filler < nFillThreads; ++filler)
+          fillers.emplace_back(fillBlocks,filler);
+        for (auto it = fillers.begin(), itEnd = fillers.end(); it != itEnd; ++it)
+          it->join();
+        if (shared)
+          FinishAtomicFill(target);
+        for (auto it = threadHistograms.begin(), itEnd = threadHistograms.end(); it != itEnd; ++it)
+          MergeHistograms(target,*it);
+        contentionPhase.AddEntries(nEntries);
+
+        entries[m] = 0;
+        for (unsigned int padrowId = 1; padrowId <= nPadrows; ++padrowId)
+          for (unsigned int padId = 1; padId <= nPads; ++padId)
+            entries[m] += target[0][0][padrowId][padId]->GetEntries();
+      }
+    }
+    cout << "[INFO] Contention with " << nFillThreads << " threads, local / shared: "
+         << 1e9*timer.GetTiming("contention-local").fWallTime/((double)nEntries*repetitions)
+         << " / "
+         << 1e9*timer.GetTiming("contention-shared").fWallTime/((double)nEntries*repetitions)
+         << " ns/entry, " << nFillThreads*totalPads << " / " << totalPads
+         << " booked spectra." << endl;
+    if (entries[0] != entries[1]) {
+      cout << "[ERROR] Shared spectra have " << entries[1] << " entries instead of "
+           << entries[0] << "!" << endl;
+      return -1;
+    }
+  }
+
+  //Write kernel: nSectors copies of the sector, with their QA, balanced
+  //over the shard files as by the analyzer. The same histograms are written
+  //under the key names of each sector copy.
+  ostringstream writeJSON;
+  writeJSON << "[";
+  if (runWrite) {
+    const TObject* qaObjects[10] = {
+      qa.fSpectra.first.get(), qa.fSpectra.second.get(), qa.fPadEntries.first.get(),
+      qa.fPadEntries.second.get(), qa.fTimeSlices.first.get(), qa.fTimeSlices.second.get(),
+      qa.fChargeVsMaxADC.first.get(), qa.fChargeVsMaxADC.second.get(),
+      qa.fNPadsVsNTimeSlices.first.get(), qa.fNPadsVsNTimeSlices.second.get()
+    };
+    vector<OutputObjects> sectorObjects(nSectors);
+    vector<unsigned long long> sectorWeights(nSectors);
+    for (unsigned int sectorId = 0; sectorId < nSectors; ++sectorId) {
+      OutputObjects& objects = sectorObjects[sectorId];
+      for (unsigned int i = 0; i < 10; ++i)
+        objects.push_back(make_pair(qaObjects[i],
+                                    string(qaObjects[i]->GetName()) + Form("Sector%u",sectorId)));
+      for (unsigned int padrowId = 1; padrowId <= nPadrows; ++padrowId)
+        for (unsigned int padId = 1; padId <= nPads; ++padId)
+          objects.push_back(make_pair((const TObject*)padHistograms[padrowId][padId].get(),
+                                      string(Form("BenchmarkSector%uPadrow%uPad%u",
+                                                  sectorId,padrowId,padId))));
+      sectorWeights[sectorId] = objects.size();
+    }
+    const unsigned long long nObjects = nSectors*(10ull + totalPads);
+    vector<unsigned int> threadCounts(1,1);
+    if (nWriteThreads > 1)
+      threadCounts.push_back(min(nWriteThreads,nSectors));
+
+    cout << "[INFO] Writing " << nObjects << " objects of " << nSectors
+         << " sectors. Compression, threads, write time [s], size [MB], MB/s:" << endl;
+    const string outputBase = "KryptonBenchmarkWrite";
+    for (auto settingIt = writeSettings.begin(), settingEnd = writeSettings.end();
+         settingIt != settingEnd; ++settingIt) {
+      for (auto threadIt = threadCounts.begin(), threadEnd = threadCounts.end();
+           threadIt != threadEnd; ++threadIt) {
+        const unsigned int nShards = *threadIt;
+        const vector<unsigned int> sectorShards = BalanceShards(sectorWeights,nShards);
+        vector<OutputObjects> shardObjects(nShards);
+        for (unsigned int sectorId = 0; sectorId < nSectors; ++sectorId)
+          shardObjects[sectorShards[sectorId]].insert(shardObjects[sectorShards[sectorId]].end(),
+                                                      sectorObjects[sectorId].begin(),
+                                                      sectorObjects[sectorId].end());
+
+        const string phaseName = "write-" + settingIt->first + "-" + to_string(nShards);
+        Long64_t bytes = 0;
+        for (unsigned int repetition = 0; repetition < repetitions; ++repetition) {
+          PhaseTimer::Scope writePhase(timer,phaseName);
+          bytes = WriteOutputShards(outputBase,shardObjects,settingIt->second);
+          writePhase.AddEntries(nObjects);
+        }
+        for (unsigned int shard = 0; shard < nShards; ++shard)
+          remove(GetOutputShardFilename(outputBase,shard).c_str());
+        if (bytes < 0) {
+          cout << "[ERROR] Could not write " << GetOutputShardFilename(outputBase,0) << endl;
+          return -1;
+        }
+
+        const double wallTime = timer.GetTiming(phaseName).fWallTime/repetitions;
+        cout << "[INFO]   " << settingIt->first << ", " << nShards << ", " << wallTime
+             << ", " << bytes/1e6 << ", " << ((wallTime > 0) ? bytes/1e6/wallTime : 0) << endl;
+        writeJSON << ((writeJSON.tellp() > 1) ? ", " : "")
+                  << "{\"compression\": \"" << settingIt->first << "\", \"threads\": " << nShards
+                  << ", \"wallTime\": " << wallTime << ", \"bytes\": " << bytes << "}";
+      }
+    }
+    writeJSON << "]";
+    timer.AddReportSection("write",writeJSON.str());
+  }
+
+  timer.Print();
+  cout << "[INFO] Fills: ns/entry; peak search and fits: ns/pad (pads/s = entries/s above)."
+       << endl;
+  const string phases[5] = {"fill", "sortedFill", "peakSearch", "gaussianFit", "fermiFit"};
+  const bool ran[5] = {runFill, runSort, runPeak, runGaussian, runFermi};
+  for (unsigned int p = 0; p < 5; ++p) {
+    if (!ran[p])
+      continue;
+    const double entries = (p < 2) ? (double)nEntries*repetitions : (double)totalPads*repetitions;
+    const PhaseTiming timing = timer.GetTiming(phases[p]);
+    cout << "[INFO]   " << phases[p] << ": " << 1e9*timing.fWallTime/entries << " ns" << endl;
+  }
+  if (!jsonFilename.empty() && timer.WriteJSON(jsonFilename,"KryptonBenchmark"))
+    cout << "[INFO] Benchmark report written to file " << jsonFilename << endl;
+
+  return 0;
+}
@@ -0,0 +1,214 @@
+/**
+  \file Comparison of two KryptonAnalyzer outputs: the pad gains XML
+  and the fResultTree of the analysis ROOT file. Used to check that
+  parallel runs reproduce a golden single-threaded output. Values
+  agree if their relative difference is within the tolerance. Exits
+  with 0 if the outputs agree and 1 otherwise.
+
+  \author B. Rumberger
+  \version $Id:    $
+  \date 17 October 2026
+*/
+
+#include "KryptonPadGains.h"
+
+#include <TFile.h>
+#include <TTree.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <iostream>
+#include <map>
+#include <string>
+#include <tuple>
+#include <utility>
+#include <vector>
+
+using namespace std;
+
+//Pad key (TPC, sector, padrow, pad) and result values (spectrum ADC, gain).
+typedef tuple<unsigned int, unsigned int, unsigned int, unsigned int> PadKey;
+typedef map<PadKey, pair<double,double> > PadResults;
+
+// Display usage.
+void DisplayUsage()
+{
+  std::cerr << "\nUsage:\n\tKryptonCompare -r referencePrefix -t testPrefix "
+    "[--tolerance relativeTolerance] \n"
+    "\n\tPrefixes are the -o prefixes given to KryptonAnalyzer.\n"
+            << std::endl;
+  exit(-1);
+}
+
+/// Relative difference, with exact zeros and the -1 marker of rejected gains equal.
+double RelativeDifference(const double reference, const double test)
+{
+  if (reference == test)
+    return 0;
+  if (std::isnan(reference) && std::isnan(test))
+    return 0;
+  return fabs(test - reference)/max(fabs(reference),fabs(test));
+}
+
+/// Read fResultTree of an analysis output file. Returns false on failure.
+bool ReadResultTree(const string& filename, PadResults& results)
+{
+  TFile file(filename.c_str(),"READ");
+  if (file.IsZombie()) {
+    cout << "[ERROR] Could not open " << filename << "!" << endl;
+    return false;
+  }
+  TTree* tree = dynamic_cast<TTree*>(file.Get("fResultTree"));
+  if (tree == nullptr) {
+    cout << "[ERROR] No fResultTree in " << filename << "!" << endl;
+    return false;
+  }
+  unsigned int tpcId = 0;
+  unsigned int sectorId = 0;
+  unsigned int padrowId = 0;
+  unsigned int padId = 0;
+  double spectrumADC = 0;
+  double gain = 0;
+  tree->SetBranchAddress("fTPCId",&tpcId);
+  tree->SetBranchAddress("fSectorId",&sectorId);
+  tree->SetBranchAddress("fPadrowId",&padrowId);
+  tree->SetBranchAddress("fPadId",&padId);
+  tree->SetBranchAddress("fSpectrumADC",&spectrumADC);
+  tree->SetBranchAddress("fGain",&gain);
+  for (Long64_t i = 0; i < tree->GetEntries(); ++i) {
+    tree->GetEntry(i);
+    results[PadKey(tpcId,sectorId,padrowId,padId)] = make_pair(spectrumADC,gain);
+  }
+  delete tree;
+  return true;
+}
+
+/// Main function.
+int main(int argc, char* argv[])
+{
+  const vector<string> argumentsVector(argv + 1, argv + argc);
+
+  string referencePrefix;
+  string testPrefix;
+  double tolerance = 1e-6;
+  for (auto it = argumentsVector.begin(), itEnd = argumentsVector.end();
+       it != itEnd; ++it) {
+    if (*it == string("-h") || *it == string("--help")) {
+      DisplayUsage();
+    }
+    else if (next(it) == itEnd) {
+      cout << "[ERROR] No value provided with argument " << *it << "!" << endl;
+      DisplayUsage();
+    }
+    else if (*it == string("-r"))
+      referencePrefix = *(++it);
+    else if (*it == string("-t"))
+      testPrefix = *(++it);
+    else if (*it == string("--tolerance")) {
+      const string& value = *(++it);
+      size_t length = 0;
+      try {
+	tolerance = stod(value,&length);
+      }
+      catch (const std::exception&) {
+	length = 0;
+      }
+      if (length == 0 || length != value.size()) {
+	cout << "[ERROR] Invalid tolerance " << value << "!" << endl;
+	DisplayUsage();
+      }
+    }
+    else {
+      cout << "[ERROR] Invalid argument " << *it << "!" << endl;
+      DisplayUsage();
+    }
+  }
+  if (referencePrefix.empty() || testPrefix.empty()) {
+    cout << "[ERROR] Reference and test prefixes are both required!" << endl;
+    DisplayUsage();
+  }
+
+  const string referenceBase = referencePrefix + "-KryptonAnalysis";
+  const string testBase = testPrefix + "-KryptonAnalysis";
+  unsigned int nMismatches = 0;
+
+  //Pad gains XML.
+  DetectorGains referenceGains;
+  DetectorGains testGains;
+  const unsigned int nReferenceGains =
+    ReadPadGainXML(referenceBase + "-KryptonPadGains.xml",referenceGains);
+  const unsigned int nTestGains = ReadPadGainXML(testBase + "-KryptonPadGains.xml",testGains);
+  if (nReferenceGains == 0 || nTestGains == 0) {
+    cout << "[ERROR] Could not read pad gains of " << referencePrefix << " or "
+         << testPrefix << "!" << endl;
+    return 1;
+  }
+  if (nReferenceGains != nTestGains) {
+    cout << "[WARNING] Number of pad gains differs: " << nReferenceGains << " vs. "
+         << nTestGains << endl;
+    ++nMismatches;
+  }
+  double maxGainDifference = 0;
+  for (auto tpcIt = referenceGains.begin(), tpcEnd = referenceGains.end(); tpcIt != tpcEnd; ++tpcIt)
+    for (auto sectorIt = tpcIt->second.begin(), sectorEnd = tpcIt->second.end();
+         sectorIt != sectorEnd; ++sectorIt)
+      for (auto padrowIt = sectorIt->second.begin(), padrowEnd = sectorIt->second.end();
+           padrowIt != padrowEnd; ++padrowIt)
+        for (auto padIt = padrowIt->second.begin(), padEnd = padrowIt->second.end();
+             padIt != padEnd; ++padIt) {
+          //Missing pads have unit gain, which never matches a rejected (-1) gain.
+          const double testGain = GetPadGain(testGains,tpcIt->first,sectorIt->first,
+                                             padrowIt->first,padIt->first);
+          const double difference = RelativeDifference(padIt->second,testGain);
+          maxGainDifference = max(maxGainDifference,difference);
+          if (difference > tolerance) {
+            if (nMismatches < 20)
+              cout << "[WARNING] Gain mismatch: TPC " << tpcIt->first
+                   << ", sector " << sectorIt->first
+                   << ", padrow " << padrowIt->first
+                   << ", pad " << padIt->first
+                   << ": " << padIt->second << " vs. " << testGain << endl;
+            ++nMismatches;
+          }
+        }
+
+  //Result trees.
+  PadResults referenceResults;
+  PadResults testResults;
+  if (!ReadResultTree(referenceBase + ".root",referenceResults) ||
+      !ReadResultTree(testBase + ".root",testResults))
+    return 1;
+  if (referenceResults.size() != testResults.size()) {
+    cout << "[WARNING] Number of result tree entries differs: " << referenceResults.size()
+         << " vs. " << testResults.size() << endl;
+    ++nMismatches;
+  }
+  double maxADCDifference = 0;
+  double maxResultGainDifference = 0;
+  for (auto it = referenceResults.begin(), itEnd = referenceResults.end(); it != itEnd; ++it) {
+    auto testIt = testResults.find(it->first);
+    if (testIt == testResults.end()) {
+      ++nMismatches;
+      continue;
+    }
+    const double adcDifference = RelativeDifference(it->second.first,testIt->second.first);
+    const double gainDifference = RelativeDifference(it->second.second,testIt->second.second);
+    maxADCDifference = max(maxADCDifference,adcDifference);
+    maxResultGainDifference = max(maxResultGainDifference,gainDifference);
+    if (adcDifference > tolerance || gainDifference > tolerance)
+      ++nMismatches;
+  }
+
+  cout << "[INFO] Compared " << nReferenceGains << " pad gains and " << referenceResults.size()
+       << " result entries. Maximum relative difference: gains " << maxGainDifference
+       << ", spectrum ADC " << maxADCDifference << ", result gains " << maxResultGainDifference
+       << ". Tolerance: " << tolerance << endl;
+  if (nMismatches > 0) {
+    cout << "[ERROR] " << testPrefix << " differs from " << referencePrefix << " ("
+         << nMismatches << " mismatches)!" << endl;
+    return 1;
+  }
+  cout << "[INFO] " << testPrefix << " matches " << referencePrefix << "." << endl;
+  return 0;
+}
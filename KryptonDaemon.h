@@ -0,0 +1,180 @@
+/**
+  \file
+  Local job socket of the KryptonAnalyzer daemon. A job is the working
+  directory and the analyzer arguments, one per line, ended by an empty
+  line. The daemon streams the job output back on the same connection
+  and ends it with a "[DAEMON] OUTPUT path" line per output file and a
+  "[DAEMON] EXIT code" line.
+
+  \author B. Rumberger
+  \version $Id:    $
+  \date 17 October 2026
+*/
+
+#ifndef _KryptonDaemon_h_
+#define _KryptonDaemon_h_
+
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+/// Prefix of the daemon's own lines in the job output.
+const std::string kDaemonLinePrefix = "[DAEMON] ";
+
+/// Largest accepted job, in bytes.
+const size_t kMaxDaemonJobBytes = 16 << 20;
+
+/// One calibration job: working directory and analyzer arguments.
+struct DaemonJob {
+  std::string fDirectory;
+  std::vector<std::string> fArguments;
+};
+
+/// Address of a UNIX socket. Returns false if the path is too long.
+inline bool GetSocketAddress(const std::string& socketPath, sockaddr_un& address)
+{
+  std::memset(&address,0,sizeof(address));
+  address.sun_family = AF_UNIX;
+  if (socketPath.empty() || socketPath.size() >= sizeof(address.sun_path))
+    return false;
+  std::strncpy(address.sun_path,socketPath.c_str(),sizeof(address.sun_path) - 1);
+  return true;
+}
+
+/// Write all of text to a socket or pipe. Returns false if the peer is gone.
+inline bool WriteSocket(const int socketFd, const std::string& text)
+{
+  size_t written = 0;
+  while (written < text.size()) {
+    const ssize_t n = write(socketFd,text.data() + written,text.size() - written);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n <= 0)
+      return false;
+    written += n;
+  }
+  return true;
+}
+
+/// Read one job. Returns false for a connection closed before the empty
+/// line, an oversized job or a job without a directory.
+inline bool ReadDaemonJob(const int socketFd, DaemonJob& job)
+{
+  std::string request;
+  char buffer[4096];
+  while (request.size() < 2 || request.compare(request.size() - 2,2,"\n\n") != 0) {
+    const ssize_t n = read(socketFd,buffer,sizeof(buffer));
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n <= 0 || request.size() + n > kMaxDaemonJobBytes)
+      return false;
+    request.append(buffer,n);
+  }
+
+  job = DaemonJob();
+  std::string::size_type lineStart = 0;
+  for (std::string::size_type lineEnd = request.find('\n');
+       lineEnd != std::string::npos && lineEnd > lineStart;
+       lineStart = lineEnd + 1, lineEnd = request.find('\n',lineStart)) {
+    const std::string line = request.substr(lineStart,lineEnd - lineStart);
+    if (job.fDirectory.empty())
+      job.fDirectory = line;
+    else
+      job.fArguments.push_back(line);
+  }
+  return !job.fDirectory.empty();
+}
+
+/// Lines read from a pipe until the writer closes it, e.g. the output
+/// files reported by a job.
+inline std::vector<std::string> ReadLines(const int fd)
+{
+  std::string text;
+  char buffer[4096];
+  for (;;) {
+    const ssize_t n = read(fd,buffer,sizeof(buffer));
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n <= 0)
+      break;
+    text.append(buffer,n);
+  }
+  std::vector<std::string> lines;
+  std::string::size_type lineStart = 0;
+  for (std::string::size_type lineEnd = text.find('\n'); lineEnd != std::string::npos;
+       lineStart = lineEnd + 1, lineEnd = text.find('\n',lineStart))
+    if (lineEnd > lineStart)
+      lines.push_back(text.substr(lineStart,lineEnd - lineStart));
+  return lines;
+}
+
+/// Send a job to the daemon at socketPath and copy its output to cout.
+/// Returns the exit code of the job, or -1 if the daemon cannot be reached
+/// or closes the connection early.
+inline int SubmitDaemonJob(const std::string& socketPath, const DaemonJob& job)
+{
+  sockaddr_un address;
+  if (!GetSocketAddress(socketPath,address)) {
+    std::cout << "[ERROR] Invalid socket path " << socketPath << "!" << std::endl;
+    return -1;
+  }
+  const int socketFd = socket(AF_UNIX,SOCK_STREAM,0);
+  if (socketFd < 0 || connect(socketFd,(const sockaddr*)&address,sizeof(address)) != 0) {
+    std::cout << "[ERROR] Cannot connect to the daemon at " << socketPath << ": "
+              << std::strerror(errno) << std::endl;
+    if (socketFd >= 0)
+      close(socketFd);
+    return -1;
+  }
+
+  std::string request = job.fDirectory + "\n";
+  for (auto it = job.fArguments.begin(), itEnd = job.fArguments.end(); it != itEnd; ++it)
+    request += *it + "\n";
+  request += "\n";
+  if (!WriteSocket(socketFd,request)) {
+    std::cout << "[ERROR] Cannot send the job to the daemon at " << socketPath << "!" << std::endl;
+    close(socketFd);
+    return -1;
+  }
+
+  //Copy the output line by line, and find the exit line.
+  int exitCode = -1;
+  bool exited = false;
+  std::string pending;
+  char buffer[4096];
+  for (;;) {
+    const ssize_t n = read(socketFd,buffer,sizeof(buffer));
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n <= 0)
+      break;
+    pending.append(buffer,n);
+    std::string::size_type lineEnd;
+    while ((lineEnd = pending.find('\n')) != std::string::npos) {
+      const std::string line = pending.substr(0,lineEnd);
+      pending.erase(0,lineEnd + 1);
+      std::cout << line << "\n";
+      const std::string exitPrefix = kDaemonLinePrefix + "EXIT ";
+      if (line.compare(0,exitPrefix.size(),exitPrefix) == 0) {
+        exitCode = std::atoi(line.c_str() + exitPrefix.size());
+        exited = true;
+      }
+    }
+  }
+  std::cout << pending << std::flush;
+  close(socketFd);
+  if (!exited) {
+    std::cout << "[ERROR] The daemon closed the connection before the job ended!" << std::endl;
+    return -1;
+  }
+  return exitCode;
+}
+
+#endif
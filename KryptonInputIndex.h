@@ -0,0 +1,86 @@
+/**
+  \file
+  Index of the sector trees in the input files. With it the input can be
+  processed sector by sector: one sector tree in all files that have it,
+  before the next sector, so only that sector's histograms are filled at
+  a time. Building the index reads the key lists and tree headers of the
+  files, not their baskets.
+
+  \author B. Rumberger
+  \version $Id:    $
+  \date 17 October 2026
+*/
+
+#ifndef _KryptonInputIndex_h_
+#define _KryptonInputIndex_h_
+
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <TFile.h>
+#include <TKey.h>
+#include <TTree.h>
+
+#include "KryptonValidation.h"
+
+/// One sector tree ([TPCName]Sector[SectorId]Clusters) in the input files.
+struct InputSector {
+  std::string fTreeName;
+  std::string fTPCName;
+  unsigned int fSectorId = 0;
+  /// Indices of the files with entries in the tree, ascending.
+  std::vector<unsigned int> fFiles;
+  /// Entries of the tree in all files.
+  Long64_t fEntries = 0;
+};
+
+/// Sector trees with entries in the given files, in tree name order.
+/// Only the highest cycle of each tree is counted, as in the fill. Files
+/// that cannot be opened and trees with a non-numeric sector id are left
+/// out.
+inline std::vector<InputSector> BuildInputIndex(const std::vector<std::string>& filenames)
+{
+  std::map<std::string, InputSector> sectors;
+  for (unsigned int fileIndex = 0; fileIndex < filenames.size(); ++fileIndex) {
+    TFile file(filenames[fileIndex].c_str(),"READ");
+    if (file.IsZombie())
+      continue;
+    TIter keyIter(file.GetListOfKeys());
+    TKey* key;
+    while ((key = (TKey*)keyIter())) {
+      if (std::string(key->GetClassName()) != "TTree")
+        continue;
+      const std::string treeName = key->GetName();
+      std::string tpcName;
+      unsigned int sectorId;
+      if (!ParseSectorTreeName(treeName,tpcName,sectorId))
+        continue;
+      const TKey* latestKey = file.GetKey(treeName.c_str());
+      if (latestKey != nullptr && latestKey->GetCycle() != key->GetCycle())
+        continue;
+      std::unique_ptr<TObject> object(key->ReadObj());
+      const TTree* tree = dynamic_cast<const TTree*>(object.get());
+      if (tree == nullptr || tree->GetEntries() == 0)
+        continue;
+
+      InputSector& sector = sectors[treeName];
+      if (sector.fTreeName.empty()) {
+        sector.fTreeName = treeName;
+        sector.fTPCName = tpcName;
+        sector.fSectorId = sectorId;
+      }
+      if (sector.fFiles.empty() || sector.fFiles.back() != fileIndex)
+        sector.fFiles.push_back(fileIndex);
+      sector.fEntries += tree->GetEntries();
+    }
+  }
+
+  std::vector<InputSector> index;
+  for (auto it = sectors.begin(), itEnd = sectors.end(); it != itEnd; ++it)
+    index.push_back(it->second);
+  return index;
+}
+
+#endif
@@ -0,0 +1,1179 @@
+/**
+  \file
+  Hot-path kernels of the Krypton analysis, shared by KryptonAnalyzer
+  and KryptonBenchmark: decoding of cluster blocks from the sector
+  trees, cluster cuts and histogram filling, the peak and
+  half-maximum search over pad spectra, and the Gaussian and Fermi
+  pad fits.
+
+  \author B. Rumberger
+  \version $Id:    $
+  \date 17 October 2026
+*/
+
+#ifndef _KryptonKernels_h_
+#define _KryptonKernels_h_
+
+#include <algorithm>
+#include <cmath>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include <TDirectory.h>
+#include <TF1.h>
+#include <TH1D.h>
+#include <TH2D.h>
+#include <TTree.h>
+
+#include "KryptonPadGains.h"
+
+//Typedefs and containers for holding histograms. The maps own the pad
+//spectra: a bank is freed with its map.
+typedef std::unordered_map<unsigned int, std::unique_ptr<TH1D> > PadHistograms;
+typedef std::unordered_map<unsigned int, PadHistograms> PadrowHistograms;
+typedef std::unordered_map<unsigned int, PadrowHistograms> SectorHistograms;
+typedef std::unordered_map<unsigned int, SectorHistograms> DetectorHistograms;
+
+//Post-cut cluster charges per pad, before any gain is applied.
+typedef std::unordered_map<unsigned int, std::vector<float> > PadCharges;
+typedef std::unordered_map<unsigned int, PadCharges> PadrowCharges;
+typedef std::unordered_map<unsigned int, PadrowCharges> SectorCharges;
+typedef std::unordered_map<unsigned int, SectorCharges> DetectorCharges;
+
+//Number of clusters decoded from a tree before filling.
+const unsigned int kClusterBlockSize = 4096;
+
+/// Block of clusters decoded from one sector tree.
+struct ClusterBlock {
+  //Branch buffers for the current entry.
+  Float16_t fEntryCharge = 0;
+  UShort_t fEntryMaxADC = 0;
+  UShort_t fEntryTimeSlice = 0;
+  UShort_t fEntryNPixels = 0;
+  UChar_t fEntryNTimeSlices = 0;
+  UChar_t fEntryNPads = 0;
+  UChar_t fEntryPadrow = 0;
+  UChar_t fEntryPad = 0;
+
+  //Decoded clusters.
+  unsigned int fSize = 0;
+  std::vector<Float16_t> fCharge;
+  std::vector<UShort_t> fMaxADC;
+  std::vector<UShort_t> fTimeSlice;
+  std::vector<UShort_t> fNPixels;
+  std::vector<UChar_t> fNTimeSlices;
+  std::vector<UChar_t> fNPads;
+  std::vector<UChar_t> fPadrow;
+  std::vector<UChar_t> fPad;
+
+  void SetBranchAddresses(TTree& tree)
+  {
+    tree.SetBranchAddress("fCharge",&fEntryCharge);
+    tree.SetBranchAddress("fMaxADC",&fEntryMaxADC);
+    tree.SetBranchAddress("fTimeSlice",&fEntryTimeSlice);
+    tree.SetBranchAddress("fNPixels",&fEntryNPixels);
+    tree.SetBranchAddress("fNTimeSlices",&fEntryNTimeSlices);
+    tree.SetBranchAddress("fNPads",&fEntryNPads);
+    tree.SetBranchAddress("fPadrow",&fEntryPadrow);
+    tree.SetBranchAddress("fPad",&fEntryPad);
+  }
+
+  void Resize(const unsigned int size)
+  {
+    fSize = size;
+    fCharge.resize(size);
+    fMaxADC.resize(size);
+    fTimeSlice.resize(size);
+    fNPixels.resize(size);
+    fNTimeSlices.resize(size);
+    fNPads.resize(size);
+    fPadrow.resize(size);
+    fPad.resize(size);
+  }
+
+  /// Decode entries [first, last) of tree. Branch addresses must be set.
+  void Read(TTree& tree, const Long64_t first, const Long64_t last)
+  {
+    Resize(last - first);
+    for (Long64_t entry = first; entry < last; ++entry) {
+      tree.GetEntry(entry);
+      const unsigned int i = entry - first;
+      fCharge[i] = fEntryCharge;
+      fMaxADC[i] = fEntryMaxADC;
+      fTimeSlice[i] = fEntryTimeSlice;
+      fNPixels[i] = fEntryNPixels;
+      fNTimeSlices[i] = fEntryNTimeSlices;
+      fNPads[i] = fEntryNPads;
+      fPadrow[i] = fEntryPadrow;
+      fPad[i] = fEntryPad;
+    }
+  }
+
+  /// Exchange the decoded clusters with another block.
+  void Swap(ClusterBlock& other)
+  {
+    std::swap(fSize,other.fSize);
+    fCharge.swap(other.fCharge);
+    fMaxADC.swap(other.fMaxADC);
+    fTimeSlice.swap(other.fTimeSlice);
+    fNPixels.swap(other.fNPixels);
+    fNTimeSlices.swap(other.fNTimeSlices);
+    fNPads.swap(other.fNPads);
+    fPadrow.swap(other.fPadrow);
+    fPad.swap(other.fPad);
+  }
+};
+
+/// Sort a block by (padrow, pad), so that the clusters of a pad are filled
+/// in one run. Stable LSD radix sort with one counting pass per key byte
+/// (pad, then padrow) through the scratch block; the clusters of each pad
+/// keep their order, so per-pad results do not change.
+inline void SortClusterBlockByPad(ClusterBlock& block, ClusterBlock& scratch)
+{
+  for (unsigned int pass = 0; pass < 2; ++pass) {
+    const std::vector<UChar_t>& keys = (pass == 0) ? block.fPad : block.fPadrow;
+    unsigned int offsets[256] = {0};
+    for (unsigned int i = 0; i < block.fSize; ++i)
+      ++offsets[keys[i]];
+    //A pass over a single key value keeps the order: skip it.
+    if (block.fSize == 0 || offsets[keys[0]] == block.fSize)
+      continue;
+    unsigned int offset = 0;
+    for (unsigned int key = 0; key < 256; ++key) {
+      const unsigned int count = offsets[key];
+      offsets[key] = offset;
+      offset += count;
+    }
+
+    scratch.Resize(block.fSize);
+    for (unsigned int i = 0; i < block.fSize; ++i) {
+      const unsigned int j = offsets[keys[i]]++;
+      scratch.fCharge[j] = block.fCharge[i];
+      scratch.fMaxADC[j] = block.fMaxADC[i];
+      scratch.fTimeSlice[j] = block.fTimeSlice[i];
+      scratch.fNPixels[j] = block.fNPixels[i];
+      scratch.fNTimeSlices[j] = block.fNTimeSlices[i];
+      scratch.fNPads[j] = block.fNPads[i];
+      scratch.fPadrow[j] = block.fPadrow[i];
+      scratch.fPad[j] = block.fPad[i];
+    }
+    block.Swap(scratch);
+  }
+}
+
+/// Cluster cuts against noise.
+struct ClusterCuts {
+  unsigned int fMinPads = 0;
+  unsigned int fMaxPads = 0;
+  unsigned int fMinTimeSliceNumber = 0;
+  unsigned int fMinTimeSlices = 0;
+  unsigned int fMaxTimeSlices = 0;
+  double fMaxADCCut = 0;
+  double fChargeCut = 0;
+};
+
+/// Set a cut by its config file name. Returns false for unknown names.
+inline bool SetClusterCut(ClusterCuts& cuts, const std::string& name, const double value)
+{
+  if (name == "minPads")
+    cuts.fMinPads = value;
+  else if (name == "maxPads")
+    cuts.fMaxPads = value;
+  else if (name == "minTimeSliceNumber")
+    cuts.fMinTimeSliceNumber = value;
+  else if (name == "minTimeSlices")
+    cuts.fMinTimeSlices = value;
+  else if (name == "maxTimeSlices")
+    cuts.fMaxTimeSlices = value;
+  else if (name == "maxADCCut")
+    cuts.fMaxADCCut = value;
+  else if (name == "chargeCut")
+    cuts.fChargeCut = value;
+  else
+    return false;
+  return true;
+}
+
+/// Alternative cut set, filling its own pad spectra from the same blocks.
+struct CutSetBank {
+  std::string fName;
+  ClusterCuts fCuts;
+  DetectorHistograms* fSpectra = nullptr;
+};
+
+inline bool PassesClusterCuts(const ClusterCuts& cuts,
+                              const double charge,
+                              const unsigned int maxADC,
+                              const unsigned int timeSlice,
+                              const unsigned int nPads,
+                              const unsigned int nTimeSlices)
+{
+  //Ignore zero charge bins.
+  if (charge == 0)
+    return false;
+  if (nPads < cuts.fMinPads)
+    return false;
+  if (nPads > cuts.fMaxPads)
+    return false;
+  if (nTimeSlices < cuts.fMinTimeSlices)
+    return false;
+  if (nTimeSlices > cuts.fMaxTimeSlices)
+    return false;
+  if (timeSlice < cuts.fMinTimeSliceNumber)
+    return false;
+  if (charge < cuts.fChargeCut && maxADC < cuts.fMaxADCCut)
+    return false;
+  return true;
+}
+
+/// Sector QA histograms, owned. First histogram: No cuts. Second histogram: With cuts.
+struct SectorQAHistograms {
+  std::pair<std::unique_ptr<TH1D>,std::unique_ptr<TH1D> > fSpectra;
+  std::pair<std::unique_ptr<TH2D>,std::unique_ptr<TH2D> > fPadEntries;
+  std::pair<std::unique_ptr<TH1D>,std::unique_ptr<TH1D> > fTimeSlices;
+  std::pair<std::unique_ptr<TH2D>,std::unique_ptr<TH2D> > fChargeVsMaxADC;
+  std::pair<std::unique_ptr<TH2D>,std::unique_ptr<TH2D> > fNPadsVsNTimeSlices;
+};
+typedef std::unordered_map<int, std::unordered_map<int, SectorQAHistograms> > DetectorQAHistograms;
+
+/// Book QA histograms of one sector.
+inline SectorQAHistograms BookSectorQAHistograms(const TString& nameString,
+                                                 const TString& titleString,
+                                                 const unsigned int nPadrows,
+                                                 const unsigned int nPads,
+                                                 const double histogramMax,
+                                                 const unsigned int histogramBins,
+                                                 const unsigned int maxPads,
+                                                 const unsigned int maxTimeSlices)
+{
+  SectorQAHistograms qa;
+  qa.fSpectra.first.reset(
+    new TH1D(Form("ChargeNoCuts%s",nameString.Data()),
+             Form("%s Krypton Cluster Charges (No cuts);"
+                  "Cluster Charge [ADC];Entries",
+                  titleString.Data()),
+             2*histogramBins,0,histogramMax));
+  qa.fSpectra.second.reset(
+    new TH1D(Form("ChargeAllCuts%s",nameString.Data()),
+             Form("%s Krypton Cluster Charges (All cuts Applied);"
+                  "Cluster Charge [ADC];Entries",
+                  titleString.Data()),
+             2*histogramBins,0,histogramMax));
+
+  qa.fPadEntries.first.reset(
+    new TH2D(Form("padEntriesNoCuts%s",nameString.Data()),
+             Form("%s Entries Per Pad (No cuts);Pad Number;Padrow Number",
+                  titleString.Data()),
+             nPads+2,0,nPads+2,
+             nPadrows+2,0,nPadrows+2));
+  qa.fPadEntries.second.reset(
+    new TH2D(Form("padEntriesAllCuts%s",nameString.Data()),
+             Form("%s Entries Per Pad (All cuts Applied);Pad Number;Padrow Number",
+                  titleString.Data()),
+             nPads+2,0,nPads+2,
+             nPadrows+2,0,nPadrows+2));
+
+  qa.fTimeSlices.first.reset(
+    new TH1D(Form("timeSlicesNoCuts%s",nameString.Data()),
+             Form("%s Time Slices (No cuts);Time Slice;Entries",
+                  titleString.Data()),
+             260,0,260));
+  qa.fTimeSlices.second.reset(
+    new TH1D(Form("timeSlicesAllCuts%s",nameString.Data()),
+             Form("%s Time Slices (All cuts Applied);Time Slice;Entries",
+                  titleString.Data()),
+             260,0,260));
+
+  qa.fChargeVsMaxADC.first.reset(
+    new TH2D(Form("chargeVsMaxADCNoCuts%s",nameString.Data()),
+             Form("%s Charge vs. MaxADC (No cuts);Charge [ADC];MaxADC [ADC]",
+                  titleString.Data()),
+             histogramMax*2,0,histogramMax*2,
+             512,0,512));
+  qa.fChargeVsMaxADC.second.reset(
+    new TH2D(Form("chargeVsMaxADCAllCuts%s",nameString.Data()),
+             Form("%s Charge vs. MaxADC (All cuts Applied);Charge [ADC];MaxADC [ADC]",
+                  titleString.Data()),
+             histogramMax*2,0,histogramMax*2,
+             512,0,512));
+
+  qa.fNPadsVsNTimeSlices.first.reset(
+    new TH2D(Form("nPadsVsNTimeSlicesNoCuts%s",nameString.Data()),
+             Form("%s nPads vs. nTimeSlices (No cuts);nPads;nTimeSlices",
+                  titleString.Data()),
+             maxPads*5,0,maxPads*5,
+             maxTimeSlices*5,0,maxTimeSlices*5));
+  qa.fNPadsVsNTimeSlices.second.reset(
+    new TH2D(Form("nPadsVsNTimeSlicesAllCuts%s",nameString.Data()),
+             Form("%s nPads vs. nTimeSlices (All cuts Applied);nPads;nTimeSlices",
+                  titleString.Data()),
+             maxPads*5,0,maxPads*5,
+             maxTimeSlices*5,0,maxTimeSlices*5));
+  return qa;
+}
+
+/// Add the contents of source to target, histogram by histogram.
+inline void AddSectorQAHistograms(SectorQAHistograms& target,
+                                  const SectorQAHistograms& source)
+{
+  target.fSpectra.first->Add(source.fSpectra.first.get());
+  target.fSpectra.second->Add(source.fSpectra.second.get());
+  target.fPadEntries.first->Add(source.fPadEntries.first.get());
+  target.fPadEntries.second->Add(source.fPadEntries.second.get());
+  target.fTimeSlices.first->Add(source.fTimeSlices.first.get());
+  target.fTimeSlices.second->Add(source.fTimeSlices.second.get());
+  target.fChargeVsMaxADC.first->Add(source.fChargeVsMaxADC.first.get());
+  target.fChargeVsMaxADC.second->Add(source.fChargeVsMaxADC.second.get());
+  target.fNPadsVsNTimeSlices.first->Add(source.fNPadsVsNTimeSlices.first.get());
+  target.fNPadsVsNTimeSlices.second->Add(source.fNPadsVsNTimeSlices.second.get());
+}
+
+/// Write the QA histograms of one sector to the current directory.
+inline void WriteSectorQAHistograms(const SectorQAHistograms& qa)
+{
+  qa.fSpectra.first->Write();
+  qa.fSpectra.second->Write();
+  qa.fPadEntries.first->Write();
+  qa.fPadEntries.second->Write();
+  qa.fTimeSlices.first->Write();
+  qa.fTimeSlices.second->Write();
+  qa.fChargeVsMaxADC.first->Write();
+  qa.fChargeVsMaxADC.second->Write();
+  qa.fNPadsVsNTimeSlices.first->Write();
+  qa.fNPadsVsNTimeSlices.second->Write();
+}
+
+/// Read the QA histograms of one sector written by WriteSectorQAHistograms.
+/// Returns false, with nothing read, if any is missing.
+inline bool ReadSectorQAHistograms(TDirectory& directory,
+                                   const TString& nameString,
+                                   SectorQAHistograms& qa)
+{
+  SectorQAHistograms stored;
+  stored.fSpectra.first.reset(directory.Get<TH1D>(Form("ChargeNoCuts%s",nameString.Data())));
+  stored.fSpectra.second.reset(directory.Get<TH1D>(Form("ChargeAllCuts%s",nameString.Data())));
+  stored.fPadEntries.first.reset(directory.Get<TH2D>(Form("padEntriesNoCuts%s",nameString.Data())));
+  stored.fPadEntries.second.reset(directory.Get<TH2D>(Form("padEntriesAllCuts%s",nameString.Data())));
+  stored.fTimeSlices.first.reset(directory.Get<TH1D>(Form("timeSlicesNoCuts%s",nameString.Data())));
+  stored.fTimeSlices.second.reset(directory.Get<TH1D>(Form("timeSlicesAllCuts%s",nameString.Data())));
+  stored.fChargeVsMaxADC.first.reset(
+    directory.Get<TH2D>(Form("chargeVsMaxADCNoCuts%s",nameString.Data())));
+  stored.fChargeVsMaxADC.second.reset(
+    directory.Get<TH2D>(Form("chargeVsMaxADCAllCuts%s",nameString.Data())));
+  stored.fNPadsVsNTimeSlices.first.reset(
+    directory.Get<TH2D>(Form("nPadsVsNTimeSlicesNoCuts%s",nameString.Data())));
+  stored.fNPadsVsNTimeSlices.second.reset(
+    directory.Get<TH2D>(Form("nPadsVsNTimeSlicesAllCuts%s",nameString.Data())));
+  if (stored.fSpectra.first == nullptr || stored.fSpectra.second == nullptr ||
+      stored.fPadEntries.first == nullptr || stored.fPadEntries.second == nullptr ||
+      stored.fTimeSlices.first == nullptr || stored.fTimeSlices.second == nullptr ||
+      stored.fChargeVsMaxADC.first == nullptr || stored.fChargeVsMaxADC.second == nullptr ||
+      stored.fNPadsVsNTimeSlices.first == nullptr || stored.fNPadsVsNTimeSlices.second == nullptr)
+    return false;
+  qa = std::move(stored);
+  return true;
+}
+
+/// Book empty copies of all pad spectra, e.g. as a worker thread's fill bank.
+inline DetectorHistograms CloneHistograms(const DetectorHistograms& histograms)
+{
+  DetectorHistograms clones;
+  for (auto tpcIt = histograms.begin(), tpcEnd = histograms.end(); tpcIt != tpcEnd; ++tpcIt)
+    for (auto sectorIt = tpcIt->second.begin(), sectorEnd = tpcIt->second.end();
+         sectorIt != sectorEnd; ++sectorIt)
+      for (auto padrowIt = sectorIt->second.begin(), padrowEnd = sectorIt->second.end();
+           padrowIt != padrowEnd; ++padrowIt)
+        for (auto padIt = padrowIt->second.begin(), padEnd = padrowIt->second.end();
+             padIt != padEnd; ++padIt) {
+          TH1D* clone = (TH1D*)padIt->second->Clone();
+          clone->Reset();
+          clones[tpcIt->first][sectorIt->first][padrowIt->first][padIt->first].reset(clone);
+        }
+  return clones;
+}
+
+/// Add all pad spectra of source to the matching spectra of target.
+inline void AddHistograms(DetectorHistograms& target, const DetectorHistograms& source)
+{
+  for (auto tpcIt = source.begin(), tpcEnd = source.end(); tpcIt != tpcEnd; ++tpcIt)
+    for (auto sectorIt = tpcIt->second.begin(), sectorEnd = tpcIt->second.end();
+         sectorIt != sectorEnd; ++sectorIt)
+      for (auto padrowIt = sectorIt->second.begin(), padrowEnd = sectorIt->second.end();
+           padrowIt != padrowEnd; ++padrowIt)
+        for (auto padIt = padrowIt->second.begin(), padEnd = padrowIt->second.end();
+             padIt != padEnd; ++padIt)
+          target[tpcIt->first][sectorIt->first][padrowIt->first][padIt->first]->Add(padIt->second.get());
+}
+
+/// Add all pad spectra of source to target, and free the source histograms.
+inline void MergeHistograms(DetectorHistograms& target, DetectorHistograms& source)
+{
+  AddHistograms(target,source);
+  source.clear();
+}
+
+/// Empty uncorrected copies of the pad spectra with bins fineBinFactor
+/// times narrower, and a range extended by rangeScale so that charges
+/// scaled by gains down to 1/rangeScale still reach the end of the range.
+inline DetectorHistograms BookFineHistograms(const DetectorHistograms& histograms,
+                                             const unsigned int fineBinFactor,
+                                             const double rangeScale)
+{
+  DetectorHistograms fine;
+  for (auto tpcIt = histograms.begin(), tpcEnd = histograms.end(); tpcIt != tpcEnd; ++tpcIt)
+    for (auto sectorIt = tpcIt->second.begin(), sectorEnd = tpcIt->second.end();
+         sectorIt != sectorEnd; ++sectorIt)
+      for (auto padrowIt = sectorIt->second.begin(), padrowEnd = sectorIt->second.end();
+           padrowIt != padrowEnd; ++padrowIt)
+        for (auto padIt = padrowIt->second.begin(), padEnd = padrowIt->second.end();
+             padIt != padEnd; ++padIt) {
+          const TH1D& histogram = *padIt->second;
+          const TAxis& axis = *histogram.GetXaxis();
+          const unsigned int nBins =
+            (unsigned int)std::ceil(axis.GetNbins()*fineBinFactor*rangeScale);
+          const double xMin = axis.GetXmin();
+          const double xMax = xMin + nBins*axis.GetBinWidth(1)/fineBinFactor;
+          fine[tpcIt->first][sectorIt->first][padrowIt->first][padIt->first].reset(
+            new TH1D(TString(histogram.GetName()) + "Fine",histogram.GetTitle(),nBins,xMin,xMax));
+        }
+  return fine;
+}
+
+/// Add an uncorrected spectrum to target with its charges scaled by gain.
+/// Each source bin [a,b] becomes [gain*a,gain*b], and its content is split
+/// over the target bins by overlap, as if uniform within the source bin.
+/// Equivalent to filling target with gain*charge up to the source binning.
+inline void RemapSpectrum(const TH1D& source, const double gain, TH1D& target)
+{
+  const TAxis& sourceAxis = *source.GetXaxis();
+  const TAxis& targetAxis = *target.GetXaxis();
+  const int nSourceBins = sourceAxis.GetNbins();
+  const int nTargetBins = targetAxis.GetNbins();
+  const double targetMin = targetAxis.GetXmin();
+  const double targetMax = targetAxis.GetXmax();
+  const double targetWidth = (targetMax - targetMin)/nTargetBins;
+  const double entries = target.GetEntries() + source.GetEntries();
+
+  //Non-positive gains send all charges below the range, as per-entry scaling does.
+  if (gain <= 0) {
+    double content = 0;
+    for (int i = 0; i <= nSourceBins + 1; ++i)
+      content += source.GetBinContent(i);
+    target.AddBinContent(0,content);
+    target.ResetStats();
+    target.SetEntries(entries);
+    return;
+  }
+
+  target.AddBinContent(0,source.GetBinContent(0));
+  target.AddBinContent(nTargetBins + 1,source.GetBinContent(nSourceBins + 1));
+  for (int i = 1; i <= nSourceBins; ++i) {
+    const double content = source.GetBinContent(i);
+    if (content == 0)
+      continue;
+    const double low = gain*sourceAxis.GetBinLowEdge(i);
+    const double high = gain*sourceAxis.GetBinUpEdge(i);
+    if (high <= targetMin) {
+      target.AddBinContent(0,content);
+      continue;
+    }
+    if (low >= targetMax) {
+      target.AddBinContent(nTargetBins + 1,content);
+      continue;
+    }
+    const double density = content/(high - low);
+    if (low < targetMin)
+      target.AddBinContent(0,density*(targetMin - low));
+    if (high > targetMax)
+      target.AddBinContent(nTargetBins + 1,density*(high - targetMax));
+    const int firstBin = std::max(1,(int)((low - targetMin)/targetWidth) + 1);
+    const int lastBin = std::min(nTargetBins,(int)((high - targetMin)/targetWidth) + 1);
+    for (int j = firstBin; j <= lastBin; ++j) {
+      const double binLow = targetMin + (j - 1)*targetWidth;
+      const double overlap = std::min(high,binLow + targetWidth) - std::max(low,binLow);
+      if (overlap > 0)
+        target.AddBinContent(j,density*overlap);
+    }
+  }
+  target.ResetStats();
+  target.SetEntries(entries);
+}
+
+/// Add the uncorrected spectra of source to the matching spectra of target,
+/// with the gains of each pad applied by remapping. Missing pads have unit gain.
+inline void RemapHistograms(DetectorHistograms& target,
+                            const DetectorHistograms& source,
+                            const DetectorGains& gains)
+{
+  for (auto tpcIt = source.begin(), tpcEnd = source.end(); tpcIt != tpcEnd; ++tpcIt)
+    for (auto sectorIt = tpcIt->second.begin(), sectorEnd = tpcIt->second.end();
+         sectorIt != sectorEnd; ++sectorIt)
+      for (auto padrowIt = sectorIt->second.begin(), padrowEnd = sectorIt->second.end();
+           padrowIt != padrowEnd; ++padrowIt)
+        for (auto padIt = padrowIt->second.begin(), padEnd = padrowIt->second.end();
+             padIt != padEnd; ++padIt) {
+          if (padIt->second->GetEntries() == 0)
+            continue;
+          const double gain = GetPadGain(gains,tpcIt->first,sectorIt->first,
+                                         padrowIt->first,padIt->first);
+          RemapSpectrum(*padIt->second,gain,
+                        *target[tpcIt->first][sectorIt->first][padrowIt->first][padIt->first]);
+        }
+}
+
+/// Move sector QA histograms of source into target. Sectors present in
+/// both are added. The source is left empty.
+inline void MergeQAHistograms(DetectorQAHistograms& target, DetectorQAHistograms& source)
+{
+  for (auto tpcIt = source.begin(), tpcEnd = source.end(); tpcIt != tpcEnd; ++tpcIt)
+    for (auto sectorIt = tpcIt->second.begin(), sectorEnd = tpcIt->second.end();
+         sectorIt != sectorEnd; ++sectorIt) {
+      std::unordered_map<int, SectorQAHistograms>& targetSectors = target[tpcIt->first];
+      auto targetIt = targetSectors.find(sectorIt->first);
+      if (targetIt == targetSectors.end())
+        targetSectors[sectorIt->first] = std::move(sectorIt->second);
+      else
+        AddSectorQAHistograms(targetIt->second,sectorIt->second);
+    }
+  source.clear();
+}
+
+/// Add one entry at x to a pad spectrum shared by several filling threads,
+/// with a relaxed atomic increment of the bin content. Only the bins are
+/// updated; FinishAtomicFill sets the statistics once all threads are done.
+/// The bin contents are updated in place with the GCC/Clang generic
+/// __atomic builtins on the double itself (no type punning), which needs
+/// lock-free 8-byte atomics and naturally aligned bins, as for the
+/// new[]-allocated TArrayD of a TH1D on x86-64 and AArch64.
+inline void AtomicFill(TH1D& histogram, const double x)
+{
+  static_assert(__atomic_always_lock_free(sizeof(double),0),
+                "AtomicFill needs lock-free atomics on double");
+  const int bin = histogram.GetXaxis()->FindFixBin(x);
+  double* content = histogram.GetArray() + bin;
+  double expected;
+  __atomic_load(content,&expected,__ATOMIC_RELAXED);
+  double desired;
+  do {
+    desired = expected + 1;
+  } while (!__atomic_compare_exchange(content,&expected,&desired,true,
+                                      __ATOMIC_RELAXED,__ATOMIC_RELAXED));
+}
+
+/// Spectrum of a pad, nullptr if none is booked. The maps are only looked
+/// up, never modified, so spectra shared by several threads can be found
+/// the same way as a thread's own.
+inline TH1D* GetPadSpectrum(const PadrowHistograms& padHistograms,
+                            const unsigned int padrow,
+                            const unsigned int pad)
+{
+  const auto padrowIt = padHistograms.find(padrow);
+  if (padrowIt == padHistograms.end())
+    return nullptr;
+  const auto padIt = padrowIt->second.find(pad);
+  return (padIt != padrowIt->second.end()) ? padIt->second.get() : nullptr;
+}
+
+/// Previous gain of a pad, 1 if there are none or the pad has none.
+inline double GetPreviousPadGain(const PadrowGains* previousGains,
+                                 const unsigned int padrow,
+                                 const unsigned int pad)
+{
+  if (previousGains == nullptr)
+    return 1;
+  const auto padrowIt = previousGains->find(padrow);
+  if (padrowIt == previousGains->end())
+    return 1;
+  const auto padIt = padrowIt->second.find(pad);
+  return (padIt != padrowIt->second.end()) ? padIt->second : 1;
+}
+
+/// Fill a pad spectrum, atomically if it is shared by several threads.
+/// Clusters of pads without a booked spectrum are skipped in both modes.
+inline void FillPadSpectrum(TH1D* padHistogram, const double charge, const bool atomicFill)
+{
+  if (padHistogram == nullptr)
+    return;
+  if (atomicFill)
+    AtomicFill(*padHistogram,charge);
+  else
+    padHistogram->Fill(charge);
+}
+
+/// Set entries and statistics of spectra filled with AtomicFill from
+/// their bin contents, as Fill would have.
+inline void FinishAtomicFill(DetectorHistograms& histograms)
+{
+  for (auto tpcIt = histograms.begin(), tpcEnd = histograms.end(); tpcIt != tpcEnd; ++tpcIt)
+    for (auto sectorIt = tpcIt->second.begin(), sectorEnd = tpcIt->second.end();
+         sectorIt != sectorEnd; ++sectorIt)
+      for (auto padrowIt = sectorIt->second.begin(), padrowEnd = sectorIt->second.end();
+           padrowIt != padrowEnd; ++padrowIt)
+        for (auto padIt = padrowIt->second.begin(), padEnd = padrowIt->second.end();
+             padIt != padEnd; ++padIt) {
+          TH1D& histogram = *padIt->second;
+          double entries = 0;
+          for (int bin = 0; bin <= histogram.GetNbinsX() + 1; ++bin)
+            entries += histogram.GetBinContent(bin);
+          histogram.ResetStats();
+          histogram.SetEntries(entries);
+        }
+}
+
+/// Apply cuts to a block of one sector's clusters and fill the pad
+/// spectra and sector QA. Charges are multiplied by the previous pad
+/// gains if given. With atomicFill the pad spectra are shared with other
+/// threads. Spectrum and gain are looked up once per run of clusters of
+/// the same pad (see SortClusterBlockByPad). Returns the number of
+/// clusters passing the cuts.
+inline unsigned int FillClusterBlock(const ClusterBlock& block,
+                                     const ClusterCuts& cuts,
+                                     PadrowHistograms& padHistograms,
+                                     SectorQAHistograms& qa,
+                                     const PadrowGains* previousGains = nullptr,
+                                     const bool atomicFill = false)
+{
+  unsigned int nPassed = 0;
+  unsigned int runKey = ~0u;
+  TH1D* padHistogram = nullptr;
+  double gain = 1;
+  for (unsigned int i = 0; i < block.fSize; ++i) {
+    const unsigned int pad = (unsigned int)block.fPad[i];
+    const unsigned int padrow = (unsigned int)block.fPadrow[i];
+    const unsigned int nPads = (unsigned int)block.fNPads[i];
+    const unsigned int nTimeSlices = (unsigned int)block.fNTimeSlices[i];
+    const UShort_t timeSlice = block.fTimeSlice[i];
+    const UShort_t maxADC = block.fMaxADC[i];
+    Float16_t charge = block.fCharge[i];
+
+    //Fill sector QA histograms (no cuts).
+    qa.fSpectra.first->Fill(charge);
+    qa.fPadEntries.first->Fill(pad,padrow);
+    qa.fTimeSlices.first->Fill(timeSlice);
+    qa.fChargeVsMaxADC.first->Fill(charge,maxADC);
+    qa.fNPadsVsNTimeSlices.first->Fill(nPads,nTimeSlices);
+
+    //Cluster cuts.
+    if (!PassesClusterCuts(cuts,charge,maxADC,timeSlice,nPads,nTimeSlices))
+      continue;
+
+    if ((padrow << 8 | pad) != runKey) {
+      runKey = padrow << 8 | pad;
+      padHistogram = GetPadSpectrum(padHistograms,padrow,pad);
+      gain = GetPreviousPadGain(previousGains,padrow,pad);
+    }
+    if (previousGains != nullptr)
+      charge *= gain;
+
+    //Fill pad histogram.
+    FillPadSpectrum(padHistogram,charge,atomicFill);
+    ++nPassed;
+
+    //Fill sector QA histograms (all cuts).
+    qa.fSpectra.second->Fill(charge);
+    qa.fPadEntries.second->Fill(pad,padrow);
+    qa.fTimeSlices.second->Fill(timeSlice);
+    qa.fChargeVsMaxADC.second->Fill(charge,maxADC);
+    qa.fNPadsVsNTimeSlices.second->Fill(nPads,nTimeSlices);
+  }
+  return nPassed;
+}
+
+/// Apply cuts to a block of one sector's clusters and fill the pad
+/// spectra only. Returns the number of clusters passing the cuts.
+inline unsigned int FillClusterBlockSpectra(const ClusterBlock& block,
+                                            const ClusterCuts& cuts,
+                                            PadrowHistograms& padHistograms,
+                                            const PadrowGains* previousGains = nullptr,
+                                            const bool atomicFill = false)
+{
+  unsigned int nPassed = 0;
+  unsigned int runKey = ~0u;
+  TH1D* padHistogram = nullptr;
+  double gain = 1;
+  for (unsigned int i = 0; i < block.fSize; ++i) {
+    const unsigned int pad = (unsigned int)block.fPad[i];
+    const unsigned int padrow = (unsigned int)block.fPadrow[i];
+    Float16_t charge = block.fCharge[i];
+    if (!PassesClusterCuts(cuts,charge,block.fMaxADC[i],block.fTimeSlice[i],
+                           block.fNPads[i],block.fNTimeSlices[i]))
+      continue;
+
+    if ((padrow << 8 | pad) != runKey) {
+      runKey = padrow << 8 | pad;
+      padHistogram = GetPadSpectrum(padHistograms,padrow,pad);
+      gain = GetPreviousPadGain(previousGains,padrow,pad);
+    }
+    if (previousGains != nullptr)
+      charge *= gain;
+
+    FillPadSpectrum(padHistogram,charge,atomicFill);
+    ++nPassed;
+  }
+  return nPassed;
+}
+
+/// Store the charges of a block's clusters passing the cuts, per pad.
+/// Pads without a booked spectrum are skipped, as in the fill.
+inline void StoreClusterCharges(const ClusterBlock& block,
+                                const ClusterCuts& cuts,
+                                const PadrowHistograms& padHistograms,
+                                PadrowCharges& charges)
+{
+  for (unsigned int i = 0; i < block.fSize; ++i) {
+    const Float16_t charge = block.fCharge[i];
+    if (!PassesClusterCuts(cuts,charge,block.fMaxADC[i],block.fTimeSlice[i],
+                           block.fNPads[i],block.fNTimeSlices[i]))
+      continue;
+    if (GetPadSpectrum(padHistograms,(unsigned int)block.fPadrow[i],(unsigned int)block.fPad[i]) ==
+        nullptr)
+      continue;
+    charges[(unsigned int)block.fPadrow[i]][(unsigned int)block.fPad[i]].push_back(charge);
+  }
+}
+
+/// Append the stored charges of source to target and clear source.
+inline void MergeClusterCharges(DetectorCharges& target, DetectorCharges& source)
+{
+  for (auto tpcIt = source.begin(), tpcEnd = source.end(); tpcIt != tpcEnd; ++tpcIt)
+    for (auto sectorIt = tpcIt->second.begin(), sectorEnd = tpcIt->second.end();
+         sectorIt != sectorEnd; ++sectorIt)
+      for (auto padrowIt = sectorIt->second.begin(), padrowEnd = sectorIt->second.end();
+           padrowIt != padrowEnd; ++padrowIt)
+        for (auto padIt = padrowIt->second.begin(), padEnd = padrowIt->second.end();
+             padIt != padEnd; ++padIt) {
+          std::vector<float>& targetCharges =
+            target[tpcIt->first][sectorIt->first][padrowIt->first][padIt->first];
+          targetCharges.insert(targetCharges.end(),padIt->second.begin(),padIt->second.end());
+        }
+  source.clear();
+}
+
+/// Running cluster counts of one pad, for flagging dead, hot and noisy
+/// channels during the fill.
+struct PadChannelStatistics {
+  unsigned long long fClusters = 0;
+  unsigned long long fPassed = 0;
+  unsigned long long fLowCharge = 0;
+  bool fExcluded = false;
+};
+typedef std::unordered_map<unsigned int, PadChannelStatistics> PadChannels;
+typedef std::unordered_map<unsigned int, PadChannels> PadrowChannels;
+typedef std::unordered_map<unsigned int, PadrowChannels> SectorChannels;
+typedef std::unordered_map<unsigned int, SectorChannels> DetectorChannels;
+
+/// Count all clusters of a block per pad, those passing the cuts, and
+/// those passing with a charge below lowChargeThreshold. The counts of a
+/// run of clusters of the same pad are added to the pad once per run.
+inline void AccumulateChannelStatistics(const ClusterBlock& block,
+                                        const ClusterCuts& cuts,
+                                        const double lowChargeThreshold,
+                                        PadrowChannels& channels)
+{
+  unsigned int runStart = 0;
+  unsigned int nPassed = 0;
+  unsigned int nLowCharge = 0;
+  for (unsigned int i = 0; i < block.fSize; ++i) {
+    const Float16_t charge = block.fCharge[i];
+    if (PassesClusterCuts(cuts,charge,block.fMaxADC[i],block.fTimeSlice[i],
+                          block.fNPads[i],block.fNTimeSlices[i])) {
+      ++nPassed;
+      if (charge < lowChargeThreshold)
+        ++nLowCharge;
+    }
+    if (i + 1 < block.fSize && block.fPadrow[i + 1] == block.fPadrow[i] &&
+        block.fPad[i + 1] == block.fPad[i])
+      continue;
+
+    PadChannelStatistics& statistics =
+      channels[(unsigned int)block.fPadrow[i]][(unsigned int)block.fPad[i]];
+    statistics.fClusters += i + 1 - runStart;
+    statistics.fPassed += nPassed;
+    statistics.fLowCharge += nLowCharge;
+    runStart = i + 1;
+    nPassed = 0;
+    nLowCharge = 0;
+  }
+}
+
+/// Number of excluded pads of a sector.
+inline unsigned int CountExcludedPads(const PadrowChannels& channels)
+{
+  unsigned int nExcluded = 0;
+  for (auto padrowIt = channels.begin(), padrowEnd = channels.end(); padrowIt != padrowEnd; ++padrowIt)
+    for (auto padIt = padrowIt->second.begin(), padEnd = padrowIt->second.end();
+         padIt != padEnd; ++padIt)
+      if (padIt->second.fExcluded)
+        ++nExcluded;
+  return nExcluded;
+}
+
+/// Whether a pad is excluded. Pads without statistics are not.
+inline bool IsPadExcluded(const PadrowChannels& channels,
+                          const unsigned int padrow,
+                          const unsigned int pad)
+{
+  const auto padrowIt = channels.find(padrow);
+  if (padrowIt == channels.end())
+    return false;
+  const auto padIt = padrowIt->second.find(pad);
+  return padIt != padrowIt->second.end() && padIt->second.fExcluded;
+}
+
+/// Remove the clusters of excluded pads from a block, keeping the order.
+inline void RemoveExcludedPads(ClusterBlock& block, const PadrowChannels& channels)
+{
+  unsigned int nKept = 0;
+  for (unsigned int i = 0; i < block.fSize; ++i) {
+    if (IsPadExcluded(channels,(unsigned int)block.fPadrow[i],(unsigned int)block.fPad[i]))
+      continue;
+    if (nKept != i) {
+      block.fCharge[nKept] = block.fCharge[i];
+      block.fMaxADC[nKept] = block.fMaxADC[i];
+      block.fTimeSlice[nKept] = block.fTimeSlice[i];
+      block.fNPixels[nKept] = block.fNPixels[i];
+      block.fNTimeSlices[nKept] = block.fNTimeSlices[i];
+      block.fNPads[nKept] = block.fNPads[i];
+      block.fPadrow[nKept] = block.fPadrow[i];
+      block.fPad[nKept] = block.fPad[i];
+    }
+    ++nKept;
+  }
+  block.Resize(nKept);
+}
+
+/// Median cluster count of the pads of a sector that have clusters.
+inline double GetMedianPadClusters(const PadrowChannels& channels)
+{
+  std::vector<unsigned long long> counts;
+  for (auto padrowIt = channels.begin(), padrowEnd = channels.end(); padrowIt != padrowEnd; ++padrowIt)
+    for (auto padIt = padrowIt->second.begin(), padEnd = padrowIt->second.end();
+         padIt != padEnd; ++padIt)
+      if (padIt->second.fClusters > 0)
+        counts.push_back(padIt->second.fClusters);
+  if (counts.empty())
+    return 0;
+  std::nth_element(counts.begin(),counts.begin() + counts.size()/2,counts.end());
+  return counts[counts.size()/2];
+}
+
+/// Exclude pads of a sector with more than hotFactor times the median
+/// cluster count and at least minClusters clusters. Returns the number of
+/// newly excluded pads.
+inline unsigned int ExcludeHotPads(PadrowChannels& channels,
+                                   const double hotFactor,
+                                   const unsigned long long minClusters)
+{
+  const double medianClusters = GetMedianPadClusters(channels);
+  unsigned int nExcluded = 0;
+  for (auto padrowIt = channels.begin(), padrowEnd = channels.end(); padrowIt != padrowEnd; ++padrowIt)
+    for (auto padIt = padrowIt->second.begin(), padEnd = padrowIt->second.end();
+         padIt != padEnd; ++padIt) {
+      PadChannelStatistics& statistics = padIt->second;
+      if (statistics.fExcluded || statistics.fClusters < minClusters ||
+          statistics.fClusters <= hotFactor*medianClusters)
+        continue;
+      statistics.fExcluded = true;
+      ++nExcluded;
+    }
+  return nExcluded;
+}
+
+/// Add the channel statistics of source to target and clear source.
+/// Pads excluded in either are excluded.
+inline void MergeChannelStatistics(DetectorChannels& target, DetectorChannels& source)
+{
+  for (auto tpcIt = source.begin(), tpcEnd = source.end(); tpcIt != tpcEnd; ++tpcIt)
+    for (auto sectorIt = tpcIt->second.begin(), sectorEnd = tpcIt->second.end();
+         sectorIt != sectorEnd; ++sectorIt)
+      for (auto padrowIt = sectorIt->second.begin(), padrowEnd = sectorIt->second.end();
+           padrowIt != padrowEnd; ++padrowIt)
+        for (auto padIt = padrowIt->second.begin(), padEnd = padrowIt->second.end();
+             padIt != padEnd; ++padIt) {
+          PadChannelStatistics& statistics =
+            target[tpcIt->first][sectorIt->first][padrowIt->first][padIt->first];
+          statistics.fClusters += padIt->second.fClusters;
+          statistics.fPassed += padIt->second.fPassed;
+          statistics.fLowCharge += padIt->second.fLowCharge;
+          statistics.fExcluded = statistics.fExcluded || padIt->second.fExcluded;
+        }
+  source.clear();
+}
+
+//Time slice range of the drift profiles, as for the time slice QA.
+const unsigned int kMaxDriftTimeSlice = 260;
+
+/// Sums of cluster charges, after cuts and gains, in time slice (drift
+/// time) bins of one padrow.
+struct DriftProfile {
+  std::vector<double> fEntries;
+  std::vector<double> fChargeSums;
+  std::vector<double> fChargeSquareSums;
+
+  void Resize(const unsigned int nBins)
+  {
+    fEntries.resize(nBins,0);
+    fChargeSums.resize(nBins,0);
+    fChargeSquareSums.resize(nBins,0);
+  }
+
+  void Add(const DriftProfile& other)
+  {
+    Resize(other.fEntries.size());
+    for (unsigned int i = 0; i < other.fEntries.size(); ++i) {
+      fEntries[i] += other.fEntries[i];
+      fChargeSums[i] += other.fChargeSums[i];
+      fChargeSquareSums[i] += other.fChargeSquareSums[i];
+    }
+  }
+};
+typedef std::unordered_map<unsigned int, DriftProfile> PadrowDriftProfiles;
+typedef std::unordered_map<unsigned int, PadrowDriftProfiles> SectorDriftProfiles;
+typedef std::unordered_map<unsigned int, SectorDriftProfiles> DetectorDriftProfiles;
+
+/// Add the charges of a block's clusters passing the cuts to the drift
+/// profiles of their padrows. Returns the number of clusters added.
+inline unsigned int FillClusterBlockDrift(const ClusterBlock& block,
+                                          const ClusterCuts& cuts,
+                                          const unsigned int nBins,
+                                          PadrowDriftProfiles& profiles,
+                                          const PadrowGains* previousGains)
+{
+  unsigned int nPassed = 0;
+  for (unsigned int i = 0; i < block.fSize; ++i) {
+    Float16_t charge = block.fCharge[i];
+    const unsigned int timeSlice = block.fTimeSlice[i];
+    if (!PassesClusterCuts(cuts,charge,block.fMaxADC[i],timeSlice,
+                           block.fNPads[i],block.fNTimeSlices[i]))
+      continue;
+
+    const unsigned int padrow = block.fPadrow[i];
+    if (previousGains != nullptr) {
+      const auto padrowIt = previousGains->find(padrow);
+      if (padrowIt != previousGains->end()) {
+        const auto padIt = padrowIt->second.find((unsigned int)block.fPad[i]);
+        if (padIt != padrowIt->second.end())
+          charge *= padIt->second;
+      }
+    }
+
+    DriftProfile& profile = profiles[padrow];
+    if (profile.fEntries.empty())
+      profile.Resize(nBins);
+    const unsigned int bin = std::min(nBins - 1,timeSlice*nBins/kMaxDriftTimeSlice);
+    profile.fEntries[bin] += 1;
+    profile.fChargeSums[bin] += charge;
+    profile.fChargeSquareSums[bin] += (double)charge*charge;
+    ++nPassed;
+  }
+  return nPassed;
+}
+
+/// Add the drift profiles of source to target and clear source.
+inline void MergeDriftProfiles(DetectorDriftProfiles& target, DetectorDriftProfiles& source)
+{
+  for (auto tpcIt = source.begin(), tpcEnd = source.end(); tpcIt != tpcEnd; ++tpcIt)
+    for (auto sectorIt = tpcIt->second.begin(), sectorEnd = tpcIt->second.end();
+         sectorIt != sectorEnd; ++sectorIt)
+      for (auto padrowIt = sectorIt->second.begin(), padrowEnd = sectorIt->second.end();
+           padrowIt != padrowEnd; ++padrowIt)
+        target[tpcIt->first][sectorIt->first][padrowIt->first].Add(padrowIt->second);
+  source.clear();
+}
+
+/// Peak of a pad spectrum and the range where it drops by half.
+struct SpectrumPeak {
+  int fMaxBin = 0;
+  double fChargePeak = 0;
+  double fChargePeakValue = 0;
+  double fMinChargeForFit = 0;
+  double fMaxChargeForFit = 0;
+  double fMaxCharge = 0;
+};
+
+/// Search for the largest peak above minADCPeakSearch, and the points
+/// above and below it where the spectrum drops by a factor of 2.
+inline SpectrumPeak FindSpectrumPeak(const TH1D& padHistogram,
+                                     const double minADCPeakSearch)
+{
+  SpectrumPeak peak;
+  const int lastBin = padHistogram.GetXaxis()->GetNbins() - 1;
+  peak.fMaxCharge = padHistogram.GetXaxis()->GetBinCenter(lastBin);
+
+  //Search for peak above minimum acceptable Krypton peak value.
+  for (int i = 0; i < lastBin; ++i) {
+    const double binCenter = padHistogram.GetXaxis()->GetBinCenter(i);
+    if (binCenter < minADCPeakSearch)
+      continue;
+    const double value = padHistogram.GetBinContent(i);
+    if (value > peak.fChargePeakValue) {
+      peak.fMaxBin = i;
+      peak.fChargePeak = binCenter;
+      peak.fChargePeakValue = value;
+    }
+  }
+
+  //Find where peak drops by a factor of 2 above and below.
+  for (int bin = peak.fMaxBin; bin > 0; --bin) {
+    const double binContent = padHistogram.GetBinContent(bin);
+    if (binContent < 0.5*peak.fChargePeakValue) {
+      peak.fMinChargeForFit = padHistogram.GetXaxis()->GetBinCenter(bin);
+      break;
+    }
+  }
+  for (int bin = peak.fMaxBin; bin <= lastBin; ++bin) {
+    const double binContent = padHistogram.GetBinContent(bin);
+    if (binContent < 0.5*peak.fChargePeakValue) {
+      peak.fMaxChargeForFit = padHistogram.GetXaxis()->GetBinCenter(bin);
+      break;
+    }
+  }
+  return peak;
+}
+
+/// Result of the fit of one pad spectrum.
+struct PadFitResult {
+  bool fFitted = false;
+  int fStatus = -1;
+  double fEntries = 0;
+  double fSpectrumADC = 0;
+  double fSpectrumADCError = 0;
+  double fChi2 = 0;
+  int fNDF = 0;
+  double fParameters[3] = {0,0,0};
+  double fParErrors[3] = {0,0,0};
+};
+
+/// Fit pad spectrum with "Gaussian" (around the peak) or "Fermi" (on
+/// the falling edge). The spectrum ADC is the Gaussian mean or the
+/// Fermi edge position.
+inline PadFitResult FitPadSpectrum(TH1D& padHistogram,
+                                   const SpectrumPeak& peak,
+                                   const std::string& fitFunction)
+{
+  PadFitResult result;
+  result.fEntries = padHistogram.GetEntries();
+  if (fitFunction == "Gaussian") {
+    TF1 gausFit("gausFit","gaus",peak.fMinChargeForFit,peak.fMaxChargeForFit);
+    result.fStatus = padHistogram.Fit(&gausFit,"R Q");
+    result.fSpectrumADC = gausFit.GetParameter(1);
+    result.fSpectrumADCError = gausFit.GetParError(1);
+    result.fChi2 = gausFit.GetChisquare();
+    result.fNDF = gausFit.GetNDF();
+    for (int i = 0; i < 3; ++i) {
+      result.fParameters[i] = gausFit.GetParameter(i);
+      result.fParErrors[i] = gausFit.GetParError(i);
+    }
+    result.fFitted = true;
+  }
+  else if (fitFunction == "Fermi") {
+    TF1 fermiFit("fermiFit","[0]/(1+TMath::Exp([1]*(x-[2])))",
+                 peak.fChargePeak,peak.fMaxCharge);
+    fermiFit.FixParameter(0,peak.fChargePeakValue);
+    fermiFit.SetParameter(1,0.01);
+    fermiFit.SetParLimits(1,0.0001,1);
+    fermiFit.SetParameter(2,peak.fChargePeak);
+    result.fStatus = padHistogram.Fit(&fermiFit,"R Q");
+    result.fSpectrumADC = fermiFit.GetParameter(2);
+    result.fSpectrumADCError = fermiFit.GetParError(2);
+    result.fChi2 = fermiFit.GetChisquare();
+    result.fNDF = fermiFit.GetNDF();
+    for (int i = 0; i < 3; ++i) {
+      result.fParameters[i] = fermiFit.GetParameter(i);
+      result.fParErrors[i] = fermiFit.GetParError(i);
+    }
+    result.fFitted = true;
+  }
+  return result;
+}
+
+/// Pad results of one sector as columns, for a result tree with one entry
+/// per sector and arrays of fNPads pads per branch. The columns are sized
+/// for maxPads pads once, so the branch addresses stay valid.
+struct SectorResultColumns {
+  unsigned int fTPCId = 0;
+  unsigned int fSectorId = 0;
+  int fNPads = 0;
+  std::vector<unsigned int> fPadrowId;
+  std::vector<unsigned int> fPadId;
+  std::vector<double> fEntries;
+  std::vector<double> fSpectrumADC;
+  std::vector<double> fSpectrumADCError;
+  std::vector<double> fGain;
+  std::vector<double> fChi2;
+  std::vector<int> fNDF;
+  std::vector<int> fStatus;
+  std::vector<double> fParameters[3];
+  std::vector<double> fParErrors[3];
+
+  explicit SectorResultColumns(const unsigned int maxPads)
+    : fPadrowId(maxPads), fPadId(maxPads), fEntries(maxPads), fSpectrumADC(maxPads),
+      fSpectrumADCError(maxPads), fGain(maxPads), fChi2(maxPads), fNDF(maxPads),
+      fStatus(maxPads)
+  {
+    for (int i = 0; i < 3; ++i) {
+      fParameters[i].resize(maxPads);
+      fParErrors[i].resize(maxPads);
+    }
+  }
+
+  /// Create the tree in the current directory, with the columns as branches.
+  TTree* BookTree(const char* name, const char* title)
+  {
+    TTree* tree = new TTree(name,title);
+    tree->Branch("fTPCId",&fTPCId,"fTPCId/i");
+    tree->Branch("fSectorId",&fSectorId,"fSectorId/i");
+    tree->Branch("fNPads",&fNPads,"fNPads/I");
+    tree->Branch("fPadrowId",fPadrowId.data(),"fPadrowId[fNPads]/i");
+    tree->Branch("fPadId",fPadId.data(),"fPadId[fNPads]/i");
+    tree->Branch("fEntries",fEntries.data(),"fEntries[fNPads]/D");
+    tree->Branch("fSpectrumADC",fSpectrumADC.data(),"fSpectrumADC[fNPads]/D");
+    tree->Branch("fSpectrumADCError",fSpectrumADCError.data(),"fSpectrumADCError[fNPads]/D");
+    tree->Branch("fGain",fGain.data(),"fGain[fNPads]/D");
+    tree->Branch("fChi2",fChi2.data(),"fChi2[fNPads]/D");
+    tree->Branch("fNDF",fNDF.data(),"fNDF[fNPads]/I");
+    tree->Branch("fStatus",fStatus.data(),"fStatus[fNPads]/I");
+    for (int i = 0; i < 3; ++i) {
+      tree->Branch(Form("fParameter%i",i),fParameters[i].data(),Form("fParameter%i[fNPads]/D",i));
+      tree->Branch(Form("fParError%i",i),fParErrors[i].data(),Form("fParError%i[fNPads]/D",i));
+    }
+    return tree;
+  }
+
+  /// Start the columns of a sector.
+  void Clear(const unsigned int tpcId, const unsigned int sectorId)
+  {
+    fTPCId = tpcId;
+    fSectorId = sectorId;
+    fNPads = 0;
+  }
+
+  /// Append one pad. Pads beyond maxPads are dropped.
+  void Add(const unsigned int padrowId,
+           const unsigned int padId,
+           const double gain,
+           const PadFitResult& result)
+  {
+    if (fNPads == (int)fPadId.size())
+      return;
+    const int i = fNPads++;
+    fPadrowId[i] = padrowId;
+    fPadId[i] = padId;
+    fEntries[i] = result.fEntries;
+    fSpectrumADC[i] = result.fSpectrumADC;
+    fSpectrumADCError[i] = result.fSpectrumADCError;
+    fGain[i] = gain;
+    fChi2[i] = result.fChi2;
+    fNDF[i] = result.fNDF;
+    fStatus[i] = result.fFitted ? result.fStatus : -1;
+    for (int p = 0; p < 3; ++p) {
+      fParameters[p][i] = result.fParameters[p];
+      fParErrors[p][i] = result.fParErrors[p];
+    }
+  }
+};
+
+#endif
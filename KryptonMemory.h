@@ -0,0 +1,137 @@
+/**
+  \file
+  Memory accounting for the Krypton analysis: process resident set
+  size, estimates of histogram sizes from their bin counts, and a
+  per-container report (pad spectra, sector QA, results). The
+  estimates are used to check the memory budget before any
+  histograms are booked.
+
+  \author B. Rumberger
+  \version $Id:    $
+  \date 17 October 2026
+*/
+
+#ifndef _KryptonMemory_h_
+#define _KryptonMemory_h_
+
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <sys/resource.h>
+#include <unistd.h>
+
+#include <TH1D.h>
+#include <TH2D.h>
+
+/// Peak resident set size of the process so far [bytes].
+inline unsigned long long GetPeakRSS()
+{
+  rusage usage;
+  if (getrusage(RUSAGE_SELF,&usage) != 0)
+    return 0;
+  //ru_maxrss is given in kB on Linux.
+  return 1024ULL*usage.ru_maxrss;
+}
+
+/// Current resident set size of the process [bytes].
+inline unsigned long long GetCurrentRSS()
+{
+  std::ifstream statm("/proc/self/statm");
+  unsigned long long totalPages = 0;
+  unsigned long long residentPages = 0;
+  if (!(statm >> totalPages >> residentPages))
+    return 0;
+  return residentPages*sysconf(_SC_PAGESIZE);
+}
+
+/// Estimated heap size of a 1D histogram with nBins bins (+ under/overflow).
+inline unsigned long long EstimateTH1DBytes(const unsigned long long nBins)
+{
+  //Object itself, name and title, and one double per cell.
+  return sizeof(TH1D) + 128 + (nBins + 2)*sizeof(double);
+}
+
+/// Estimated heap size of a 2D histogram.
+inline unsigned long long EstimateTH2DBytes(const unsigned long long nBinsX,
+                                            const unsigned long long nBinsY)
+{
+  return sizeof(TH2D) + 128 + (nBinsX + 2)*(nBinsY + 2)*sizeof(double);
+}
+
+/// Estimated heap size of an existing histogram.
+inline unsigned long long EstimateHistogramBytes(const TH1& histogram)
+{
+  const unsigned long long objectBytes = histogram.InheritsFrom("TH2") ?
+    sizeof(TH2D) : sizeof(TH1D);
+  return objectBytes + 128 + histogram.GetNcells()*sizeof(double);
+}
+
+/// Byte counts of the main containers of the analysis.
+class MemoryReport {
+public:
+  void Add(const std::string& container,
+           const unsigned long long bytes,
+           const unsigned long long objects = 1)
+  {
+    if (fBytes.find(container) == fBytes.end())
+      fOrder.push_back(container);
+    fBytes[container] += bytes;
+    fObjects[container] += objects;
+  }
+
+  unsigned long long GetBytes(const std::string& container) const
+  {
+    auto it = fBytes.find(container);
+    return (it == fBytes.end()) ? 0 : it->second;
+  }
+
+  unsigned long long GetObjects(const std::string& container) const
+  {
+    auto it = fObjects.find(container);
+    return (it == fObjects.end()) ? 0 : it->second;
+  }
+
+  unsigned long long GetTotalBytes() const
+  {
+    unsigned long long total = 0;
+    for (auto it = fBytes.begin(), itEnd = fBytes.end(); it != itEnd; ++it)
+      total += it->second;
+    return total;
+  }
+
+  void Print(const std::string& title) const
+  {
+    std::cout << "[INFO] " << title << " (MB, objects):" << std::endl;
+    for (auto it = fOrder.begin(), itEnd = fOrder.end(); it != itEnd; ++it)
+      std::cout << "[INFO]   " << std::left << std::setw(24) << *it << std::right
+                << std::setw(12) << fBytes.at(*it)/1e6
+                << std::setw(12) << fObjects.at(*it) << std::endl;
+    std::cout << "[INFO]   " << std::left << std::setw(24) << "total" << std::right
+              << std::setw(12) << GetTotalBytes()/1e6 << std::endl;
+  }
+
+  /// JSON object with one entry per container.
+  std::string ToJSON() const
+  {
+    std::ostringstream json;
+    json << "{";
+    for (auto it = fOrder.begin(), itEnd = fOrder.end(); it != itEnd; ++it)
+      json << (it == fOrder.begin() ? "" : ", ")
+           << "\"" << *it << "\": {\"bytes\": " << fBytes.at(*it)
+           << ", \"objects\": " << fObjects.at(*it) << "}";
+    json << "}";
+    return json.str();
+  }
+
+private:
+  std::vector<std::string> fOrder;
+  std::map<std::string, unsigned long long> fBytes;
+  std::map<std::string, unsigned long long> fObjects;
+};
+
+#endif
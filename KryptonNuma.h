@@ -0,0 +1,96 @@
+/**
+  \file
+  NUMA placement of the filling threads. Nodes and their CPUs are read
+  from sysfs, so no NUMA library is needed. Workers are assigned to nodes
+  in contiguous blocks and pinned to the CPUs of their node; as each
+  worker also allocates its own histograms (first touch), its fills stay
+  in node-local memory.
+
+  \author B. Rumberger
+  \version $Id:    $
+  \date 17 October 2026
+*/
+
+#ifndef _KryptonNuma_h_
+#define _KryptonNuma_h_
+
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <pthread.h>
+#include <sched.h>
+
+/// Numbers of a sysfs list such as "0-7,16-23".
+inline std::vector<int> ParseSysfsList(const std::string& list)
+{
+  std::vector<int> numbers;
+  std::istringstream listStream(list);
+  std::string range;
+  while (std::getline(listStream,range,',')) {
+    const std::string::size_type dash = range.find('-');
+    try {
+      const int first = std::stoi(range.substr(0,dash));
+      const int last = (dash == std::string::npos) ? first : std::stoi(range.substr(dash + 1));
+      for (int number = first; number <= last; ++number)
+        numbers.push_back(number);
+    }
+    catch (...) {
+      return std::vector<int>();
+    }
+  }
+  return numbers;
+}
+
+/// CPUs of each online NUMA node that this process may run on. Nodes
+/// without such CPUs are left out. Empty if sysfs has no NUMA nodes.
+inline std::vector<std::vector<int> > GetNumaNodeCPUs()
+{
+  std::vector<std::vector<int> > nodes;
+  std::ifstream onlineFile("/sys/devices/system/node/online");
+  std::string onlineList;
+  if (!std::getline(onlineFile,onlineList))
+    return nodes;
+
+  cpu_set_t allowed;
+  CPU_ZERO(&allowed);
+  if (sched_getaffinity(0,sizeof(allowed),&allowed) != 0)
+    return nodes;
+  const std::vector<int> nodeIds = ParseSysfsList(onlineList);
+  for (auto nodeIt = nodeIds.begin(), nodeEnd = nodeIds.end(); nodeIt != nodeEnd; ++nodeIt) {
+    std::ifstream cpuFile("/sys/devices/system/node/node" + std::to_string(*nodeIt) + "/cpulist");
+    std::string cpuList;
+    if (!std::getline(cpuFile,cpuList))
+      continue;
+    std::vector<int> cpus;
+    const std::vector<int> nodeCPUs = ParseSysfsList(cpuList);
+    for (auto cpuIt = nodeCPUs.begin(), cpuEnd = nodeCPUs.end(); cpuIt != cpuEnd; ++cpuIt)
+      if (*cpuIt < CPU_SETSIZE && CPU_ISSET(*cpuIt,&allowed))
+        cpus.push_back(*cpuIt);
+    if (!cpus.empty())
+      nodes.push_back(cpus);
+  }
+  return nodes;
+}
+
+/// Node of a worker: contiguous blocks of workers per node, so that the
+/// workers of a node are neighbours in the (deterministic) merge order.
+inline unsigned int GetWorkerNumaNode(const unsigned int worker,
+                                      const unsigned int nWorkers,
+                                      const unsigned int nNodes)
+{
+  return (unsigned long long)worker*nNodes/nWorkers;
+}
+
+/// Pin the calling thread to the given CPUs. Returns false on failure.
+inline bool PinThreadToCPUs(const std::vector<int>& cpus)
+{
+  cpu_set_t cpuSet;
+  CPU_ZERO(&cpuSet);
+  for (auto it = cpus.begin(), itEnd = cpus.end(); it != itEnd; ++it)
+    CPU_SET(*it,&cpuSet);
+  return pthread_setaffinity_np(pthread_self(),sizeof(cpuSet),&cpuSet) == 0;
+}
+
+#endif
@@ -0,0 +1,136 @@
+/**
+  \file
+  Output compression and parallel output writing. The compression of the
+  output files is given as algorithm:level. A single ROOT file cannot be
+  written from several threads, so the many per-pad and per-sector objects
+  are distributed over shard files next to the main output, and each shard
+  is serialized, compressed and written by its own thread.
+
+  \author B. Rumberger
+  \version $Id:    $
+  \date 17 October 2026
+*/
+
+#ifndef _KryptonOutput_h_
+#define _KryptonOutput_h_
+
+#include <algorithm>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include <Compression.h>
+#include <TDirectory.h>
+#include <TFile.h>
+#include <TObject.h>
+
+/// Compression level used if only the algorithm is given.
+const int kDefaultCompressionLevel = 5;
+
+/// Compression setting of "algorithm:level" or "algorithm", with the
+/// algorithm zlib, lzma, lz4, zstd or none and the level in 1-9. Returns -1
+/// for an invalid setting.
+inline int ParseCompressionSetting(const std::string& setting)
+{
+  const std::string::size_type colon = setting.find(':');
+  const std::string algorithm = setting.substr(0,colon);
+  if (algorithm == "none")
+    return (colon == std::string::npos) ? 0 : -1;
+
+  int level = kDefaultCompressionLevel;
+  if (colon != std::string::npos) {
+    const std::string levelString = setting.substr(colon + 1);
+    if (levelString.size() != 1 || levelString[0] < '1' || levelString[0] > '9')
+      return -1;
+    level = levelString[0] - '0';
+  }
+
+  if (algorithm == "zlib")
+    return ROOT::CompressionSettings(ROOT::RCompressionSetting::EAlgorithm::kZLIB,level);
+  if (algorithm == "lzma")
+    return ROOT::CompressionSettings(ROOT::RCompressionSetting::EAlgorithm::kLZMA,level);
+  if (algorithm == "lz4")
+    return ROOT::CompressionSettings(ROOT::RCompressionSetting::EAlgorithm::kLZ4,level);
+  if (algorithm == "zstd")
+    return ROOT::CompressionSettings(ROOT::RCompressionSetting::EAlgorithm::kZSTD,level);
+  return -1;
+}
+
+/// Objects of one shard, with their key names. An empty name keeps the
+/// object name.
+typedef std::vector<std::pair<const TObject*, std::string> > OutputObjects;
+
+/// Filename of output shard k of the output outputBase.root.
+inline std::string GetOutputShardFilename(const std::string& outputBase, const unsigned int shard)
+{
+  return outputBase + "-Spectra" + std::to_string(shard) + ".root";
+}
+
+/// Assign items to nShards shards, heaviest first to the least loaded
+/// shard. Ties go to the lower item and shard index, so the assignment
+/// only depends on the weights.
+inline std::vector<unsigned int> BalanceShards(const std::vector<unsigned long long>& weights,
+                                               const unsigned int nShards)
+{
+  std::vector<unsigned int> order(weights.size());
+  for (unsigned int i = 0; i < order.size(); ++i)
+    order[i] = i;
+  std::stable_sort(order.begin(),order.end(),
+                   [&weights](const unsigned int a, const unsigned int b)
+                   { return weights[a] > weights[b]; });
+
+  std::vector<unsigned int> shards(weights.size(),0);
+  std::vector<unsigned long long> loads(nShards,0);
+  for (auto it = order.begin(), itEnd = order.end(); it != itEnd; ++it) {
+    const unsigned int shard = std::min_element(loads.begin(),loads.end()) - loads.begin();
+    shards[*it] = shard;
+    loads[shard] += weights[*it];
+  }
+  return shards;
+}
+
+/// Write each object list to its own shard file, one thread per shard, with
+/// the given compression setting (-1 for the ROOT default). ROOT thread
+/// safety must be enabled for more than one shard. Returns the bytes of all
+/// shard files, or -1 if a shard could not be created.
+inline Long64_t WriteOutputShards(const std::string& outputBase,
+                                  const std::vector<OutputObjects>& shardObjects,
+                                  const int compression)
+{
+  //A shard written on this thread must not stay the current directory.
+  TDirectory::TContext directoryContext;
+  std::vector<Long64_t> shardBytes(shardObjects.size(),-1);
+  auto writeShard = [&](const unsigned int shard) {
+    TFile file(GetOutputShardFilename(outputBase,shard).c_str(),"RECREATE");
+    if (file.IsZombie())
+      return;
+    if (compression >= 0)
+      file.SetCompressionSettings(compression);
+    const OutputObjects& objects = shardObjects[shard];
+    for (auto it = objects.begin(), itEnd = objects.end(); it != itEnd; ++it)
+      file.WriteTObject(it->first,it->second.empty() ? nullptr : it->second.c_str());
+    file.Close();
+    shardBytes[shard] = file.GetEND();
+  };
+
+  if (shardObjects.size() == 1)
+    writeShard(0);
+  else {
+    std::vector<std::thread> writers;
+    for (unsigned int shard = 0; shard < shardObjects.size(); ++shard)
+      writers.emplace_back(writeShard,shard);
+    for (auto it = writers.begin(), itEnd = writers.end(); it != itEnd; ++it)
+      it->join();
+  }
+
+  Long64_t totalBytes = 0;
+  for (auto it = shardBytes.begin(), itEnd = shardBytes.end(); it != itEnd; ++it) {
+    if (*it < 0)
+      return -1;
+    totalBytes += *it;
+  }
+  return totalBytes;
+}
+
+#endif
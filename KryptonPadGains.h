@@ -0,0 +1,302 @@
+/**
+  \file
+  In-memory pad gain tables and their file formats. Gains are read
+  either from the PadByPadGain XML written by KryptonAnalyzer or from
+  the compact binary file written next to it, so that previously
+  calculated gains can be applied without touching bootstrap.xml.
+
+  Binary format (native byte order): the 8-byte magic "KRPADGN1", a
+  uint32 record count, then one record per pad holding uint16 TPC id,
+  sector id, padrow id, pad id and a float gain.
+
+  \author B. Rumberger
+  \version $Id:    $
+  \date 17 October 2026
+*/
+
+#ifndef _KryptonPadGains_h_
+#define _KryptonPadGains_h_
+
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+
+#include <det/TPCConst.h>
+
+//Typedefs and containers for holding pad gains.
+typedef std::unordered_map<unsigned int, double> PadGains;
+typedef std::unordered_map<unsigned int, PadGains> PadrowGains;
+typedef std::unordered_map<unsigned int, PadrowGains> SectorGains;
+typedef std::unordered_map<unsigned int, SectorGains> DetectorGains;
+
+const char kPadGainBinaryMagic[8] = {'K','R','P','A','D','G','N','1'};
+
+/// Binary pad gain record.
+struct PadGainRecord {
+  uint16_t fTPCId;
+  uint16_t fSectorId;
+  uint16_t fPadrowId;
+  uint16_t fPadId;
+  float fGain;
+};
+
+/// Get gain of a pad. Pads missing from the table have unit gain.
+inline double GetPadGain(const DetectorGains& gains,
+                         const unsigned int tpcId,
+                         const unsigned int sectorId,
+                         const unsigned int padrowId,
+                         const unsigned int padId)
+{
+  const auto tpcIt = gains.find(tpcId);
+  if (tpcIt == gains.end())
+    return 1.;
+  const auto sectorIt = tpcIt->second.find(sectorId);
+  if (sectorIt == tpcIt->second.end())
+    return 1.;
+  const auto padrowIt = sectorIt->second.find(padrowId);
+  if (padrowIt == sectorIt->second.end())
+    return 1.;
+  const auto padIt = padrowIt->second.find(padId);
+  if (padIt == padrowIt->second.end())
+    return 1.;
+  return padIt->second;
+}
+
+/// Get gains of one sector, or nullptr if the sector is not in the table.
+inline const PadrowGains* GetSectorGains(const DetectorGains& gains,
+                                         const unsigned int tpcId,
+                                         const unsigned int sectorId)
+{
+  const auto tpcIt = gains.find(tpcId);
+  if (tpcIt == gains.end())
+    return nullptr;
+  const auto sectorIt = tpcIt->second.find(sectorId);
+  if (sectorIt == tpcIt->second.end())
+    return nullptr;
+  return &sectorIt->second;
+}
+
+/// Get value of attribute in an XML tag. Returns empty string if absent.
+inline std::string GetXMLAttribute(const std::string& tag,
+                                   const std::string& attribute)
+{
+  const std::string key = attribute + "=\"";
+  const size_t start = tag.find(key);
+  if (start == std::string::npos)
+    return "";
+  const size_t valueStart = start + key.size();
+  const size_t valueStop = tag.find('"',valueStart);
+  if (valueStop == std::string::npos)
+    return "";
+  return tag.substr(valueStart,valueStop - valueStart);
+}
+
+/// Numeric id attribute of an XML tag. Returns false if it is missing or
+/// not a non-negative integer.
+inline bool GetXMLIdAttribute(const std::string& tag, unsigned int& id)
+{
+  const std::string value = GetXMLAttribute(tag,"id");
+  if (value.empty() || value.find_first_not_of("0123456789") != std::string::npos)
+    return false;
+  try {
+    id = std::stoul(value);
+  }
+  catch (const std::exception&) {
+    return false;
+  }
+  return true;
+}
+
+/// Read PadByPadGain XML file into gain table. Returns number of pads read.
+inline unsigned int ReadPadGainXML(const std::string& filename,
+                                   DetectorGains& gains)
+{
+  std::ifstream file(filename);
+  if (!file.is_open()) {
+    std::cout << "[ERROR] Could not open pad gain file " << filename << "!" << std::endl;
+    return 0;
+  }
+  std::stringstream buffer;
+  buffer << file.rdbuf();
+  const std::string content = buffer.str();
+
+  if (content.find("<PadByPadGain") == std::string::npos) {
+    std::cout << "[ERROR] " << filename << " is not a PadByPadGain XML file!" << std::endl;
+    return 0;
+  }
+
+  unsigned int nPads = 0;
+  unsigned int tpcId = det::TPCConst::eUnknown;
+  unsigned int sectorId = 0;
+  unsigned int padrowId = 0;
+  size_t position = 0;
+  //Walk through tags. Only TPC, Sector, Padrow and PadGains are relevant.
+  while ((position = content.find('<',position)) != std::string::npos) {
+    const size_t tagEnd = content.find('>',position);
+    if (tagEnd == std::string::npos)
+      break;
+    const std::string tag = content.substr(position + 1,tagEnd - position - 1);
+    position = tagEnd + 1;
+
+    if (tag.rfind("TPC ",0) == 0) {
+      tpcId = det::TPCConst::GetId(GetXMLAttribute(tag,"name"));
+    }
+    else if (tag.rfind("Sector ",0) == 0 || tag.rfind("Padrow ",0) == 0) {
+      unsigned int& id = (tag[0] == 'S') ? sectorId : padrowId;
+      if (!GetXMLIdAttribute(tag,id)) {
+        std::cerr << "[ERROR] Missing or invalid id in <" << tag << "> of "
+                  << filename << "!" << std::endl;
+        return 0;
+      }
+    }
+    else if (tag == "PadGains") {
+      const size_t gainsEnd = content.find("</PadGains>",position);
+      if (gainsEnd == std::string::npos) {
+        std::cout << "[ERROR] Unterminated PadGains tag in " << filename << "!" << std::endl;
+        return 0;
+      }
+      if (tpcId == det::TPCConst::eUnknown) {
+        position = gainsEnd;
+        continue;
+      }
+      std::istringstream gainsString(content.substr(position,gainsEnd - position));
+      PadGains& padGains = gains[tpcId][sectorId][padrowId];
+      double gain = 0;
+      //Pads are numbered from 1 in the order they are listed.
+      for (unsigned int padId = 1; gainsString >> gain; ++padId) {
+        padGains[padId] = gain;
+        ++nPads;
+      }
+      position = gainsEnd;
+    }
+  }
+  return nPads;
+}
+
+/// Read binary pad gain file into gain table. Returns number of pads read.
+inline unsigned int ReadPadGainBinary(const std::string& filename,
+                                      DetectorGains& gains)
+{
+  std::ifstream file(filename,std::ios::binary);
+  if (!file.is_open()) {
+    std::cout << "[ERROR] Could not open pad gain file " << filename << "!" << std::endl;
+    return 0;
+  }
+  char magic[sizeof(kPadGainBinaryMagic)];
+  uint32_t nRecords = 0;
+  file.read(magic,sizeof(magic));
+  file.read(reinterpret_cast<char*>(&nRecords),sizeof(nRecords));
+  if (!file || std::memcmp(magic,kPadGainBinaryMagic,sizeof(magic)) != 0) {
+    std::cout << "[ERROR] " << filename << " is not a binary pad gain file!" << std::endl;
+    return 0;
+  }
+  PadGainRecord record;
+  unsigned int nPads = 0;
+  for (; nPads < nRecords; ++nPads) {
+    if (!file.read(reinterpret_cast<char*>(&record),sizeof(record))) {
+      std::cout << "[ERROR] Binary pad gain file " << filename << " is truncated!" << std::endl;
+      return 0;
+    }
+    gains[record.fTPCId][record.fSectorId][record.fPadrowId][record.fPadId] = record.fGain;
+  }
+  return nPads;
+}
+
+/// Write gain table to binary pad gain file.
+inline bool WritePadGainBinary(const std::string& filename,
+                               const DetectorGains& gains)
+{
+  uint32_t nRecords = 0;
+  for (const auto& tpcGains : gains)
+    for (const auto& sectorGains : tpcGains.second)
+      for (const auto& padrowGains : sectorGains.second)
+        nRecords += padrowGains.second.size();
+
+  std::ofstream file(filename,std::ios::binary);
+  if (!file.is_open()) {
+    std::cout << "[ERROR] Could not create pad gain file " << filename << "!" << std::endl;
+    return false;
+  }
+  file.write(kPadGainBinaryMagic,sizeof(kPadGainBinaryMagic));
+  file.write(reinterpret_cast<const char*>(&nRecords),sizeof(nRecords));
+  for (const auto& tpcGains : gains) {
+    for (const auto& sectorGains : tpcGains.second) {
+      for (const auto& padrowGains : sectorGains.second) {
+        for (const auto& padGain : padrowGains.second) {
+          const PadGainRecord record = {(uint16_t)tpcGains.first,
+                                        (uint16_t)sectorGains.first,
+                                        (uint16_t)padrowGains.first,
+                                        (uint16_t)padGain.first,
+                                        (float)padGain.second};
+          file.write(reinterpret_cast<const char*>(&record),sizeof(record));
+        }
+      }
+    }
+  }
+  return file.good();
+}
+
+/// Write gain table to PadByPadGain XML file. Pads must be numbered from 1.
+inline bool WritePadGainXML(const std::string& filename,
+                            const DetectorGains& gains)
+{
+  std::ofstream file(filename);
+  if (!file.is_open()) {
+    std::cout << "[ERROR] Could not create pad gain file " << filename << "!" << std::endl;
+    return false;
+  }
+  file << "<?xml version=\"1.0\" encoding=\"utf-8\"?>\n"
+       << "\n"
+       << "<PadByPadGain\n"
+       << "  xmlns:xsi=\"http://www.w3.org/2001/XMLSchema-instance\"\n"
+       << "  xsi:noNamespaceSchemaLocation=\"[SCHEMAPATH]/TPCPadGain_DataFormat.xsd\">\n"
+       << "\n";
+  //Sort by id, as in the XML files written from the detector geometry.
+  const std::map<unsigned int, SectorGains> sortedTPCs(gains.begin(),gains.end());
+  for (const auto& tpcGains : sortedTPCs) {
+    file << "  <TPC name=\""
+         << det::TPCConst::GetName((det::TPCConst::EId)tpcGains.first) << "\">\n";
+    const std::map<unsigned int, PadrowGains>
+      sortedSectors(tpcGains.second.begin(),tpcGains.second.end());
+    for (const auto& sectorGains : sortedSectors) {
+      file << "    <Sector id=\"" << sectorGains.first << "\">\n";
+      const std::map<unsigned int, PadGains>
+        sortedPadrows(sectorGains.second.begin(),sectorGains.second.end());
+      for (const auto& padrowGains : sortedPadrows) {
+        file << "      <Padrow id=\"" << padrowGains.first << "\">\n";
+        file << "        <PadGains> ";
+        const std::map<unsigned int, double>
+          sortedPads(padrowGains.second.begin(),padrowGains.second.end());
+        for (const auto& padGain : sortedPads)
+          file << padGain.second << " ";
+        file << "</PadGains>\n";
+        file << "      </Padrow>\n";
+      }
+      file << "    </Sector>\n";
+    }
+    file << "  </TPC>\n";
+  }
+  file << "</PadByPadGain>\n";
+  return file.good();
+}
+
+/// Read pad gains from XML or binary file. Format is identified by content.
+inline unsigned int LoadPadGains(const std::string& filename,
+                                 DetectorGains& gains)
+{
+  std::ifstream file(filename,std::ios::binary);
+  char magic[sizeof(kPadGainBinaryMagic)] = {0};
+  file.read(magic,sizeof(magic));
+  file.close();
+  if (std::memcmp(magic,kPadGainBinaryMagic,sizeof(magic)) == 0)
+    return ReadPadGainBinary(filename,gains);
+  return ReadPadGainXML(filename,gains);
+}
+
+#endif
@@ -0,0 +1,152 @@
+/**
+  \file
+  Hardware performance counters (cycles, instructions, cache misses,
+  branch misses) of the calling thread, read through perf_event_open.
+  Used to tell whether a phase is bound by cache misses (e.g. the
+  nested-map lookups in the fill loop) or by instruction count (e.g.
+  decompression). Counters that cannot be opened, because of the
+  kernel's perf_event_paranoid setting, a container or a virtual
+  machine without a PMU, are reported as unavailable and read as zero.
+
+  \author B. Rumberger
+  \version $Id:    $
+  \date 17 October 2026
+*/
+
+#ifndef _KryptonPerfCounters_h_
+#define _KryptonPerfCounters_h_
+
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+#include <mutex>
+#include <string>
+
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+/// Counter values of a thread, or their sum over the passes through a phase.
+struct PerfCounts {
+  unsigned long long fCycles = 0;
+  unsigned long long fInstructions = 0;
+  unsigned long long fCacheMisses = 0;
+  unsigned long long fBranchMisses = 0;
+
+  PerfCounts& operator+=(const PerfCounts& other)
+  {
+    fCycles += other.fCycles;
+    fInstructions += other.fInstructions;
+    fCacheMisses += other.fCacheMisses;
+    fBranchMisses += other.fBranchMisses;
+    return *this;
+  }
+  PerfCounts operator-(const PerfCounts& other) const
+  {
+    PerfCounts difference;
+    difference.fCycles = fCycles - other.fCycles;
+    difference.fInstructions = fInstructions - other.fInstructions;
+    difference.fCacheMisses = fCacheMisses - other.fCacheMisses;
+    difference.fBranchMisses = fBranchMisses - other.fBranchMisses;
+    return difference;
+  }
+};
+
+/// Counters of the calling thread. They run from construction on and
+/// are read without stopping them.
+class PerfCounterGroup {
+public:
+  enum ECounter {
+    eCycles = 0,
+    eInstructions,
+    eCacheMisses,
+    eBranchMisses,
+    eNCounters
+  };
+
+  PerfCounterGroup()
+  {
+    const unsigned long long configs[eNCounters] = {
+      PERF_COUNT_HW_CPU_CYCLES,
+      PERF_COUNT_HW_INSTRUCTIONS,
+      PERF_COUNT_HW_CACHE_MISSES,
+      PERF_COUNT_HW_BRANCH_MISSES
+    };
+    for (unsigned int i = 0; i < eNCounters; ++i) {
+      perf_event_attr attributes;
+      memset(&attributes,0,sizeof(attributes));
+      attributes.type = PERF_TYPE_HARDWARE;
+      attributes.size = sizeof(attributes);
+      attributes.config = configs[i];
+      //User space only, so perf_event_paranoid <= 2 is enough.
+      attributes.exclude_kernel = 1;
+      attributes.exclude_hv = 1;
+      attributes.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+      fDescriptors[i] = syscall(__NR_perf_event_open,&attributes,0,-1,-1,0);
+      if (fDescriptors[i] < 0)
+        ReportUnavailable(i,errno);
+    }
+  }
+
+  ~PerfCounterGroup()
+  {
+    for (unsigned int i = 0; i < eNCounters; ++i)
+      if (fDescriptors[i] >= 0)
+        close(fDescriptors[i]);
+  }
+
+  PerfCounterGroup(const PerfCounterGroup&) = delete;
+  PerfCounterGroup& operator=(const PerfCounterGroup&) = delete;
+
+  bool IsAvailable(const ECounter counter) const { return fDescriptors[counter] >= 0; }
+
+  /// Current counts, scaled up if the kernel multiplexed the counters.
+  PerfCounts Read() const
+  {
+    PerfCounts counts;
+    counts.fCycles = ReadCounter(eCycles);
+    counts.fInstructions = ReadCounter(eInstructions);
+    counts.fCacheMisses = ReadCounter(eCacheMisses);
+    counts.fBranchMisses = ReadCounter(eBranchMisses);
+    return counts;
+  }
+
+  /// Counters of the calling thread, opened on first use.
+  static PerfCounterGroup& ForThisThread()
+  {
+    thread_local PerfCounterGroup group;
+    return group;
+  }
+
+private:
+  unsigned long long ReadCounter(const ECounter counter) const
+  {
+    if (fDescriptors[counter] < 0)
+      return 0;
+    //Value, time enabled, time running.
+    unsigned long long values[3] = {0, 0, 0};
+    if (read(fDescriptors[counter],values,sizeof(values)) != sizeof(values) || values[2] == 0)
+      return 0;
+    if (values[2] == values[1])
+      return values[0];
+    return (unsigned long long)((double)values[0]*values[1]/values[2]);
+  }
+
+  /// Warn once per counter and process.
+  static void ReportUnavailable(const unsigned int counter, const int error)
+  {
+    static std::mutex reportMutex;
+    static bool reported[eNCounters] = {false, false, false, false};
+    const char* names[eNCounters] = {"cycles", "instructions", "cache misses", "branch misses"};
+    std::lock_guard<std::mutex> lock(reportMutex);
+    if (reported[counter])
+      return;
+    reported[counter] = true;
+    std::cout << "[WARNING] Hardware counter for " << names[counter] << " unavailable ("
+              << strerror(error) << "). Reported as 0." << std::endl;
+  }
+
+  int fDescriptors[eNCounters];
+};
+
+#endif
@@ -0,0 +1,368 @@
+/**
+  \file
+  Wall-clock and CPU timers for the phases of the Krypton analysis
+  (geometry initialization, histogram booking, input reading, filling,
+  fitting, output writing etc.). Phases are timed with scoped objects,
+  so a phase may be entered many times (e.g. once per cluster block)
+  and from several threads. Each thread sums its passes into its own
+  totals, which are merged when the report is read, so the workers do
+  not share a lock per pass. The accumulated report is written as JSON
+  next to the gains XML to track performance across versions. The
+  process peak RSS at the end of each phase, and its growth during the
+  phase, are recorded as well. If a trace recorder is attached, every
+  pass is also recorded as a span. Per block scopes skip both the RSS
+  sample and the span. Optionally, hardware counters (cycles,
+  instructions, cache and branch misses) of the timing thread are
+  summed per phase.
+
+  \author B. Rumberger
+  \version $Id:    $
+  \date 17 October 2026
+*/
+
+#ifndef _KryptonPhaseTimer_h_
+#define _KryptonPhaseTimer_h_
+
+#include <algorithm>
+#include <chrono>
+#include <ctime>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <time.h>
+
+#include "KryptonMemory.h"
+#include "KryptonPerfCounters.h"
+#include "KryptonTrace.h"
+
+/// Accumulated timing of one analysis phase.
+struct PhaseTiming {
+  unsigned long long fCalls = 0;
+  double fWallTime = 0;
+  double fCPUTime = 0;
+  unsigned long long fEntries = 0;
+  unsigned long long fBytesRead = 0;
+  unsigned long long fPeakRSS = 0;
+  unsigned long long fRSSGrowth = 0;
+  PerfCounts fCounters;
+};
+
+class PhaseTimer {
+public:
+  /// How often a scope is entered. Per block scopes, entered for each
+  /// cluster block by the workers, do not sample the peak RSS (a
+  /// getrusage call) and are not recorded as trace spans.
+  enum EGranularity {
+    ePass,
+    eBlock
+  };
+
+  /// Times one pass through a phase. Results are added on destruction.
+  class Scope {
+  public:
+    Scope(PhaseTimer& timer, const std::string& phase, const std::string& detail = "",
+          const EGranularity granularity = ePass) :
+      fTimer(timer), fPhase(phase), fDetail(detail), fGranularity(granularity),
+      fWallStart(std::chrono::steady_clock::now()),
+      fCPUStart(GetThreadCPUTime()),
+      fPeakRSSStart((granularity == ePass) ? GetPeakRSS() : 0)
+    {
+      if (fTimer.fPerfCountersEnabled)
+        fCountersStart = PerfCounterGroup::ForThisThread().Read();
+    }
+    ~Scope() { Stop(); }
+    /// Stop timing before the end of the enclosing block.
+    void Stop()
+    {
+      if (fStopped)
+        return;
+      fStopped = true;
+      const std::chrono::steady_clock::time_point wallStop = std::chrono::steady_clock::now();
+      fWallTime = std::chrono::duration<double>(wallStop - fWallStart).count();
+      const unsigned long long peakRSS = (fGranularity == ePass) ? GetPeakRSS() : 0;
+      const PerfCounts counters = fTimer.fPerfCountersEnabled ?
+        PerfCounterGroup::ForThisThread().Read() - fCountersStart : PerfCounts();
+      fTimer.Add(fPhase,fWallTime,GetThreadCPUTime() - fCPUStart,fEntries,fBytesRead,
+                 peakRSS,peakRSS - fPeakRSSStart,counters);
+      if (fTimer.fTraceRecorder != nullptr && fGranularity == ePass)
+        fTimer.fTraceRecorder->AddSpan(fPhase,fWallStart,wallStop,fDetail);
+    }
+    void AddEntries(const unsigned long long entries) { fEntries += entries; }
+    void AddBytesRead(const unsigned long long bytes) { fBytesRead += bytes; }
+    /// Wall time of the pass [s], once stopped.
+    double GetWallTime() const { return fWallTime; }
+  private:
+    PhaseTimer& fTimer;
+    const std::string fPhase;
+    const std::string fDetail;
+    const EGranularity fGranularity;
+    const std::chrono::steady_clock::time_point fWallStart;
+    const double fCPUStart;
+    const unsigned long long fPeakRSSStart;
+    PerfCounts fCountersStart;
+    unsigned long long fEntries = 0;
+    unsigned long long fBytesRead = 0;
+    double fWallTime = 0;
+    bool fStopped = false;
+  };
+
+  PhaseTimer() : fStart(std::chrono::steady_clock::now()), fCPUStart(GetProcessCPUTime()) { }
+
+  /// Drop all phases and report sections and restart the clocks, e.g. in a
+  /// process forked for a new job. No scope may be open in another thread.
+  void Restart()
+  {
+    std::lock_guard<std::mutex> lock(fMutex);
+    fPhaseOrder.clear();
+    fThreadTimings.clear();
+    ++fGeneration;
+    fReportSections.clear();
+    fStart = std::chrono::steady_clock::now();
+    fCPUStart = GetProcessCPUTime();
+  }
+
+  /// Record every phase pass as a trace span as well.
+  void SetTraceRecorder(TraceRecorder* recorder) { fTraceRecorder = recorder; }
+
+  /// Sum hardware counters per phase. Enable before the first scope.
+  void EnablePerfCounters() { fPerfCountersEnabled = true; }
+
+  /// Add one pass through a phase to the totals of the calling thread.
+  /// Phases are reported in order of first use.
+  void Add(const std::string& phase,
+           const double wallTime,
+           const double cpuTime,
+           const unsigned long long entries = 0,
+           const unsigned long long bytesRead = 0,
+           const unsigned long long peakRSS = 0,
+           const unsigned long long rssGrowth = 0,
+           const PerfCounts& counters = PerfCounts())
+  {
+    ThreadTimings& threadTimings = GetThreadTimings();
+    //Only this thread inserts into its map, so it may look up without the lock.
+    if (threadTimings.fPhases.find(phase) == threadTimings.fPhases.end()) {
+      std::lock_guard<std::mutex> lock(fMutex);
+      if (std::find(fPhaseOrder.begin(),fPhaseOrder.end(),phase) == fPhaseOrder.end())
+        fPhaseOrder.push_back(phase);
+    }
+    std::lock_guard<std::mutex> lock(threadTimings.fMutex);
+    PhaseTiming& timing = threadTimings.fPhases[phase];
+    ++timing.fCalls;
+    timing.fWallTime += wallTime;
+    timing.fCPUTime += cpuTime;
+    timing.fEntries += entries;
+    timing.fBytesRead += bytesRead;
+    timing.fRSSGrowth += rssGrowth;
+    timing.fCounters += counters;
+    if (peakRSS > timing.fPeakRSS)
+      timing.fPeakRSS = peakRSS;
+  }
+
+  /// Add a named JSON value (object, array or number) to the report.
+  void AddReportSection(const std::string& name, const std::string& json)
+  {
+    std::lock_guard<std::mutex> lock(fMutex);
+    fReportSections.push_back(std::make_pair(name,json));
+  }
+
+  /// Accumulated timing of one phase (empty if the phase was never entered).
+  PhaseTiming GetTiming(const std::string& phase) const
+  {
+    std::lock_guard<std::mutex> lock(fMutex);
+    const std::map<std::string, PhaseTiming> phases = MergeThreadTimings();
+    auto it = phases.find(phase);
+    return (it == phases.end()) ? PhaseTiming() : it->second;
+  }
+
+  /// Print phase summary.
+  void Print() const
+  {
+    std::lock_guard<std::mutex> lock(fMutex);
+    std::map<std::string, PhaseTiming> phases = MergeThreadTimings();
+    std::cout << "[INFO] Phase timing (wall [s], CPU [s], entries/s, MB/s, peak RSS [MB]):"
+              << std::endl;
+    for (auto it = fPhaseOrder.begin(), itEnd = fPhaseOrder.end(); it != itEnd; ++it) {
+      const PhaseTiming& timing = phases[*it];
+      std::cout << "[INFO]   " << std::left << std::setw(20) << *it << std::right
+                << std::setw(12) << timing.fWallTime
+                << std::setw(12) << timing.fCPUTime
+                << std::setw(14) << Rate(timing.fEntries,timing.fWallTime)
+                << std::setw(12) << Rate(timing.fBytesRead,timing.fWallTime)/1e6
+                << std::setw(12) << timing.fPeakRSS/1e6
+                << std::endl;
+    }
+    std::cout << "[INFO]   " << std::left << std::setw(20) << "total" << std::right
+              << std::setw(12) << GetElapsedWallTime()
+              << std::setw(12) << GetProcessCPUTime() - fCPUStart
+              << std::setw(14) << ""
+              << std::setw(12) << ""
+              << std::setw(12) << GetPeakRSS()/1e6 << std::endl;
+    if (!fPerfCountersEnabled)
+      return;
+    std::cout << "[INFO] Hardware counters (IPC, cycles/entry, instructions/entry, "
+              << "cache misses/entry, branch misses/entry):" << std::endl;
+    for (auto it = fPhaseOrder.begin(), itEnd = fPhaseOrder.end(); it != itEnd; ++it) {
+      const PhaseTiming& timing = phases[*it];
+      const PerfCounts& counters = timing.fCounters;
+      std::cout << "[INFO]   " << std::left << std::setw(20) << *it << std::right
+                << std::setw(12) << Ratio(counters.fInstructions,counters.fCycles)
+                << std::setw(12) << Ratio(counters.fCycles,timing.fEntries)
+                << std::setw(12) << Ratio(counters.fInstructions,timing.fEntries)
+                << std::setw(12) << Ratio(counters.fCacheMisses,timing.fEntries)
+                << std::setw(12) << Ratio(counters.fBranchMisses,timing.fEntries)
+                << std::endl;
+    }
+  }
+
+  /// Write phase report as JSON.
+  bool WriteJSON(const std::string& filename, const std::string& outputPrefix) const
+  {
+    std::ofstream file(filename);
+    if (!file.is_open()) {
+      std::cout << "[ERROR] Could not create timing report " << filename << "!" << std::endl;
+      return false;
+    }
+    std::lock_guard<std::mutex> lock(fMutex);
+    std::map<std::string, PhaseTiming> phases = MergeThreadTimings();
+    char date[32];
+    const std::time_t now = std::time(nullptr);
+    std::strftime(date,sizeof(date),"%Y-%m-%dT%H:%M:%S",std::localtime(&now));
+    file << std::setprecision(9)
+         << "{\n"
+         << "  \"outputPrefix\": \"" << outputPrefix << "\",\n"
+         << "  \"date\": \"" << date << "\",\n"
+         << "  \"totalWallTime\": " << GetElapsedWallTime() << ",\n"
+         << "  \"totalCPUTime\": " << GetProcessCPUTime() - fCPUStart << ",\n"
+         << "  \"peakRSS\": " << GetPeakRSS() << ",\n";
+    for (auto it = fReportSections.begin(), itEnd = fReportSections.end(); it != itEnd; ++it)
+      file << "  \"" << it->first << "\": " << it->second << ",\n";
+    file << "  \"phases\": [";
+    for (auto it = fPhaseOrder.begin(), itEnd = fPhaseOrder.end(); it != itEnd; ++it) {
+      const PhaseTiming& timing = phases[*it];
+      file << (it == fPhaseOrder.begin() ? "\n" : ",\n")
+           << "    {\"name\": \"" << *it << "\""
+           << ", \"calls\": " << timing.fCalls
+           << ", \"wallTime\": " << timing.fWallTime
+           << ", \"cpuTime\": " << timing.fCPUTime
+           << ", \"entries\": " << timing.fEntries
+           << ", \"bytesRead\": " << timing.fBytesRead
+           << ", \"entriesPerSecond\": " << Rate(timing.fEntries,timing.fWallTime)
+           << ", \"bytesReadPerSecond\": " << Rate(timing.fBytesRead,timing.fWallTime)
+           << ", \"peakRSS\": " << timing.fPeakRSS
+           << ", \"rssGrowth\": " << timing.fRSSGrowth;
+      if (fPerfCountersEnabled)
+        file << ", \"cycles\": " << timing.fCounters.fCycles
+             << ", \"instructions\": " << timing.fCounters.fInstructions
+             << ", \"cacheMisses\": " << timing.fCounters.fCacheMisses
+             << ", \"branchMisses\": " << timing.fCounters.fBranchMisses
+             << ", \"instructionsPerCycle\": "
+             << Ratio(timing.fCounters.fInstructions,timing.fCounters.fCycles)
+             << ", \"cacheMissesPerEntry\": "
+             << Ratio(timing.fCounters.fCacheMisses,timing.fEntries)
+             << ", \"branchMissesPerEntry\": "
+             << Ratio(timing.fCounters.fBranchMisses,timing.fEntries);
+      file << "}";
+    }
+    file << "\n  ]\n"
+         << "}\n";
+    return file.good();
+  }
+
+  double GetElapsedWallTime() const
+  {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - fStart).count();
+  }
+
+  /// CPU time of the calling thread.
+  static double GetThreadCPUTime()
+  {
+    timespec time;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID,&time);
+    return time.tv_sec + 1e-9*time.tv_nsec;
+  }
+
+  /// CPU time of the whole process, all threads.
+  static double GetProcessCPUTime()
+  {
+    timespec time;
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID,&time);
+    return time.tv_sec + 1e-9*time.tv_nsec;
+  }
+
+private:
+  /// Phase totals of one thread. Only that thread adds to them, so the
+  /// lock is uncontended until the totals are merged.
+  struct ThreadTimings {
+    std::mutex fMutex;
+    std::map<std::string, PhaseTiming> fPhases;
+  };
+
+  /// Totals of the calling thread, registered on its first pass.
+  ThreadTimings& GetThreadTimings()
+  {
+    thread_local const PhaseTimer* timer = nullptr;
+    thread_local unsigned int generation = 0;
+    thread_local ThreadTimings* timings = nullptr;
+    if (timer != this || generation != fGeneration) {
+      std::lock_guard<std::mutex> lock(fMutex);
+      fThreadTimings.emplace_back(new ThreadTimings);
+      timings = fThreadTimings.back().get();
+      timer = this;
+      generation = fGeneration;
+    }
+    return *timings;
+  }
+
+  /// Sum of the totals of all threads. Caller holds fMutex.
+  std::map<std::string, PhaseTiming> MergeThreadTimings() const
+  {
+    std::map<std::string, PhaseTiming> phases;
+    for (auto it = fThreadTimings.begin(), itEnd = fThreadTimings.end(); it != itEnd; ++it) {
+      std::lock_guard<std::mutex> lock((*it)->fMutex);
+      for (auto phaseIt = (*it)->fPhases.begin(), phaseEnd = (*it)->fPhases.end();
+           phaseIt != phaseEnd; ++phaseIt) {
+        const PhaseTiming& threadTiming = phaseIt->second;
+        PhaseTiming& timing = phases[phaseIt->first];
+        timing.fCalls += threadTiming.fCalls;
+        timing.fWallTime += threadTiming.fWallTime;
+        timing.fCPUTime += threadTiming.fCPUTime;
+        timing.fEntries += threadTiming.fEntries;
+        timing.fBytesRead += threadTiming.fBytesRead;
+        timing.fRSSGrowth += threadTiming.fRSSGrowth;
+        timing.fCounters += threadTiming.fCounters;
+        if (threadTiming.fPeakRSS > timing.fPeakRSS)
+          timing.fPeakRSS = threadTiming.fPeakRSS;
+      }
+    }
+    return phases;
+  }
+
+  static double Rate(const unsigned long long count, const double time)
+  {
+    return (time > 0) ? count/time : 0;
+  }
+
+  static double Ratio(const unsigned long long numerator, const unsigned long long denominator)
+  {
+    return (denominator > 0) ? (double)numerator/denominator : 0;
+  }
+
+  mutable std::mutex fMutex;
+  TraceRecorder* fTraceRecorder = nullptr;
+  bool fPerfCountersEnabled = false;
+  std::vector<std::string> fPhaseOrder;
+  std::vector<std::unique_ptr<ThreadTimings> > fThreadTimings;
+  unsigned int fGeneration = 0;
+  std::vector<std::pair<std::string, std::string> > fReportSections;
+  std::chrono::steady_clock::time_point fStart;
+  double fCPUStart;
+};
+
+#endif
@@ -0,0 +1,343 @@
+/**
+  \file Generator of synthetic 83Kr cluster files. Each pad is given a
+  random true response, and clusters are drawn from the configured
+  83Kr line spectrum, smeared by the energy resolution and scaled by
+  the pad response. A fraction of low-charge noise clusters is mixed
+  in. The expected calibration gains (sector-average response divided
+  by pad response) are written as [prefix]-TrueGains.xml, so analyzer
+  output can be checked against the truth.
+
+  \author B. Rumberger
+  \version $Id:    $
+  \date 17 October 2026
+*/
+
+#include "KryptonSynth.h"
+#include "KryptonPadGains.h"
+
+#include <fwk/CentralConfig.h>
+#include <det/Detector.h>
+#include <det/TPC.h>
+#include <det/TPCSector.h>
+
+#include <TFile.h>
+#include <TRandom3.h>
+#include <TTree.h>
+
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <sstream>
+
+#include <boost/filesystem.hpp>
+
+using namespace std;
+
+/// Main function.
+int main(int argc, char* argv[])
+{
+  const vector<string> argumentsVector(argv + 1, argv + argc);
+
+  string configFilename = "SynthConfig.txt";
+  string outputPrefix;
+  for (auto it = argumentsVector.begin(), itEnd = argumentsVector.end();
+       it != itEnd; ++it) {
+    if (*it == string("-h") || *it == string("--help")) {
+      DisplayUsage();
+    }
+    else if (*it == string("-o")) {
+      if (next(it) == itEnd || next(it)->rfind("-",0) != string::npos) {
+        cout << "[ERROR] No output prefix provided with argument -o!" << endl;
+        DisplayUsage();
+      }
+      advance(it,1);
+      outputPrefix = *it;
+    }
+    else if (*it == string("-c") || *it == string("--config")) {
+      if (next(it) == itEnd || next(it)->rfind("-",0) != string::npos) {
+        cout << "[ERROR] No config filename provided with argument -c!" << endl;
+        DisplayUsage();
+      }
+      advance(it,1);
+      configFilename = *it;
+      cout << "[INFO] User-provided config file: " << configFilename << endl;
+    }
+    else {
+      cout << "[ERROR] Invalid argument " << *it << "!" << endl;
+      DisplayUsage();
+    }
+  }
+
+  if (outputPrefix.size() == 0) {
+    cout << "[ERROR] No output prefix provided!" << endl;
+    DisplayUsage();
+  }
+
+  //Parse configuration file.
+  ParseConfigFile(configFilename);
+  if (fKrLines.empty()) {
+    cout << "[ERROR] No 83Kr lines given in config file!" << endl;
+    return -1;
+  }
+
+  //Cumulative line intensities for sampling.
+  vector<double> cumulativeIntensities;
+  double totalIntensity = 0;
+  for (auto it = fKrLines.begin(), itEnd = fKrLines.end(); it != itEnd; ++it) {
+    totalIntensity += it->second;
+    cumulativeIntensities.push_back(totalIntensity);
+  }
+  //Energy resolution is given at the main 41.6 keV line.
+  const double referenceEnergy = 41.6;
+
+  //Geometry from the standard bootstrap file.
+  const string bootstrapPath = "bootstrap.xml";
+  fwk::CentralConfig::GetInstance(bootstrapPath);
+  det::Detector& detector  = det::Detector::GetInstance();
+  const unsigned int dummyRun = 1;
+  const utl::TimeStamp dummyTime = utl::TimeStamp(1);
+  detector.Update(dummyTime,dummyRun);
+  const det::TPC& tpc = detector.GetTPC();
+
+  boost::filesystem::path currentPath( boost::filesystem::current_path() );
+  const string& currentWorkingDirectory = currentPath.string() + "/";
+
+  //Draw true pad responses. Pad lists per sector are used for sampling.
+  TRandom3 random(fSeed);
+  DetectorGains padResponses;
+  DetectorGains trueGains;
+  //Indices: padLists[tpcId][sectorId] = vector of (padrow, pad).
+  map<unsigned int, map<unsigned int, vector<pair<unsigned int, unsigned int> > > > padLists;
+  unsigned int totalPads = 0;
+  for (auto chamberIt = tpc.ChambersBegin(), chamberEnd = tpc.ChambersEnd();
+       chamberIt != chamberEnd; ++chamberIt) {
+    const det::TPCChamber& chamber = *chamberIt;
+    const unsigned int tpcId = (unsigned int)chamber.GetId();
+    if (fTPCIdList.find(chamber.GetId()) == fTPCIdList.end())
+      continue;
+    for (auto sectorIt = chamber.SectorsBegin(), sectorEnd = chamber.SectorsEnd();
+         sectorIt != sectorEnd; ++sectorIt) {
+      const det::TPCSector& sector = *sectorIt;
+      const unsigned int sectorId = sector.GetId();
+      double responseSum = 0;
+      unsigned int nSectorPads = 0;
+      for (auto padrowIt = sector.PadrowsBegin(), padrowEnd = sector.PadrowsEnd();
+           padrowIt != padrowEnd; ++padrowIt) {
+        const det::TPCPadrow& padrow = *padrowIt;
+        const unsigned int padrowId = padrow.GetId();
+        for (unsigned int padId = 1; padId <= padrow.GetNPads(); ++padId) {
+          const double response = max(0.1,random.Gaus(1.,fGainSpread));
+          padResponses[tpcId][sectorId][padrowId][padId] = response;
+          padLists[tpcId][sectorId].push_back(make_pair(padrowId,padId));
+          responseSum += response;
+          ++nSectorPads;
+        }
+      }
+      //Analyzer gains are normalized to the sector average.
+      const double averageResponse = (nSectorPads > 0) ? responseSum/nSectorPads : 1.;
+      for (auto& padrowResponses : padResponses[tpcId][sectorId])
+        for (auto& padResponse : padrowResponses.second)
+          trueGains[tpcId][sectorId][padrowResponses.first][padResponse.first] =
+            averageResponse/padResponse.second;
+      totalPads += nSectorPads;
+    }
+  }
+
+  if (totalPads == 0) {
+    cout << "[ERROR] No pads found. Was your TPC included in the configuration file list?" << endl;
+    return -1;
+  }
+
+  const string trueGainsFilename = currentWorkingDirectory + outputPrefix + "-TrueGains.xml";
+  WritePadGainXML(trueGainsFilename,trueGains);
+  cout << "[INFO] True pad gains written to file " << trueGainsFilename << endl;
+
+  //Variables to fill. Types match the TPCKrCalibrationMN output.
+  Float16_t fCharge = 0;
+  UShort_t fMaxADC = 0;
+  UShort_t fTimeSlice = 0;
+  UShort_t fNPixels = 0;
+  UChar_t fNTimeSlices = 0;
+  UChar_t fNPads = 0;
+  UChar_t fPadrow = 0;
+  UChar_t fPad = 0;
+
+  for (unsigned int fileNumber = 0; fileNumber < fNFiles; ++fileNumber) {
+    //Each file has its own stream, so files can be regenerated individually.
+    TRandom3 fileRandom(fSeed + 1 + fileNumber);
+    const double nFileClusters =
+      max(0.,round(fileRandom.Gaus(fClustersPerFile,fFileSizeSpread*fClustersPerFile)));
+
+    const string filename = currentWorkingDirectory + outputPrefix +
+      Form("-%04u-krCalibration.root",fileNumber);
+    TFile outputFile(filename.c_str(),"RECREATE");
+    if (outputFile.IsZombie()) {
+      cout << "[ERROR] Could not create output file " << filename << "!" << endl;
+      return -1;
+    }
+
+    for (auto tpcIt = padLists.begin(), tpcEnd = padLists.end(); tpcIt != tpcEnd; ++tpcIt) {
+      const det::TPCConst::EId tpcId = (det::TPCConst::EId)tpcIt->first;
+      for (auto sectorIt = tpcIt->second.begin(), sectorEnd = tpcIt->second.end();
+           sectorIt != sectorEnd; ++sectorIt) {
+        const unsigned int sectorId = sectorIt->first;
+        const vector<pair<unsigned int, unsigned int> >& pads = sectorIt->second;
+        const PadrowGains& sectorResponses = padResponses[tpcId][sectorId];
+
+        //Format: TTree name = [TPCName]Sector[SectorId]Clusters
+        const string treeName = det::TPCConst::GetName(tpcId) +
+          Form("Sector%uClusters",sectorId);
+        TTree* tree = new TTree(treeName.c_str(),treeName.c_str());
+        tree->Branch("fCharge",&fCharge,"fCharge/f");
+        tree->Branch("fMaxADC",&fMaxADC,"fMaxADC/s");
+        tree->Branch("fTimeSlice",&fTimeSlice,"fTimeSlice/s");
+        tree->Branch("fNPixels",&fNPixels,"fNPixels/s");
+        tree->Branch("fNTimeSlices",&fNTimeSlices,"fNTimeSlices/b");
+        tree->Branch("fNPads",&fNPads,"fNPads/b");
+        tree->Branch("fPadrow",&fPadrow,"fPadrow/b");
+        tree->Branch("fPad",&fPad,"fPad/b");
+
+        //Sectors receive clusters in proportion to their pad count.
+        const unsigned int nClusters =
+          fileRandom.Poisson(nFileClusters*pads.size()/totalPads);
+        for (unsigned int i = 0; i < nClusters; ++i) {
+          const pair<unsigned int, unsigned int>& pad = pads[fileRandom.Integer(pads.size())];
+          const double response = sectorResponses.at(pad.first).at(pad.second);
+          double charge = 0;
+          unsigned int nPads = 0;
+          unsigned int nTimeSlices = 0;
+          if (fileRandom.Uniform() < fNoiseFraction) {
+            //Noise: small, low-charge clusters.
+            charge = fileRandom.Exp(fNoiseChargeScale);
+            nPads = 1 + fileRandom.Integer(4);
+            nTimeSlices = 1 + fileRandom.Integer(5);
+          }
+          else {
+            //Pick 83Kr line.
+            const double u = fileRandom.Uniform(totalIntensity);
+            const unsigned int line =
+              lower_bound(cumulativeIntensities.begin(),cumulativeIntensities.end(),u) -
+              cumulativeIntensities.begin();
+            const double energy = fKrLines[min(line,(unsigned int)fKrLines.size() - 1)].first;
+            const double resolution = fEnergyResolution*sqrt(referenceEnergy/energy);
+            charge = energy*fADCPerKeV*response*(1 + resolution*fileRandom.Gaus());
+            nPads = 4 + fileRandom.Poisson(4);
+            nTimeSlices = 5 + fileRandom.Poisson(8);
+          }
+          nPads = min(nPads,255u);
+          nTimeSlices = min(nTimeSlices,255u);
+          charge = max(0.,charge);
+          fCharge = charge;
+          fMaxADC = (UShort_t)min(1023.,3*charge/(nPads*nTimeSlices));
+          fTimeSlice = (UShort_t)fileRandom.Integer(256);
+          fNPixels = (UShort_t)ceil(0.7*nPads*nTimeSlices);
+          fNTimeSlices = (UChar_t)nTimeSlices;
+          fNPads = (UChar_t)nPads;
+          fPadrow = (UChar_t)pad.first;
+          fPad = (UChar_t)pad.second;
+          tree->Fill();
+        }
+        outputFile.cd();
+        tree->Write();
+        delete tree;
+      } //End sector loop.
+    } //End TPC loop.
+    outputFile.Close();
+    cout << "[INFO] Wrote " << nFileClusters << " clusters to " << filename << endl;
+  } //End file loop.
+
+  return 0;
+}
+
+void ParseConfigFile(const std::string& configFile) {
+  //Open file.
+  ifstream file(configFile);
+  //Parse lines in file.
+  std::string line;
+  cout << "[INFO] Parsing config file:" << endl;
+  while (std::getline(file, line))
+    {
+      std::istringstream lineString(line);
+      //Ignore empty lines and lines beginning with a "#".
+      string variableName = "";
+      if (!(lineString >> variableName) || variableName.front() == '#')
+        continue;
+      if (variableName == "tpcList") {
+        string tpcName = "";
+        while (std::getline(file,line) && line.find("tpcListEnd") == string::npos) {
+          std::istringstream nameString(line);
+          if (!(nameString >> tpcName) || tpcName.front() == '#')
+            continue;
+          const det::TPCConst::EId& tpcId = det::TPCConst::GetId(tpcName);
+          if (tpcId != det::TPCConst::eUnknown) {
+            fTPCIdList.insert(tpcId);
+            cout << "[INFO] Added TPC " << tpcName << " (ID = " << tpcId << ")" << endl;
+          }
+        }
+      }
+      else if (variableName == "krLines") {
+        while (std::getline(file,line) && line.find("krLinesEnd") == string::npos) {
+          std::istringstream krLineString(line);
+          double energy = 0;
+          double intensity = 0;
+          if (line.empty() || line.front() == '#')
+            continue;
+          if (!(krLineString >> energy >> intensity)) {
+            cout << "[ERROR] File parsing failed! Line: " << line << endl;
+            continue;
+          }
+          fKrLines.push_back(make_pair(energy,intensity));
+          cout << "[INFO] 83Kr line: " << energy << " keV, intensity " << intensity << endl;
+        }
+      }
+      else if (variableName == "seed") {
+        if (!(lineString >> fSeed))
+          cout << "[ERROR] File parsing failed! Line: " << line << endl;
+        cout << "[INFO] seed: " << fSeed << endl;
+      }
+      else if (variableName == "nFiles") {
+        if (!(lineString >> fNFiles))
+          cout << "[ERROR] File parsing failed! Line: " << line << endl;
+        cout << "[INFO] nFiles: " << fNFiles << endl;
+      }
+      else if (variableName == "clustersPerFile") {
+        if (!(lineString >> fClustersPerFile))
+          cout << "[ERROR] File parsing failed! Line: " << line << endl;
+        cout << "[INFO] clustersPerFile: " << fClustersPerFile << endl;
+      }
+      else if (variableName == "fileSizeSpread") {
+        if (!(lineString >> fFileSizeSpread))
+          cout << "[ERROR] File parsing failed! Line: " << line << endl;
+        cout << "[INFO] fileSizeSpread: " << fFileSizeSpread << endl;
+      }
+      else if (variableName == "gainSpread") {
+        if (!(lineString >> fGainSpread))
+          cout << "[ERROR] File parsing failed! Line: " << line << endl;
+        cout << "[INFO] gainSpread: " << fGainSpread << endl;
+      }
+      else if (variableName == "adcPerKeV") {
+        if (!(lineString >> fADCPerKeV))
+          cout << "[ERROR] File parsing failed! Line: " << line << endl;
+        cout << "[INFO] adcPerKeV: " << fADCPerKeV << endl;
+      }
+      else if (variableName == "energyResolution") {
+        if (!(lineString >> fEnergyResolution))
+          cout << "[ERROR] File parsing failed! Line: " << line << endl;
+        cout << "[INFO] energyResolution: " << fEnergyResolution << endl;
+      }
+      else if (variableName == "noiseFraction") {
+        if (!(lineString >> fNoiseFraction))
+          cout << "[ERROR] File parsing failed! Line: " << line << endl;
+        cout << "[INFO] noiseFraction: " << fNoiseFraction << endl;
+      }
+      else if (variableName == "noiseChargeScale") {
+        if (!(lineString >> fNoiseChargeScale))
+          cout << "[ERROR] File parsing failed! Line: " << line << endl;
+        cout << "[INFO] noiseChargeScale: " << fNoiseChargeScale << endl;
+      }
+      else {
+        cout << "[WARNING] Unknown config variable " << variableName << ". Ignoring." << endl;
+      }
+    } //End parsing.
+  return;
+}
@@ -0,0 +1,51 @@
+/**
+  \file
+  Generator of synthetic 83Kr cluster files for benchmarking the
+  Krypton calibration analyzer without real detector data. The output
+  files have the same [TPC]Sector[N]Clusters tree layout and branch
+  types as the output of the TPCKrCalibrationMN module. Pad responses,
+  the 83Kr line spectrum, noise clusters and file sizes are set in
+  SynthConfig.txt.
+
+  \author B. Rumberger
+  \version $Id:    $
+  \date 17 October 2026
+*/
+
+#include <cstdlib>
+#include <iostream>
+#include <set>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <det/TPCConst.h>
+
+//Config parameters.
+std::set<det::TPCConst::EId> fTPCIdList;
+unsigned int fSeed = 4357;
+unsigned int fNFiles = 10;
+double fClustersPerFile = 100000;
+double fFileSizeSpread = 0.2;
+double fGainSpread = 0.05;
+double fADCPerKeV = 70;
+double fEnergyResolution = 0.08;
+double fNoiseFraction = 0.2;
+double fNoiseChargeScale = 300;
+//83Kr lines: pairs of (energy [keV], relative intensity).
+std::vector<std::pair<double,double> > fKrLines;
+
+/// Main function.
+int main(int argc, char* argv[]);
+
+/// Configuration file parsing function.
+void ParseConfigFile(const std::string& configFile);
+
+// Display usage.
+void DisplayUsage()
+{
+  std::cerr << "\nUsage:\n\tKryptonSynth -o outputPrefix "
+    "[ (-c / --config) configFilePath] \n"
+            << std::endl;
+  exit(-1);
+}
@@ -0,0 +1,175 @@
+/**
+  \file
+  Recorder of per-thread time spans in the Chrome trace-event format
+  (viewable in chrome://tracing or Perfetto). Used to find stalls and
+  load imbalance between the pipeline tasks (file opening, tree
+  decoding, filling, fitting, QA page rendering). Recording is off
+  unless a trace file is set. At most kMaxSpans spans are kept, later
+  ones are only counted.
+
+  \author B. Rumberger
+  \version $Id:    $
+  \date 17 October 2026
+*/
+
+#ifndef _KryptonTrace_h_
+#define _KryptonTrace_h_
+
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <unistd.h>
+
+class TraceRecorder {
+public:
+  /// Spans kept in memory, about 100 MB.
+  static const size_t kMaxSpans = 1000000;
+
+  /// Records one span from construction to destruction.
+  class Span {
+  public:
+    Span(TraceRecorder& recorder, const std::string& name, const std::string& detail = "") :
+      fRecorder(recorder), fName(name), fDetail(detail),
+      fStart(std::chrono::steady_clock::now()) { }
+    ~Span() { Stop(); }
+    void Stop()
+    {
+      if (fStopped)
+        return;
+      fStopped = true;
+      fRecorder.AddSpan(fName,fStart,std::chrono::steady_clock::now(),fDetail);
+    }
+  private:
+    TraceRecorder& fRecorder;
+    const std::string fName;
+    const std::string fDetail;
+    const std::chrono::steady_clock::time_point fStart;
+    bool fStopped = false;
+  };
+
+  TraceRecorder() : fStart(std::chrono::steady_clock::now()) { }
+
+  /// Enable recording. Events are written to filename by Write().
+  void Enable(const std::string& filename) { fFilename = filename; fEnabled = true; }
+  bool IsEnabled() const { return fEnabled; }
+  const std::string& GetFilename() const { return fFilename; }
+
+  /// Name the calling thread in the trace viewer.
+  void SetThreadName(const std::string& name)
+  {
+    if (!fEnabled)
+      return;
+    std::lock_guard<std::mutex> lock(fMutex);
+    fThreadNames[GetThreadIndex()] = name;
+  }
+
+  void AddSpan(const std::string& name,
+               const std::chrono::steady_clock::time_point& start,
+               const std::chrono::steady_clock::time_point& stop,
+               const std::string& detail = "")
+  {
+    if (!fEnabled)
+      return;
+    std::lock_guard<std::mutex> lock(fMutex);
+    if (fEvents.size() >= kMaxSpans) {
+      ++fDroppedSpans;
+      return;
+    }
+    TraceEvent event;
+    event.fName = name;
+    event.fDetail = detail;
+    event.fThread = GetThreadIndex();
+    event.fStart = std::chrono::duration<double,std::micro>(start - fStart).count();
+    event.fDuration = std::chrono::duration<double,std::micro>(stop - start).count();
+    fEvents.push_back(event);
+  }
+
+  /// Write all recorded events as a Chrome trace JSON file.
+  bool Write() const
+  {
+    if (!fEnabled)
+      return false;
+    std::ofstream file(fFilename);
+    if (!file.is_open()) {
+      std::cout << "[ERROR] Could not create trace file " << fFilename << "!" << std::endl;
+      return false;
+    }
+    std::lock_guard<std::mutex> lock(fMutex);
+    const int pid = getpid();
+    file << std::fixed;
+    file.precision(3);
+    file << "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [";
+    bool first = true;
+    for (auto it = fThreadNames.begin(), itEnd = fThreadNames.end(); it != itEnd; ++it) {
+      file << (first ? "\n" : ",\n")
+           << "{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": " << pid
+           << ", \"tid\": " << it->first
+           << ", \"args\": {\"name\": \"" << Escape(it->second) << "\"}}";
+      first = false;
+    }
+    for (auto it = fEvents.begin(), itEnd = fEvents.end(); it != itEnd; ++it) {
+      file << (first ? "\n" : ",\n")
+           << "{\"name\": \"" << Escape(it->fName) << "\", \"cat\": \"krypton\", \"ph\": \"X\""
+           << ", \"ts\": " << it->fStart << ", \"dur\": " << it->fDuration
+           << ", \"pid\": " << pid << ", \"tid\": " << it->fThread;
+      if (!it->fDetail.empty())
+        file << ", \"args\": {\"detail\": \"" << Escape(it->fDetail) << "\"}";
+      file << "}";
+      first = false;
+    }
+    file << "\n]}\n";
+    std::cout << "[INFO] Trace with " << fEvents.size() << " spans written to file "
+              << fFilename << std::endl;
+    if (fDroppedSpans > 0)
+      std::cout << "[WARNING] " << fDroppedSpans << " spans after the first " << kMaxSpans
+                << " were not recorded." << std::endl;
+    return file.good();
+  }
+
+private:
+  struct TraceEvent {
+    std::string fName;
+    std::string fDetail;
+    unsigned int fThread;
+    double fStart;
+    double fDuration;
+  };
+
+  /// Small consecutive thread ids for the viewer. Caller holds the lock.
+  unsigned int GetThreadIndex()
+  {
+    const std::thread::id id = std::this_thread::get_id();
+    auto it = fThreadIndices.find(id);
+    if (it == fThreadIndices.end())
+      it = fThreadIndices.insert(std::make_pair(id,(unsigned int)fThreadIndices.size())).first;
+    return it->second;
+  }
+
+  static std::string Escape(const std::string& text)
+  {
+    std::string escaped;
+    for (auto it = text.begin(), itEnd = text.end(); it != itEnd; ++it) {
+      if (*it == '"' || *it == '\\')
+        escaped += '\\';
+      escaped += *it;
+    }
+    return escaped;
+  }
+
+  bool fEnabled = false;
+  std::string fFilename;
+  mutable std::mutex fMutex;
+  std::vector<TraceEvent> fEvents;
+  unsigned long long fDroppedSpans = 0;
+  std::map<std::thread::id, unsigned int> fThreadIndices;
+  std::map<unsigned int, std::string> fThreadNames;
+  const std::chrono::steady_clock::time_point fStart;
+};
+
+#endif
@@ -0,0 +1,95 @@
+/**
+  \file
+  Validation of Krypton cluster input files before the analysis. A file
+  is good if it opens, was closed properly (ROOT did not have to recover
+  its keys, as for truncated files), has keys, and every tree is named
+  [TPCName]Sector[SectorId]Clusters and has the cluster branches.
+  Optionally all baskets are read and decompressed,
+  which finds corrupted baskets that would otherwise fail in the fill
+  loop. Bad files go to a quarantine list instead of the analysis.
+
+  \author B. Rumberger
+  \version $Id:    $
+  \date 17 October 2026
+*/
+
+#ifndef _KryptonValidation_h_
+#define _KryptonValidation_h_
+
+#include <memory>
+#include <string>
+
+#include <TFile.h>
+#include <TKey.h>
+#include <TTree.h>
+
+/// Branches read by ClusterBlock.
+const char* const kClusterBranches[] = {
+  "fCharge", "fMaxADC", "fTimeSlice", "fNPixels",
+  "fNTimeSlices", "fNPads", "fPadrow", "fPad"
+};
+
+/// Split a sector tree name, [TPCName]Sector[SectorId]Clusters, into the
+/// TPC name and the sector id. Returns false if the name is not of this
+/// form or the sector id is not a number.
+inline bool ParseSectorTreeName(const std::string& treeName,
+                                std::string& tpcName,
+                                unsigned int& sectorId)
+{
+  const std::string::size_type sectorStart = treeName.find("Sector");
+  if (sectorStart == std::string::npos)
+    return false;
+  const std::string::size_type sectorIdStart = sectorStart + 6;
+  const std::string::size_type sectorIdStop = treeName.find("Clusters",sectorIdStart);
+  if (sectorIdStop == std::string::npos || sectorIdStop == sectorIdStart ||
+      sectorIdStop + 8 != treeName.size())
+    return false;
+  const std::string sectorIdString = treeName.substr(sectorIdStart,sectorIdStop - sectorIdStart);
+  if (sectorIdString.size() > 9 ||
+      sectorIdString.find_first_not_of("0123456789") != std::string::npos)
+    return false;
+  tpcName = treeName.substr(0,sectorStart);
+  sectorId = std::stoul(sectorIdString);
+  return true;
+}
+
+/// Check one input file. With readBaskets, every entry of every tree is
+/// read. Returns an empty string for a good file, and the reason otherwise.
+inline std::string ValidateInputFile(const std::string& filename, const bool readBaskets)
+{
+  TFile file(filename.c_str(),"READ");
+  if (file.IsZombie())
+    return "cannot be opened";
+  if (file.TestBit(TFile::kRecovered))
+    return "was not closed properly (keys recovered)";
+  if (file.GetNkeys() == 0)
+    return "has no keys";
+
+  TIter keyIter(file.GetListOfKeys());
+  TKey* key;
+  while ((key = (TKey*)keyIter())) {
+    if (std::string(key->GetClassName()) != "TTree")
+      continue;
+    std::string tpcName;
+    unsigned int sectorId;
+    if (!ParseSectorTreeName(key->GetName(),tpcName,sectorId))
+      return std::string("tree ") + key->GetName() + " is not named [TPCName]Sector[SectorId]Clusters";
+    std::unique_ptr<TObject> object(key->ReadObj());
+    TTree* tree = dynamic_cast<TTree*>(object.get());
+    if (tree == nullptr)
+      return std::string("tree ") + key->GetName() + " cannot be read";
+    for (unsigned int i = 0; i < sizeof(kClusterBranches)/sizeof(kClusterBranches[0]); ++i)
+      if (tree->GetBranch(kClusterBranches[i]) == nullptr)
+        return std::string("tree ") + key->GetName() + " has no branch " + kClusterBranches[i];
+    if (readBaskets) {
+      const Long64_t nEntries = tree->GetEntries();
+      for (Long64_t entry = 0; entry < nEntries; ++entry)
+        if (tree->GetEntry(entry) < 0)
+          return std::string("tree ") + key->GetName() +
+            " has an unreadable basket at entry " + std::to_string(entry);
+    }
+  }
+  return "";
+}
+
+#endif
@@ -0,0 +1,103 @@
+#!/bin/bash
+
+#Long-run memory check for KryptonAnalyzer. Generates a few synthetic
+#files with KryptonSynth and runs the analyzer on growing input lists
+#(the same files repeated), doubling the file count each run. The peak
+#RSS during the fill must stay flat: it may grow by at most the given
+#limit from the first to the last run. Leaked TFiles, trees or QA objects
+#per input file show up as growth proportional to the file count. The
+#fill phases are timed per cluster block and do not sample the RSS, so
+#the fill peak RSS is the one at the end of the last file opening, after
+#all earlier files were filled.
+
+if [[ $# -lt 1 || $# -gt 4 ]]
+then
+    echo "Incorrect usage! Usage: ./runMemoryHarness.sh [Work Directory] [Max Files (default 256)] [Distinct Files (default 8)] [Max RSS Growth MB (default 20)]"
+    exit 1
+fi
+
+workDirectory=$1
+maxFiles=${2:-256}
+nDistinctFiles=${3:-8}
+maxGrowth=${4:-20}
+
+#Output prefixes are taken relative to the current directory.
+if [[ $workDirectory == /* ]]
+then
+    echo '[ERROR] Work directory must be relative to the current directory.'
+    exit 1
+fi
+
+analyzerName=`pwd`'/KryptonAnalyzer'
+synthName=`pwd`'/KryptonSynth'
+
+for exe in $analyzerName $synthName
+do
+    if [[ ! -x $exe ]]
+    then
+	echo '[ERROR] '$exe' not found. Run make first.'
+	exit 1
+    fi
+done
+
+mkdir -p $workDirectory
+
+echo '[INFO] Work directory: '$workDirectory
+echo '[INFO] Distinct synthetic files: '$nDistinctFiles'. Maximum input list: '$maxFiles' files'
+echo '[INFO] Maximum peak RSS growth: '$maxGrowth' MB'
+
+#Generate the distinct files once.
+synthConfig=$workDirectory'/SynthConfig.txt'
+sed -e 's/^nFiles .*/nFiles '$nDistinctFiles'/' SynthConfig.txt > $synthConfig
+if [[ `ls $workDirectory/synth-*-krCalibration.root 2>/dev/null | wc -l` -ne $nDistinctFiles ]]
+then
+    rm -f $workDirectory/synth-*-krCalibration.root
+    $synthName -c $synthConfig -o $workDirectory/synth > $workDirectory/synth.log || exit 1
+fi
+distinctFiles=(`ls $workDirectory/synth-*-krCalibration.root`)
+
+summaryFile=$workDirectory'/memory.csv'
+echo 'files,wallTime,fillPeakRSS,peakRSS' > $summaryFile
+firstFillPeakRSS=
+
+for ((nFiles = nDistinctFiles; nFiles <= maxFiles; nFiles *= 2))
+do
+    inputFiles=()
+    for ((i = 0; i < nFiles; ++i))
+    do
+	inputFiles+=(${distinctFiles[$((i % nDistinctFiles))]})
+    done
+    prefix=$workDirectory'/memory-'$nFiles
+    $analyzerName -o $prefix -i "${inputFiles[@]}" > $prefix.log 2>&1
+    timingFile=$prefix'-KryptonAnalysis-Timing.json'
+    if [[ ! -f $timingFile ]]
+    then
+	echo '[ERROR] Analyzer failed with '$nFiles' files. See '$prefix'.log'
+	exit 1
+    fi
+    wallTime=`sed -n 's/.*"totalWallTime": \([0-9.e+-]*\),.*/\1/p' $timingFile`
+    fillPeakRSS=`sed -n 's/.*"name": "fileOpen".*"peakRSS": \([0-9]*\),.*/\1/p' $timingFile`
+    peakRSS=`sed -n 's/^  "peakRSS": \([0-9]*\),.*/\1/p' $timingFile`
+    if [[ -z $fillPeakRSS || $fillPeakRSS -eq 0 ]]
+    then
+	echo '[ERROR] No fileOpen peak RSS in '$timingFile'.'
+	exit 1
+    fi
+    if [[ -z $firstFillPeakRSS ]]
+    then
+	firstFillPeakRSS=$fillPeakRSS
+    fi
+    echo '[INFO] '$nFiles' files: '$wallTime' s, fill peak RSS '$((fillPeakRSS/1000000))' MB, peak RSS '$((peakRSS/1000000))' MB'
+    echo $nFiles','$wallTime','$fillPeakRSS','$peakRSS >> $summaryFile
+    lastFillPeakRSS=$fillPeakRSS
+done
+
+growth=$(((lastFillPeakRSS - firstFillPeakRSS)/1000000))
+echo '[INFO] Memory summary written to '$summaryFile
+if [[ $growth -gt $maxGrowth ]]
+then
+    echo '[ERROR] Fill peak RSS grew by '$growth' MB with the file count!'
+    exit 1
+fi
+echo '[INFO] Fill peak RSS stays flat (growth '$growth' MB).'
+exit 0
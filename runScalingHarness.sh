@@ -0,0 +1,147 @@
+#!/bin/bash
+
+#Thread scaling harness for KryptonAnalyzer. Generates a fixed synthetic
+#dataset with KryptonSynth, runs the analyzer at 1, 2, 4, ... threads, and
+#reports strong scaling (all files at every thread count) and weak scaling
+#(filesPerThread files per thread). Every strong-scaling output is checked
+#against the single-threaded (golden) output with KryptonCompare. With
+#NUMA set to yes, strong scaling is repeated with --numa (workers pinned to
+#NUMA nodes, node-local histograms, per-node merge) for comparison.
+
+if [[ $# -lt 2 || $# -gt 5 ]]
+then
+    echo "Incorrect usage! Usage: ./runScalingHarness.sh [Work Directory] [Max Threads] [Files Per Thread (default 2)] [Relative Tolerance (default 1e-6)] [NUMA: yes/no (default no)]"
+    exit 1
+fi
+
+workDirectory=$1
+maxThreads=$2
+filesPerThread=${3:-2}
+tolerance=${4:-1e-6}
+numa=${5:-no}
+
+#Output prefixes are taken relative to the current directory.
+if [[ $workDirectory == /* ]]
+then
+    echo '[ERROR] Work directory must be relative to the current directory.'
+    exit 1
+fi
+
+analyzerName=`pwd`'/KryptonAnalyzer'
+synthName=`pwd`'/KryptonSynth'
+compareName=`pwd`'/KryptonCompare'
+
+for exe in $analyzerName $synthName $compareName
+do
+    if [[ ! -x $exe ]]
+    then
+	echo '[ERROR] '$exe' not found. Run make first.'
+	exit 1
+    fi
+done
+
+mkdir -p $workDirectory
+nFiles=$((maxThreads*filesPerThread))
+
+echo '[INFO] Work directory: '$workDirectory
+echo '[INFO] Maximum threads: '$maxThreads'. Files per thread (weak scaling): '$filesPerThread
+echo '[INFO] Number of synthetic files: '$nFiles'. Tolerance: '$tolerance
+
+#Generate the dataset once. The seed in SynthConfig.txt fixes its content.
+synthConfig=$workDirectory'/SynthConfig.txt'
+sed -e 's/^nFiles .*/nFiles '$nFiles'/' SynthConfig.txt > $synthConfig
+if [[ `ls $workDirectory/synth-*-krCalibration.root 2>/dev/null | wc -l` -ne $nFiles ]]
+then
+    rm -f $workDirectory/synth-*-krCalibration.root
+    $synthName -c $synthConfig -o $workDirectory/synth > $workDirectory/synth.log || exit 1
+fi
+inputFiles=(`ls $workDirectory/synth-*-krCalibration.root`)
+
+#Thread counts: powers of two up to maxThreads, and maxThreads itself.
+threadCounts=""
+for ((threads = 1; threads < maxThreads; threads *= 2))
+do
+    threadCounts=$threadCounts' '$threads
+done
+threadCounts=$threadCounts' '$maxThreads
+
+#Run the analyzer and print its total wall time.
+function runAnalyzer {
+    local prefix=$1
+    local threads=$2
+    local options=$3
+    shift 3
+    $analyzerName -j $threads $options -o $prefix -i "$@" > $prefix.log 2>&1 || return 1
+    sed -n 's/.*"totalWallTime": \([0-9.e+-]*\),.*/\1/p' $prefix-KryptonAnalysis-Timing.json
+}
+
+summaryFile=$workDirectory'/scaling.csv'
+echo 'mode,threads,files,wallTime,efficiency,matchesGolden' > $summaryFile
+status=0
+
+#Strong scaling. The single-threaded run is the golden output.
+goldenPrefix=$workDirectory'/strong-1'
+strongModes='strong'
+if [[ $numa == yes ]]
+then
+    strongModes='strong strong-numa'
+fi
+for mode in $strongModes
+do
+    options=''
+    if [[ $mode == strong-numa ]]
+    then
+	options='--numa'
+    fi
+    for threads in $threadCounts
+    do
+	prefix=$workDirectory'/'$mode'-'$threads
+	wallTime=`runAnalyzer $prefix $threads "$options" "${inputFiles[@]}"`
+	if [[ -z $wallTime ]]
+	then
+	    echo '[ERROR] Analyzer failed with '$threads' threads. See '$prefix'.log'
+	    exit 1
+	fi
+	if [[ $threads -eq 1 && $mode == strong ]]
+	then
+	    strongReference=$wallTime
+	    matches='golden'
+	elif $compareName -r $goldenPrefix -t $prefix --tolerance $tolerance > $prefix-compare.log
+	then
+	    matches='yes'
+	else
+	    matches='no'
+	    status=1
+	fi
+	efficiency=`echo "$strongReference $wallTime $threads" | awk '{printf "%.3f", $1/($2*$3)}'`
+	echo '[INFO] Strong scaling ('$mode'): '$threads' threads, '${#inputFiles[@]}' files: '$wallTime' s, efficiency '$efficiency', matches golden: '$matches
+	echo $mode','$threads','${#inputFiles[@]}','$wallTime','$efficiency','$matches >> $summaryFile
+    done
+done
+
+#Weak scaling.
+for threads in $threadCounts
+do
+    prefix=$workDirectory'/weak-'$threads
+    nWeakFiles=$((threads*filesPerThread))
+    wallTime=`runAnalyzer $prefix $threads "" "${inputFiles[@]:0:$nWeakFiles}"`
+    if [[ -z $wallTime ]]
+    then
+	echo '[ERROR] Analyzer failed with '$threads' threads. See '$prefix'.log'
+	exit 1
+    fi
+    if [[ $threads -eq 1 ]]
+    then
+	weakReference=$wallTime
+    fi
+    efficiency=`echo "$weakReference $wallTime" | awk '{printf "%.3f", $1/$2}'`
+    echo '[INFO] Weak scaling: '$threads' threads, '$nWeakFiles' files: '$wallTime' s, efficiency '$efficiency
+    echo 'weak,'$threads','$nWeakFiles','$wallTime','$efficiency',' >> $summaryFile
+done
+
+echo '[INFO] Scaling summary written to '$summaryFile
+if [[ $status -ne 0 ]]
+then
+    echo '[ERROR] Some outputs differ from the golden single-threaded output!'
+fi
+exit $status